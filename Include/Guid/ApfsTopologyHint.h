@@ -0,0 +1,66 @@
+/** @file
+
+Apple FileSystem topology hint stored in NVRAM by ApfsDriverLoader
+
+Copyright (c) 2018, savvas
+
+All rights reserved.
+
+This program and the accompanying materials
+are licensed and made available under the terms and conditions of the BSD License
+which accompanies this distribution.  The full text of the license may be found at
+http://opensource.org/licenses/bsd-license.php
+
+THE PROGRAM IS DISTRIBUTED UNDER THE BSD LICENSE ON AN "AS IS" BASIS,
+WITHOUT WARRANTIES OR REPRESENTATIONS OF ANY KIND, EITHER EXPRESS OR IMPLIED.
+
+**/
+
+#ifndef APFS_TOPOLOGY_HINT_GUID_H_
+#define APFS_TOPOLOGY_HINT_GUID_H_
+
+#define APFS_TOPOLOGY_HINT_VARIABLE_GUID \
+  { 0x7C3A9E15, 0x4B2D, 0x4F68, {0x8E, 0x21, 0xD5, 0x6B, 0x93, 0x0A, 0x7F, 0x4C } }
+
+#define APFS_TOPOLOGY_HINT_VARIABLE_NAME  L"ApfsTopologyHint"
+
+#define APFS_TOPOLOGY_HINT_REVISION       0x00000001
+
+//
+// Maximum amount of remembered controllers, the oldest entry is dropped first
+//
+#define APFS_TOPOLOGY_HINT_MAX_ENTRIES    8
+
+typedef struct _APFS_TOPOLOGY_HINT_ENTRY
+{
+    //
+    // CRC32 of the controller device path
+    //
+    UINT32                                      DevicePathHash;
+    UINT32                                      Reserved;
+    //
+    // UUID of the container found on the controller
+    //
+    EFI_GUID                                    ContainerUuid;
+    //
+    // Byte offset of the container on the controller (non-zero for legacy scan)
+    //
+    UINT64                                      ContainerOffset;
+} APFS_TOPOLOGY_HINT_ENTRY;
+
+typedef struct _APFS_TOPOLOGY_HINT
+{
+    //
+    // APFS_TOPOLOGY_HINT_REVISION
+    //
+    UINT32                                      Revision;
+    UINT32                                      NumberOfEntries;
+    //
+    // Only NumberOfEntries entries are stored in the variable
+    //
+    APFS_TOPOLOGY_HINT_ENTRY                    Entries[APFS_TOPOLOGY_HINT_MAX_ENTRIES];
+} APFS_TOPOLOGY_HINT;
+
+extern EFI_GUID gApfsTopologyHintVariableGuid;
+
+#endif // APFS_TOPOLOGY_HINT_GUID_H_
@@ -0,0 +1,253 @@
+/** @file
+
+AppleUiSupport protocol call trace.
+Recording is enabled by a non-zero APPLE_UI_SUPPORT_TRACE_VARIABLE_NAME
+variable, the trace is written to APPLE_UI_SUPPORT_TRACE_FILE_NAME on the
+volume AppleUiSupport was loaded from and is replayed by Tools/UiTraceReplay.
+
+Copyright (c) 2018, savvas
+
+All rights reserved.
+
+This program and the accompanying materials
+are licensed and made available under the terms and conditions of the BSD License
+which accompanies this distribution.  The full text of the license may be found at
+http://opensource.org/licenses/bsd-license.php
+
+THE PROGRAM IS DISTRIBUTED UNDER THE BSD LICENSE ON AN "AS IS" BASIS,
+WITHOUT WARRANTIES OR REPRESENTATIONS OF ANY KIND, EITHER EXPRESS OR IMPLIED.
+
+**/
+
+#ifndef APPLE_UI_SUPPORT_TRACE_GUID_H_
+#define APPLE_UI_SUPPORT_TRACE_GUID_H_
+
+#define APPLE_UI_SUPPORT_TRACE_VARIABLE_GUID \
+  { 0x3E6A1F52, 0x9C84, 0x4B27, {0xA5, 0x3D, 0x61, 0xE0, 0x8F, 0x2C, 0xB7, 0x94 } }
+
+#define APPLE_UI_SUPPORT_TRACE_VARIABLE_NAME  L"AppleUiSupportTrace"
+
+#define APPLE_UI_SUPPORT_TRACE_FILE_NAME      L"\\AppleUiSupport.trace"
+
+#define APPLE_UI_SUPPORT_TRACE_SIGNATURE      SIGNATURE_32 ('U', 'i', 'T', 'r')
+
+#define APPLE_UI_SUPPORT_TRACE_REVISION       0x00000001
+
+#define APPLE_UI_SUPPORT_TRACE_DIGEST_SIZE    32
+
+//
+// Record types
+//
+#define APPLE_UI_SUPPORT_TRACE_BLOB             0
+#define APPLE_UI_SUPPORT_TRACE_DROPPED          1
+#define APPLE_UI_SUPPORT_TRACE_IMAGE_CODEC      2
+#define APPLE_UI_SUPPORT_TRACE_KEY_MAP          3
+#define APPLE_UI_SUPPORT_TRACE_HASH             4
+#define APPLE_UI_SUPPORT_TRACE_COLLATION        5
+#define APPLE_UI_SUPPORT_TRACE_FIRMWARE_VOLUME  6
+#define APPLE_UI_SUPPORT_TRACE_MAX_TYPE         7
+
+//
+// APPLE_UI_SUPPORT_TRACE_IMAGE_CODEC functions
+//
+#define APPLE_UI_SUPPORT_TRACE_RECOGNIZE_IMAGE_DATA     0
+#define APPLE_UI_SUPPORT_TRACE_GET_IMAGE_DIMS           1
+#define APPLE_UI_SUPPORT_TRACE_DECODE_IMAGE_DATA        2
+#define APPLE_UI_SUPPORT_TRACE_GET_IMAGE_DIMS_VER       3
+#define APPLE_UI_SUPPORT_TRACE_DECODE_IMAGE_DATA_VER    4
+
+//
+// APPLE_UI_SUPPORT_TRACE_KEY_MAP functions
+//
+#define APPLE_UI_SUPPORT_TRACE_CREATE_KEY_STROKES_BUFFER  0
+#define APPLE_UI_SUPPORT_TRACE_REMOVE_KEY_STROKES_BUFFER  1
+#define APPLE_UI_SUPPORT_TRACE_SET_KEY_STROKE_BUFFER_KEYS 2
+#define APPLE_UI_SUPPORT_TRACE_GET_KEY_STROKES            3
+#define APPLE_UI_SUPPORT_TRACE_CONTAINS_KEY_STROKES       4
+#define APPLE_UI_SUPPORT_TRACE_COMPILE_CHORDS             5
+#define APPLE_UI_SUPPORT_TRACE_MATCH_CHORDS               6
+#define APPLE_UI_SUPPORT_TRACE_FREE_CHORDS                7
+
+//
+// APPLE_UI_SUPPORT_TRACE_HASH functions
+//
+#define APPLE_UI_SUPPORT_TRACE_CREATE_CHILD   0
+#define APPLE_UI_SUPPORT_TRACE_DESTROY_CHILD  1
+#define APPLE_UI_SUPPORT_TRACE_GET_HASH_SIZE  2
+#define APPLE_UI_SUPPORT_TRACE_HASH_MESSAGE   3
+
+//
+// APPLE_UI_SUPPORT_TRACE_COLLATION functions
+//
+#define APPLE_UI_SUPPORT_TRACE_STRI_COLL      0
+#define APPLE_UI_SUPPORT_TRACE_METAI_MATCH    1
+#define APPLE_UI_SUPPORT_TRACE_STR_LWR        2
+#define APPLE_UI_SUPPORT_TRACE_STR_UPR        3
+#define APPLE_UI_SUPPORT_TRACE_FAT_TO_STR     4
+#define APPLE_UI_SUPPORT_TRACE_STR_TO_FAT     5
+
+//
+// APPLE_UI_SUPPORT_TRACE_FIRMWARE_VOLUME functions
+//
+#define APPLE_UI_SUPPORT_TRACE_READ_SECTION   0
+
+#pragma pack(push, 1)
+
+//
+// The file starts with this header followed by records
+//
+typedef struct _APPLE_UI_SUPPORT_TRACE_HEADER
+{
+    //
+    // APPLE_UI_SUPPORT_TRACE_SIGNATURE
+    //
+    UINT32                                      Signature;
+    //
+    // APPLE_UI_SUPPORT_TRACE_REVISION
+    //
+    UINT32                                      Revision;
+} APPLE_UI_SUPPORT_TRACE_HEADER;
+
+typedef struct _APPLE_UI_SUPPORT_TRACE_RECORD
+{
+    //
+    // APPLE_UI_SUPPORT_TRACE_* record type
+    //
+    UINT16                                      Type;
+    //
+    // Protocol function of the record type
+    //
+    UINT16                                      Function;
+    //
+    // Size of the payload following the record
+    //
+    UINT32                                      Size;
+} APPLE_UI_SUPPORT_TRACE_RECORD;
+
+//
+// APPLE_UI_SUPPORT_TRACE_BLOB payload, followed by the blob data.
+// Blobs are written once, the first time a call references their digest.
+//
+typedef struct _APPLE_UI_SUPPORT_TRACE_BLOB_DATA
+{
+    //
+    // SHA-256 of the data
+    //
+    UINT8                                       Digest[APPLE_UI_SUPPORT_TRACE_DIGEST_SIZE];
+} APPLE_UI_SUPPORT_TRACE_BLOB_DATA;
+
+//
+// APPLE_UI_SUPPORT_TRACE_DROPPED payload
+//
+typedef struct _APPLE_UI_SUPPORT_TRACE_DROPPED_DATA
+{
+    //
+    // Calls which could not be recorded since the previous record
+    //
+    UINT32                                      NumberOfCalls;
+} APPLE_UI_SUPPORT_TRACE_DROPPED_DATA;
+
+//
+// APPLE_UI_SUPPORT_TRACE_IMAGE_CODEC payload
+//
+typedef struct _APPLE_UI_SUPPORT_TRACE_IMAGE_CODEC_DATA
+{
+    //
+    // Digest of the image blob
+    //
+    UINT8                                       Digest[APPLE_UI_SUPPORT_TRACE_DIGEST_SIZE];
+    UINT64                                      ImageSize;
+    UINT64                                      Version;
+    //
+    // Target mode of DecodeImageDataVer APPLE_IMAGE_CODEC_DECODE_GOP_VERSION
+    //
+    UINT32                                      PixelFormat;
+    UINT32                                      RedMask;
+    UINT32                                      GreenMask;
+    UINT32                                      BlueMask;
+    UINT32                                      ReservedMask;
+} APPLE_UI_SUPPORT_TRACE_IMAGE_CODEC_DATA;
+
+//
+// APPLE_UI_SUPPORT_TRACE_KEY_MAP payload.
+// ContainsKeyStrokes is followed by NumberOfKeyCodes UINT16 key codes and
+// CompileChords by Count APPLE_UI_SUPPORT_TRACE_CHORD entries. Pressed keys
+// passed to SetKeyStrokeBufferKeys are never recorded, only their number.
+//
+typedef struct _APPLE_UI_SUPPORT_TRACE_KEY_MAP_DATA
+{
+    //
+    // Key strokes buffer index, chord set, or non-zero when GetKeyStrokes
+    // was given a key code buffer
+    //
+    UINT64                                      Id;
+    //
+    // Buffer length, number of key codes, chords or chord ids
+    //
+    UINT64                                      Count;
+    UINT16                                      Modifiers;
+    UINT8                                       ExactMatch;
+    UINT8                                       Reserved;
+    UINT32                                      Reserved2;
+} APPLE_UI_SUPPORT_TRACE_KEY_MAP_DATA;
+
+typedef struct _APPLE_UI_SUPPORT_TRACE_CHORD
+{
+    UINT64                                      ChordId;
+    UINT16                                      Modifiers;
+    UINT8                                       ExactMatch;
+    UINT8                                       NumberOfKeyCodes;
+    UINT16                                      KeyCodes[6];
+} APPLE_UI_SUPPORT_TRACE_CHORD;
+
+//
+// APPLE_UI_SUPPORT_TRACE_HASH payload.
+// Messages are never recorded, only their size.
+//
+typedef struct _APPLE_UI_SUPPORT_TRACE_HASH_DATA
+{
+    //
+    // Hash protocol instance of the child
+    //
+    UINT64                                      Id;
+    EFI_GUID                                    HashAlgorithm;
+    UINT64                                      MessageSize;
+    UINT8                                       Extend;
+    UINT8                                       Reserved[7];
+} APPLE_UI_SUPPORT_TRACE_HASH_DATA;
+
+//
+// APPLE_UI_SUPPORT_TRACE_COLLATION payload.
+// Strings are file names, they are never recorded, only their length.
+//
+typedef struct _APPLE_UI_SUPPORT_TRACE_COLLATION_DATA
+{
+    //
+    // Length of the first and of the second string in characters without
+    // the null terminator. FatToStr stores the FAT name length in Length1,
+    // StrToFat the size of its FAT buffer in Length2.
+    //
+    UINT32                                      Length1;
+    UINT32                                      Length2;
+} APPLE_UI_SUPPORT_TRACE_COLLATION_DATA;
+
+//
+// APPLE_UI_SUPPORT_TRACE_FIRMWARE_VOLUME payload
+//
+typedef struct _APPLE_UI_SUPPORT_TRACE_FIRMWARE_VOLUME_DATA
+{
+    EFI_GUID                                    NameGuid;
+    UINT64                                      SectionInstance;
+    //
+    // Caller buffer size, zero when the section buffer is allocated
+    //
+    UINT64                                      BufferSize;
+    UINT8                                       SectionType;
+    UINT8                                       Reserved[7];
+} APPLE_UI_SUPPORT_TRACE_FIRMWARE_VOLUME_DATA;
+
+#pragma pack(pop)
+
+extern EFI_GUID gAppleUiSupportTraceVariableGuid;
+
+#endif // APPLE_UI_SUPPORT_TRACE_GUID_H_
@@ -0,0 +1,114 @@
+/** @file
+
+Apple FileSystem container and volume info gathered by ApfsDriverLoader
+
+Copyright (c) 2018, savvas
+
+All rights reserved.
+
+This program and the accompanying materials
+are licensed and made available under the terms and conditions of the BSD License
+which accompanies this distribution.  The full text of the license may be found at
+http://opensource.org/licenses/bsd-license.php
+
+THE PROGRAM IS DISTRIBUTED UNDER THE BSD LICENSE ON AN "AS IS" BASIS,
+WITHOUT WARRANTIES OR REPRESENTATIONS OF ANY KIND, EITHER EXPRESS OR IMPLIED.
+
+**/
+
+#ifndef APPLE_FILESYSTEM_CONTAINER_INFO_PROTOCOL_H_
+#define APPLE_FILESYSTEM_CONTAINER_INFO_PROTOCOL_H_
+
+#define APPLE_FILESYSTEM_CONTAINER_INFO_PROTOCOL_GUID \
+  { 0x5D4B7F2E, 0x8A61, 0x4C3D, {0xB0, 0x9E, 0x27, 0x1F, 0x6A, 0xC4, 0x53, 0x8D } }
+
+//
+// Revision 1: container geometry and per-volume superblock fields
+//
+#define APPLE_FILESYSTEM_CONTAINER_INFO_PROTOCOL_REVISION  0x00000001
+
+//
+// Maximum amount of volumes in one container (NXSB max_file_systems)
+//
+#define APPLE_FILESYSTEM_MAX_VOLUMES                       100
+
+//
+// Volume roles (APSB apfs_role)
+//
+#define APPLE_FILESYSTEM_VOLUME_ROLE_NONE                  0x0000
+#define APPLE_FILESYSTEM_VOLUME_ROLE_SYSTEM                0x0001
+#define APPLE_FILESYSTEM_VOLUME_ROLE_USER                  0x0002
+#define APPLE_FILESYSTEM_VOLUME_ROLE_RECOVERY              0x0004
+#define APPLE_FILESYSTEM_VOLUME_ROLE_VM                    0x0008
+#define APPLE_FILESYSTEM_VOLUME_ROLE_PREBOOT               0x0010
+
+typedef struct _APPLE_FILESYSTEM_VOLUME_INFO
+{
+    //
+    // Index of the volume in the container
+    //
+    UINT32                                      Index;
+    //
+    // Volume role, see APPLE_FILESYSTEM_VOLUME_ROLE_*
+    //
+    UINT16                                      Role;
+    UINT16                                      Reserved;
+    //
+    // Virtual object id and resolved physical block of the volume superblock
+    //
+    UINT64                                      ObjectId;
+    UINT64                                      SuperblockBlock;
+    //
+    // Incompatible features (case sensitivity, normalization)
+    //
+    UINT64                                      IncompatibleFeatures;
+    //
+    // Volume flags (encryption state)
+    //
+    UINT64                                      Flags;
+    //
+    // Blocks allocated by this volume
+    //
+    UINT64                                      BlocksInUseCount;
+    //
+    // UUID of the volume
+    //
+    EFI_GUID                                    VolumeUuid;
+    //
+    // Null-terminated UTF-8 volume name
+    //
+    CHAR8                                       VolumeName[256];
+} APPLE_FILESYSTEM_VOLUME_INFO;
+
+typedef struct _APPLE_FILESYSTEM_CONTAINER_INFO
+{
+    //
+    // APPLE_FILESYSTEM_CONTAINER_INFO_PROTOCOL_REVISION
+    //
+    UINT32                                      Revision;
+    //
+    // Size of container allocation unit in bytes
+    //
+    UINT32                                      BlockSize;
+    //
+    // Number of blocks in the container
+    //
+    UINT64                                      TotalBlocks;
+    //
+    // Handle of partition which contains the container
+    //
+    EFI_HANDLE                                  ControllerHandle;
+    //
+    // UUID of the container
+    //
+    EFI_GUID                                    ContainerUuid;
+    //
+    // Volumes which superblocks were found and passed checksum verification
+    //
+    UINT32                                      NumberOfVolumes;
+    APPLE_FILESYSTEM_VOLUME_INFO                *Volumes;
+} APPLE_FILESYSTEM_CONTAINER_INFO;
+
+extern EFI_GUID gAppleFileSystemContainerInfoProtocolGuid;
+
+#endif // APPLE_FILESYSTEM_CONTAINER_INFO_PROTOCOL_H_
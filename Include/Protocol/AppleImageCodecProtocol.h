@@ -10,14 +10,39 @@
 // savvas: fixed RecognizeImageData structure and its function.
 //         code refactor and cleanup. use lodepng instead of picopng
 //********************************************************************
+// DecodeImageDataVer APPLE_IMAGE_CODEC_DECODE_GOP_VERSION decodes
+// straight into a Graphics Output pixel format. The protocol layout and
+// Version stay as Apple defined them, other codecs return EFI_UNSUPPORTED
+//********************************************************************
 
 #ifndef _APPLE_IMAGE_CODEC_H_
 #define _APPLE_IMAGE_CODEC_H_
 
+#include <Protocol/GraphicsOutput.h>
 
 #define APPLE_IMAGE_CODEC_PROTOCOL_GUID\
   { 0x0DFCE9F6, 0xC4E3, 0x45EE, {0xA0, 0x6A, 0xA8, 0x61, 0x3B, 0x98, 0xA5, 0x07 } }
 
+#define APPLE_IMAGE_CODEC_VERSION             0x20000
+
+//
+// DecodeImageDataVer version, which decodes for a Graphics Output mode.
+// On input *RawImageData points to APPLE_IMAGE_CODEC_GOP_DECODE_INFO,
+// on output it receives the pixel buffer and the codec fills the image
+// dimensions in the decode info.
+// Pixels are written in ModeInfo->PixelFormat layout, 4 bytes per pixel,
+// with alpha in the reserved byte (not inverted). PixelBltOnly produces
+// EFI_GRAPHICS_OUTPUT_BLT_PIXEL. PixelBitMask uses ModeInfo->PixelInformation.
+//
+#define APPLE_IMAGE_CODEC_DECODE_GOP_VERSION  2
+
+typedef struct _APPLE_IMAGE_CODEC_GOP_DECODE_INFO
+{
+    EFI_GRAPHICS_OUTPUT_MODE_INFORMATION  *ModeInfo;
+    UINT32                                ImageWidth;
+    UINT32                                ImageHeight;
+} APPLE_IMAGE_CODEC_GOP_DECODE_INFO;
+
 typedef EFI_STATUS (EFIAPI* RECOGNIZE_IMAGE_DATA) (
   VOID   *ImageBuffer,
   UINTN  ImageSize
@@ -0,0 +1,124 @@
+/** @file
+
+Apple KeyMap chord matcher protocol.
+Extends AppleKeyMapAggregator with evaluation of many precompiled key chords
+(boot hotkeys) in one pass over the aggregated key state.
+
+Copyright (c) 2018, savvas
+
+All rights reserved.
+
+This program and the accompanying materials
+are licensed and made available under the terms and conditions of the BSD License
+which accompanies this distribution.  The full text of the license may be found at
+http://opensource.org/licenses/bsd-license.php
+
+THE PROGRAM IS DISTRIBUTED UNDER THE BSD LICENSE ON AN "AS IS" BASIS,
+WITHOUT WARRANTIES OR REPRESENTATIONS OF ANY KIND, EITHER EXPRESS OR IMPLIED.
+
+**/
+
+#ifndef APPLE_KEY_MAP_CHORD_MATCHER_PROTOCOL_H_
+#define APPLE_KEY_MAP_CHORD_MATCHER_PROTOCOL_H_
+
+#include <Protocol/AppleKeyMapAggregator.h>
+
+#define APPLE_KEY_MAP_CHORD_MATCHER_PROTOCOL_GUID \
+  { 0x9F2E4B61, 0x3C7A, 0x4D85, {0xA1, 0x6E, 0x52, 0xB8, 0x0F, 0xD3, 0x47, 0x9C } }
+
+#define APPLE_KEY_MAP_CHORD_MATCHER_PROTOCOL_REVISION  0x00000001
+
+//
+// Maximum number of non-modifier keys in one chord
+//
+#define APPLE_KEY_MAP_CHORD_MAX_KEYS                   6
+
+typedef struct _APPLE_KEY_MAP_CHORD_MATCHER_PROTOCOL APPLE_KEY_MAP_CHORD_MATCHER_PROTOCOL;
+
+//
+// Opaque compiled chord set
+//
+typedef VOID *APPLE_KEY_MAP_CHORD_SET;
+
+typedef struct {
+  //
+  // Caller defined id returned on match
+  //
+  UINTN               ChordId;
+  APPLE_MODIFIER_MAP  Modifiers;
+  UINTN               NumberOfKeyCodes;
+  APPLE_KEY_CODE      KeyCodes[APPLE_KEY_MAP_CHORD_MAX_KEYS];
+  //
+  // Pressed keys and modifiers must equal the chord instead of containing it
+  //
+  BOOLEAN             ExactMatch;
+} APPLE_KEY_MAP_CHORD;
+
+/** Compiles a set of chords into bitmask predicates.
+
+  @param[in]  This            A pointer to the protocol instance.
+  @param[in]  NumberOfChords  The number of chords in Chords.
+  @param[in]  Chords          The chords to compile.
+  @param[out] ChordSet        The compiled chord set.
+
+  @retval EFI_SUCCESS            The chord set has been compiled.
+  @retval EFI_INVALID_PARAMETER  A chord has too many keys.
+  @retval EFI_UNSUPPORTED        Chord keys belong to different HID usage pages.
+  @retval EFI_OUT_OF_RESOURCES   The memory necessary could not be allocated.
+**/
+typedef
+EFI_STATUS
+(EFIAPI *APPLE_KEY_MAP_COMPILE_CHORDS) (
+  IN  APPLE_KEY_MAP_CHORD_MATCHER_PROTOCOL  *This,
+  IN  UINTN                                 NumberOfChords,
+  IN  CONST APPLE_KEY_MAP_CHORD             *Chords,
+  OUT APPLE_KEY_MAP_CHORD_SET               *ChordSet
+  );
+
+/** Returns ids of all chords of ChordSet matching currently pressed keys.
+    Chords are only evaluated again when the aggregated key state changed.
+
+  @param[in]      This              A pointer to the protocol instance.
+  @param[in]      ChordSet          The compiled chord set.
+  @param[in, out] NumberOfChordIds  On input the number of ids ChordIds holds.
+                                    On output the number of matched chords.
+  @param[out]     ChordIds          The matched chord ids in chord set order.
+
+  @retval EFI_SUCCESS           At least one chord matched.
+  @retval EFI_NOT_FOUND         No chord matched.
+  @retval EFI_BUFFER_TOO_SMALL  ChordIds is too small, the required number of
+                                ids has been returned in NumberOfChordIds.
+**/
+typedef
+EFI_STATUS
+(EFIAPI *APPLE_KEY_MAP_MATCH_CHORDS) (
+  IN     APPLE_KEY_MAP_CHORD_MATCHER_PROTOCOL  *This,
+  IN     APPLE_KEY_MAP_CHORD_SET               ChordSet,
+  IN OUT UINTN                                 *NumberOfChordIds,
+  OUT    UINTN                                 *ChordIds OPTIONAL
+  );
+
+/** Frees a compiled chord set.
+
+  @param[in] This      A pointer to the protocol instance.
+  @param[in] ChordSet  The compiled chord set.
+
+  @retval EFI_SUCCESS  The chord set has been freed.
+**/
+typedef
+EFI_STATUS
+(EFIAPI *APPLE_KEY_MAP_FREE_CHORDS) (
+  IN APPLE_KEY_MAP_CHORD_MATCHER_PROTOCOL  *This,
+  IN APPLE_KEY_MAP_CHORD_SET               ChordSet
+  );
+
+struct _APPLE_KEY_MAP_CHORD_MATCHER_PROTOCOL {
+  UINTN                         Revision;
+  APPLE_KEY_MAP_COMPILE_CHORDS  CompileChords;
+  APPLE_KEY_MAP_MATCH_CHORDS    MatchChords;
+  APPLE_KEY_MAP_FREE_CHORDS     FreeChords;
+};
+
+extern EFI_GUID gAppleKeyMapChordMatcherProtocolGuid;
+
+#endif // APPLE_KEY_MAP_CHORD_MATCHER_PROTOCOL_H_
@@ -24,8 +24,10 @@ WITHOUT WARRANTIES OR REPRESENTATIONS OF ANY KIND, EITHER EXPRESS OR IMPLIED.
 #include <Library/MemoryAllocationLib.h>
 #include <Library/UefiDriverEntryPoint.h>
 #include <Library/UefiBootServicesTableLib.h>
+#include <Library/UefiLib.h>
 #include <Library/UefiRuntimeServicesTableLib.h>
 #include <Library/AppleDxeImageVerificationLib.h>
+#include <Guid/ApfsTopologyHint.h>
 #include <Protocol/BlockIo.h>
 #include <Protocol/DiskIo.h>
 #include <Protocol/BlockIo2.h>
@@ -36,6 +38,7 @@ WITHOUT WARRANTIES OR REPRESENTATIONS OF ANY KIND, EITHER EXPRESS OR IMPLIED.
 #include <Protocol/PartitionInfo.h>
 #include <Protocol/ApplePartitionInfo.h>
 #include <Protocol/ApfsEfiBootRecordInfo.h>
+#include <Protocol/ApfsContainerInfo.h>
 #include <Protocol/NullTextOutputProtocol.h>
 #include "ApfsDriverLoader.h"
 #include "FletcherChecksum.h"
@@ -44,12 +47,255 @@ WITHOUT WARRANTIES OR REPRESENTATIONS OF ANY KIND, EITHER EXPRESS OR IMPLIED.
 STATIC BOOLEAN  LegacyScan       = FALSE;
 STATIC UINT64   LegacyBaseOffset = 0;
 
+//
+// Controllers which held valid containers on previous boots
+//
+STATIC APFS_TOPOLOGY_HINT  TopologyHint;
+
+//
+// Device path hashes of hinted controllers not started yet on this boot.
+// While any is left and present, other controllers are deferred, so that
+// containers from previous boot are started first. The ones left at boot
+// are dropped from topology hint.
+//
+STATIC UINT32              PendingHints[APFS_TOPOLOGY_HINT_MAX_ENTRIES];
+STATIC UINTN               NumberOfPendingHints  = 0;
+STATIC BOOLEAN             DeferringControllers  = FALSE;
+STATIC EFI_HANDLE          *DeferredControllers  = NULL;
+STATIC UINTN               NumberOfDeferredControllers = 0;
+STATIC EFI_EVENT           ConnectDeferredEvent  = NULL;
+
+//
+// Returns a NULL terminated list of driver binding handles installed by
+// ApfsImageHandle, or NULL when there are none.
+//
+STATIC
+EFI_HANDLE *
+GetApfsDriverBindingHandles (
+  IN  EFI_HANDLE  ApfsImageHandle,
+  OUT UINTN       *DriverCount
+  )
+{
+  EFI_STATUS                           Status;
+  UINTN                                HandleCount        = 0;
+  EFI_HANDLE                           *HandleBuffer      = NULL;
+  EFI_HANDLE                           *DriverHandles     = NULL;
+  EFI_DRIVER_BINDING_PROTOCOL          *DriverBinding     = NULL;
+  UINTN                                Index;
+
+  *DriverCount = 0;
+
+  Status = gBS->LocateHandleBuffer (
+    ByProtocol,
+    &gEfiDriverBindingProtocolGuid,
+    NULL,
+    &HandleCount,
+    &HandleBuffer
+    );
+
+  if (EFI_ERROR (Status)) {
+    return NULL;
+  }
+
+  DriverHandles = AllocatePool ((HandleCount + 1) * sizeof (EFI_HANDLE));
+  if (DriverHandles != NULL) {
+    for (Index = 0; Index < HandleCount; ++Index) {
+      Status = gBS->HandleProtocol (
+        HandleBuffer[Index],
+        &gEfiDriverBindingProtocolGuid,
+        (VOID **) &DriverBinding
+        );
+
+      if (!EFI_ERROR (Status) && DriverBinding->ImageHandle == ApfsImageHandle) {
+        DriverHandles[(*DriverCount)++] = HandleBuffer[Index];
+      }
+    }
+    DriverHandles[*DriverCount] = NULL;
+  }
+  FreePool (HandleBuffer);
+
+  if (*DriverCount == 0 && DriverHandles != NULL) {
+    FreePool (DriverHandles);
+    DriverHandles = NULL;
+  }
+
+  return DriverHandles;
+}
+
+//
+// Connects apfs.efi to ControllerHandle, then recursively connects only the
+// child handles its driver bindings produced. The DriverImageHandle list
+// only gives apfs.efi bindings priority, other drivers are still tested
+// on the controller. The gain over a recursive connect of ControllerHandle
+// is that handles under it not produced by apfs.efi are not revisited.
+// When the narrowed connect fails, the full recursive connect is done.
+//
+STATIC
+VOID
+ConnectApfsDriver (
+  IN EFI_HANDLE  ControllerHandle,
+  IN EFI_HANDLE  ApfsImageHandle
+  )
+{
+  EFI_STATUS                           Status;
+  EFI_HANDLE                           *DriverHandles     = NULL;
+  UINTN                                DriverCount        = 0;
+  EFI_GUID                             **ProtocolBuffer   = NULL;
+  UINTN                                ProtocolCount      = 0;
+  EFI_OPEN_PROTOCOL_INFORMATION_ENTRY  *OpenInfo          = NULL;
+  UINTN                                OpenInfoCount      = 0;
+  EFI_HANDLE                           *ChildHandles      = NULL;
+  EFI_HANDLE                           *NewChildHandles   = NULL;
+  UINTN                                ChildCount         = 0;
+  BOOLEAN                              ConnectAll         = FALSE;
+  UINTN                                ProtocolIndex;
+  UINTN                                InfoIndex;
+  UINTN                                Index;
+
+  DriverHandles = GetApfsDriverBindingHandles (ApfsImageHandle, &DriverCount);
+
+  if (DriverCount == 0) {
+    //
+    // No binding to target, let every driver test the controller.
+    //
+    DEBUG ((DEBUG_WARN, "No driver binding found for apfs.efi\n"));
+    gBS->ConnectController (ControllerHandle, NULL, NULL, TRUE);
+    return;
+  }
+
+  Status = gBS->ConnectController (ControllerHandle, DriverHandles, NULL, FALSE);
+  if (EFI_ERROR (Status)) {
+    DEBUG ((DEBUG_WARN, "Failed to connect apfs.efi with Status: %r\n", Status));
+    FreePool (DriverHandles);
+    gBS->ConnectController (ControllerHandle, NULL, NULL, TRUE);
+    return;
+  }
+
+  //
+  // Children are the handles opening controller protocols BY_CHILD_CONTROLLER
+  // on behalf of apfs.efi bindings.
+  //
+  Status = gBS->ProtocolsPerHandle (
+    ControllerHandle,
+    &ProtocolBuffer,
+    &ProtocolCount
+    );
+
+  if (EFI_ERROR (Status)) {
+    FreePool (DriverHandles);
+    gBS->ConnectController (ControllerHandle, NULL, NULL, TRUE);
+    return;
+  }
+
+  for (ProtocolIndex = 0; ProtocolIndex < ProtocolCount && !ConnectAll; ++ProtocolIndex) {
+    Status = gBS->OpenProtocolInformation (
+      ControllerHandle,
+      ProtocolBuffer[ProtocolIndex],
+      &OpenInfo,
+      &OpenInfoCount
+      );
+
+    if (EFI_ERROR (Status)) {
+      continue;
+    }
+
+    for (InfoIndex = 0; InfoIndex < OpenInfoCount; ++InfoIndex) {
+      if ((OpenInfo[InfoIndex].Attributes & EFI_OPEN_PROTOCOL_BY_CHILD_CONTROLLER) == 0) {
+        continue;
+      }
+
+      for (Index = 0; Index < DriverCount; ++Index) {
+        if (OpenInfo[InfoIndex].AgentHandle == DriverHandles[Index]) {
+          break;
+        }
+      }
+
+      if (Index == DriverCount) {
+        continue;
+      }
+
+      for (Index = 0; Index < ChildCount; ++Index) {
+        if (ChildHandles[Index] == OpenInfo[InfoIndex].ControllerHandle) {
+          break;
+        }
+      }
+
+      if (Index < ChildCount) {
+        continue;
+      }
+
+      NewChildHandles = ReallocatePool (
+        ChildCount * sizeof (EFI_HANDLE),
+        (ChildCount + 1) * sizeof (EFI_HANDLE),
+        ChildHandles
+        );
+
+      if (NewChildHandles == NULL) {
+        ConnectAll = TRUE;
+        break;
+      }
+
+      ChildHandles = NewChildHandles;
+      ChildHandles[ChildCount++] = OpenInfo[InfoIndex].ControllerHandle;
+    }
+
+    FreePool (OpenInfo);
+  }
+
+  FreePool (ProtocolBuffer);
+  FreePool (DriverHandles);
+
+  if (ConnectAll) {
+    //
+    // Children could not be collected, connect everything below.
+    //
+    gBS->ConnectController (ControllerHandle, NULL, NULL, TRUE);
+  } else {
+    DEBUG ((DEBUG_VERBOSE, "Connecting %u apfs.efi children\n", ChildCount));
+
+    for (Index = 0; Index < ChildCount; ++Index) {
+      gBS->ConnectController (ChildHandles[Index], NULL, NULL, TRUE);
+    }
+  }
+
+  if (ChildHandles != NULL) {
+    FreePool (ChildHandles);
+  }
+}
+
+//
+// Detaches driver bindings installed by ApfsImageHandle from
+// ControllerHandle, leaving other drivers on the controller bound.
+//
+STATIC
+VOID
+DisconnectApfsDriver (
+  IN EFI_HANDLE  ControllerHandle,
+  IN EFI_HANDLE  ApfsImageHandle
+  )
+{
+  EFI_HANDLE                           *DriverHandles     = NULL;
+  UINTN                                DriverCount        = 0;
+  UINTN                                Index;
+
+  DriverHandles = GetApfsDriverBindingHandles (ApfsImageHandle, &DriverCount);
+
+  for (Index = 0; Index < DriverCount; ++Index) {
+    gBS->DisconnectController (ControllerHandle, DriverHandles[Index], NULL);
+  }
+
+  if (DriverHandles != NULL) {
+    FreePool (DriverHandles);
+  }
+}
+
 EFI_STATUS
 EFIAPI
 StartApfsDriver (
-  IN EFI_HANDLE ControllerHandle,
-  IN VOID       *AppleFileSystemDriverBuffer,
-  IN UINTN      AppleFileSystemDriverSize
+  IN  EFI_HANDLE ControllerHandle,
+  IN  VOID       *AppleFileSystemDriverBuffer,
+  IN  UINTN      AppleFileSystemDriverSize,
+  OUT EFI_HANDLE *ApfsImageHandle
   )
 {
   EFI_STATUS                 Status;
@@ -159,7 +405,9 @@ StartApfsDriver (
   //
   // Connect loaded apfs.efi to controller from which we retrieve it
   //
-  gBS->ConnectController(ControllerHandle, NULL, NULL, TRUE);
+  ConnectApfsDriver (ControllerHandle, ImageHandle);
+
+  *ApfsImageHandle = ImageHandle;
 
   return EFI_SUCCESS;
 }
@@ -203,128 +451,526 @@ ReadDisk (
 }
 
 //
-// Function to parse GPT entries in legacy
+// Reads one container block and verifies its checksum.
 //
+STATIC
 EFI_STATUS
-EFIAPI
-LegacyApfsContainerScan (
-  IN EFI_DRIVER_BINDING_PROTOCOL  *This,
-  IN EFI_HANDLE                   ControllerHandle
+ReadApfsBlock (
+  IN  EFI_DISK_IO_PROTOCOL   *DiskIo,
+  IN  EFI_DISK_IO2_PROTOCOL  *DiskIo2,
+  IN  UINT32                 MediaId,
+  IN  UINT32                 ApfsBlockSize,
+  IN  UINT64                 BlockNumber,
+  OUT UINT8                  *Buffer
   )
 {
-  EFI_STATUS                  Status;
-  UINTN                       Index                        = 0;
-  UINT8                       *Block                       = NULL;
-  UINTN                       Lba                          = 0;
-  UINT32                      PartitionNumber              = 0;
-  UINT32                      PartitionEntrySize           = 0;
-  EFI_PARTITION_TABLE_HEADER  *GptHeader                   = NULL;
-  UINT32                      MediaId                      = 0;
-  UINT32                      BlockSize                    = 0;
-  EFI_BLOCK_IO_PROTOCOL       *BlockIo                     = NULL;
-  EFI_BLOCK_IO2_PROTOCOL      *BlockIo2                    = NULL;
-  EFI_DISK_IO_PROTOCOL        *DiskIo                      = NULL;
-  EFI_DISK_IO2_PROTOCOL       *DiskIo2                     = NULL;
-  EFI_PARTITION_ENTRY         *ApfsGptEntry                = NULL;
+  EFI_STATUS  Status;
 
-  //
-  // Open I/O protocols
-  //
-  Status = gBS->OpenProtocol (
-    ControllerHandle,
-    &gEfiBlockIo2ProtocolGuid,
-    (VOID **) &BlockIo2,
-    This->DriverBindingHandle,
-    ControllerHandle,
-    EFI_OPEN_PROTOCOL_GET_PROTOCOL
+  Status = ReadDisk (
+    DiskIo,
+    DiskIo2,
+    MediaId,
+    MultU64x32 (BlockNumber, ApfsBlockSize) + LegacyBaseOffset,
+    ApfsBlockSize,
+    Buffer
     );
 
   if (EFI_ERROR (Status)) {
-    BlockIo2 = NULL;
-
-    Status = gBS->OpenProtocol (
-      ControllerHandle,
-      &gEfiBlockIoProtocolGuid,
-      (VOID **) &BlockIo,
-      This->DriverBindingHandle,
-      ControllerHandle,
-      EFI_OPEN_PROTOCOL_GET_PROTOCOL
-      );
+    return EFI_DEVICE_ERROR;
+  }
 
-    if (EFI_ERROR (Status)) {
-      return EFI_UNSUPPORTED;
-    }
+  if (!ApfsBlockChecksumVerify (Buffer, ApfsBlockSize)) {
+    return EFI_VOLUME_CORRUPTED;
   }
 
-  Status = gBS->OpenProtocol (
-    ControllerHandle,
-    &gEfiDiskIo2ProtocolGuid,
-    (VOID **) &DiskIo2,
-    This->DriverBindingHandle,
-    ControllerHandle,
-    EFI_OPEN_PROTOCOL_GET_PROTOCOL
-    );
+  return EFI_SUCCESS;
+}
 
-  if (EFI_ERROR (Status)) {
-    DiskIo2 = NULL;
-    Status = gBS->OpenProtocol (
-      ControllerHandle,
-      &gEfiDiskIoProtocolGuid,
-      (VOID **) &DiskIo,
-      This->DriverBindingHandle,
-      ControllerHandle,
-      EFI_OPEN_PROTOCOL_GET_PROTOCOL
-      );
+//
+// Resolves virtual ObjectId to physical block by walking container
+// Object Map B-Tree. The newest mapping not newer than CheckpointId is used.
+// Node is a scratch buffer of ApfsBlockSize bytes and NodeBlock the block it
+// holds (MAX_UINT64 for none), so that consecutive lookups in a single leaf
+// tree read it only once.
+//
+STATIC
+EFI_STATUS
+ApfsObjectMapLookup (
+  IN  EFI_DISK_IO_PROTOCOL   *DiskIo,
+  IN  EFI_DISK_IO2_PROTOCOL  *DiskIo2,
+  IN  UINT32                 MediaId,
+  IN  UINT32                 ApfsBlockSize,
+  IN  UINT64                 TreeBlock,
+  IN  UINT64                 ObjectId,
+  IN  UINT64                 CheckpointId,
+  IN  UINT8                  *Node,
+  IN OUT UINT64              *NodeBlock,
+  OUT UINT64                 *PhysicalBlock
+  )
+{
+  EFI_STATUS        Status;
+  UINTN             Depth;
+  UINT32            Index;
+  UINT32            Found;
+  UINTN             KeyStart;
+  UINTN             ValueEnd;
+  UINTN             KeyOffset;
+  UINTN             ValueOffset;
+  UINTN             ValueSize;
+  APFS_BTREE_NODE   *NodeHeader;
+  APFS_BTREE_KVOFF  *Toc;
+  APFS_OMAP_KEY     *Key;
+  APFS_OMAP_VALUE   *Value;
+
+  for (Depth = 0; Depth < APFS_OMAP_MAX_DEPTH; Depth++) {
+    if (*NodeBlock != TreeBlock) {
+      *NodeBlock = MAX_UINT64;
+
+      Status = ReadApfsBlock (
+        DiskIo,
+        DiskIo2,
+        MediaId,
+        ApfsBlockSize,
+        TreeBlock,
+        Node
+        );
 
-    if (EFI_ERROR (Status)){
+      if (EFI_ERROR (Status)) {
+        return Status;
+      }
+
+      *NodeBlock = TreeBlock;
+    }
+
+    NodeHeader = (APFS_BTREE_NODE *) Node;
+
+    //
+    // Object Map always uses fixed size keys and values.
+    //
+    if ((NodeHeader->Flags & APFS_BTREE_NODE_FIXED_KV_SIZE) == 0) {
       return EFI_UNSUPPORTED;
     }
-  }
 
-  if (BlockIo2 != NULL) {
-    BlockSize     = BlockIo2->Media->BlockSize;
-    MediaId       = BlockIo2->Media->MediaId;
-  } else if (BlockIo != NULL) {
-      BlockSize     = BlockIo->Media->BlockSize;
-      MediaId       = BlockIo->Media->MediaId;
+    KeyStart = sizeof (APFS_BTREE_NODE)
+      + NodeHeader->TableSpaceOffset
+      + NodeHeader->TableSpaceLength;
+    ValueEnd = ApfsBlockSize;
+    if ((NodeHeader->Flags & APFS_BTREE_NODE_ROOT) != 0) {
+      ValueEnd -= APFS_BTREE_INFO_SIZE;
+    }
+
+    if (KeyStart > ValueEnd
+      || (UINT64) NodeHeader->KeyCount * sizeof (APFS_BTREE_KVOFF) > NodeHeader->TableSpaceLength) {
+      return EFI_VOLUME_CORRUPTED;
+    }
+
+    if ((NodeHeader->Flags & APFS_BTREE_NODE_LEAF) != 0) {
+      ValueSize = sizeof (APFS_OMAP_VALUE);
     } else {
-      return EFI_UNSUPPORTED;
+      ValueSize = sizeof (UINT64);
     }
 
+    Toc   = (APFS_BTREE_KVOFF *) (Node + sizeof (APFS_BTREE_NODE) + NodeHeader->TableSpaceOffset);
+    Found = MAX_UINT32;
 
-  Block = AllocateZeroPool ((UINTN)BlockSize);
+    //
+    // Keys are sorted, find the last one not above (ObjectId, CheckpointId).
+    //
+    for (Index = 0; Index < NodeHeader->KeyCount; Index++) {
+      KeyOffset = KeyStart + Toc[Index].KeyOffset;
+      if (KeyOffset + sizeof (APFS_OMAP_KEY) > ValueEnd) {
+        return EFI_VOLUME_CORRUPTED;
+      }
+
+      Key = (APFS_OMAP_KEY *) (Node + KeyOffset);
+      if (Key->ObjectId > ObjectId
+        || (Key->ObjectId == ObjectId && Key->CheckpointId > CheckpointId)) {
+        break;
+      }
+
+      Found = Index;
+    }
+
+    if (Found == MAX_UINT32) {
+      return EFI_NOT_FOUND;
+    }
+
+    ValueOffset = Toc[Found].ValueOffset;
+    if (ValueOffset < ValueSize || ValueOffset > ValueEnd - KeyStart) {
+      return EFI_VOLUME_CORRUPTED;
+    }
+
+    if ((NodeHeader->Flags & APFS_BTREE_NODE_LEAF) != 0) {
+      Key   = (APFS_OMAP_KEY *) (Node + KeyStart + Toc[Found].KeyOffset);
+      Value = (APFS_OMAP_VALUE *) (Node + ValueEnd - ValueOffset);
+      if (Key->ObjectId != ObjectId
+        || (Value->Flags & APFS_OMAP_VALUE_DELETED) != 0) {
+        return EFI_NOT_FOUND;
+      }
+
+      *PhysicalBlock = Value->PhysicalBlock;
+      return EFI_SUCCESS;
+    }
+
+    CopyMem (&TreeBlock, Node + ValueEnd - ValueOffset, sizeof (UINT64));
+  }
+
+  return EFI_VOLUME_CORRUPTED;
+}
+
+//
+// Fills ContainerInfo from already verified ContainerSuperBlock.
+// Volume superblocks are resolved through Object Map first and then read
+// in block order, so that adjacent ones are fetched with a single read.
+// Volumes, which cannot be resolved or fail checksum verification, are skipped.
+// ContainerInfo->Volumes is allocated for the volumes found and must be
+// released by the caller.
+//
+STATIC
+VOID
+ReadApfsContainerInfo (
+  IN     EFI_DISK_IO_PROTOCOL             *DiskIo,
+  IN     EFI_DISK_IO2_PROTOCOL            *DiskIo2,
+  IN     UINT32                           MediaId,
+  IN     APFS_NXSB                        *ContainerSuperBlock,
+  IN OUT APPLE_FILESYSTEM_CONTAINER_INFO  *ContainerInfo
+  )
+{
+  EFI_STATUS                    Status;
+  UINT32                        ApfsBlockSize;
+  UINT32                        MaxVolumes;
+  UINT32                        NumberOfLocations;
+  UINT32                        Index;
+  UINT32                        RunEnd;
+  UINT32                        Slot;
+  UINT64                        TreeBlock;
+  UINT64                        NodeBlock;
+  UINT64                        VolumeBlock;
+  UINT8                         *Block;
+  UINT8                         *VolumeBlocks;
+  APFS_OMAP                     *ObjectMap;
+  APFS_APSB                     *VolumeSuperBlock;
+  APFS_VOLUME_LOCATION          *Locations;
+  APPLE_FILESYSTEM_VOLUME_INFO  *Volume;
+
+  ApfsBlockSize = ContainerSuperBlock->BlockSize;
+
+  ContainerInfo->Revision        = APPLE_FILESYSTEM_CONTAINER_INFO_PROTOCOL_REVISION;
+  ContainerInfo->BlockSize       = ApfsBlockSize;
+  ContainerInfo->TotalBlocks     = ContainerSuperBlock->TotalBlocks;
+  ContainerInfo->NumberOfVolumes = 0;
+  ContainerInfo->Volumes         = NULL;
+  CopyMem (&ContainerInfo->ContainerUuid, &ContainerSuperBlock->Uuid, sizeof (EFI_GUID));
+
+  MaxVolumes = ContainerSuperBlock->ListOfVolumeIds;
+  if (MaxVolumes > APPLE_FILESYSTEM_MAX_VOLUMES) {
+    MaxVolumes = APPLE_FILESYSTEM_MAX_VOLUMES;
+  }
+
+  if (MaxVolumes == 0) {
+    return;
+  }
+
+  Block = AllocatePool (ApfsBlockSize);
   if (Block == NULL) {
-    return EFI_OUT_OF_RESOURCES;
+    return;
   }
 
-  //
-  // Read GPT header first.
-  //
-  Status = ReadDisk (
+  Locations = AllocatePool (MaxVolumes * sizeof (APFS_VOLUME_LOCATION));
+  if (Locations == NULL) {
+    FreePool (Block);
+    return;
+  }
+
+  Status = ReadApfsBlock (
     DiskIo,
     DiskIo2,
     MediaId,
-    BlockSize,
-    BlockSize,
+    ApfsBlockSize,
+    ContainerSuperBlock->BlockMapBlock,
     Block
     );
 
   if (EFI_ERROR (Status)) {
+    DEBUG ((DEBUG_VERBOSE, "Container object map read failed with Status: %r\n", Status));
+    FreePool (Locations);
     FreePool (Block);
-    return EFI_DEVICE_ERROR;
+    return;
   }
 
-  GptHeader = (EFI_PARTITION_TABLE_HEADER *) Block;
-  PartitionEntrySize = GptHeader->SizeOfPartitionEntry;
+  ObjectMap         = (APFS_OMAP *) Block;
+  TreeBlock         = ObjectMap->TreeBlock;
+  NodeBlock         = MAX_UINT64;
+  NumberOfLocations = 0;
 
-  //
-  // Check GPT Header signature.
-  //
-  if (GptHeader->Header.Signature == EFI_PTAB_HEADER_ID) {
-    //
-    // Get partitions count.
-    //
-    PartitionNumber = GptHeader->NumberOfPartitionEntries;
+  for (Index = 0; Index < MaxVolumes; Index++) {
+    if (ContainerSuperBlock->VolumesRootIds[Index] == 0) {
+      continue;
+    }
+
+    Status = ApfsObjectMapLookup (
+      DiskIo,
+      DiskIo2,
+      MediaId,
+      ApfsBlockSize,
+      TreeBlock,
+      ContainerSuperBlock->VolumesRootIds[Index],
+      ContainerSuperBlock->BlockHeader.CheckpointId,
+      Block,
+      &NodeBlock,
+      &VolumeBlock
+      );
+
+    if (EFI_ERROR (Status)) {
+      DEBUG ((
+        DEBUG_VERBOSE,
+        "Volume %llx lookup failed with Status: %r\n",
+        ContainerSuperBlock->VolumesRootIds[Index],
+        Status
+        ));
+      continue;
+    }
+
+    //
+    // Keep locations sorted by block to coalesce reads.
+    //
+    for (Slot = NumberOfLocations; Slot > 0; Slot--) {
+      if (Locations[Slot - 1].PhysicalBlock <= VolumeBlock) {
+        break;
+      }
+      Locations[Slot] = Locations[Slot - 1];
+    }
+
+    Locations[Slot].ObjectId      = ContainerSuperBlock->VolumesRootIds[Index];
+    Locations[Slot].PhysicalBlock = VolumeBlock;
+    NumberOfLocations++;
+  }
+
+  FreePool (Block);
+
+  if (NumberOfLocations == 0) {
+    FreePool (Locations);
+    return;
+  }
+
+  VolumeBlocks           = AllocatePool (NumberOfLocations * ApfsBlockSize);
+  ContainerInfo->Volumes = AllocateZeroPool (NumberOfLocations * sizeof (APPLE_FILESYSTEM_VOLUME_INFO));
+  if (VolumeBlocks == NULL || ContainerInfo->Volumes == NULL) {
+    if (VolumeBlocks != NULL) {
+      FreePool (VolumeBlocks);
+    }
+    if (ContainerInfo->Volumes != NULL) {
+      FreePool (ContainerInfo->Volumes);
+      ContainerInfo->Volumes = NULL;
+    }
+    FreePool (Locations);
+    return;
+  }
+
+  for (Index = 0; Index < NumberOfLocations; Index = RunEnd) {
+    RunEnd = Index + 1;
+    while (RunEnd < NumberOfLocations
+      && Locations[RunEnd].PhysicalBlock == Locations[RunEnd - 1].PhysicalBlock + 1) {
+      RunEnd++;
+    }
+
+    Status = ReadDisk (
+      DiskIo,
+      DiskIo2,
+      MediaId,
+      MultU64x32 (Locations[Index].PhysicalBlock, ApfsBlockSize) + LegacyBaseOffset,
+      (RunEnd - Index) * ApfsBlockSize,
+      VolumeBlocks + Index * ApfsBlockSize
+      );
+
+    if (EFI_ERROR (Status)) {
+      DEBUG ((
+        DEBUG_VERBOSE,
+        "Volume superblocks at %llu block read failed with Status: %r\n",
+        Locations[Index].PhysicalBlock,
+        Status
+        ));
+      ZeroMem (VolumeBlocks + Index * ApfsBlockSize, (RunEnd - Index) * ApfsBlockSize);
+    }
+  }
+
+  for (Index = 0; Index < NumberOfLocations; Index++) {
+    Block            = VolumeBlocks + Index * ApfsBlockSize;
+    VolumeSuperBlock = (APFS_APSB *) Block;
+
+    if (VolumeSuperBlock->MagicNumber != VsbMagic
+      || !ApfsBlockChecksumVerify (Block, ApfsBlockSize)) {
+      continue;
+    }
+
+    Volume = &ContainerInfo->Volumes[ContainerInfo->NumberOfVolumes];
+    Volume->Index                = VolumeSuperBlock->VolumeNumber;
+    Volume->Role                 = VolumeSuperBlock->Role;
+    Volume->Reserved             = 0;
+    Volume->ObjectId             = Locations[Index].ObjectId;
+    Volume->SuperblockBlock      = Locations[Index].PhysicalBlock;
+    Volume->IncompatibleFeatures = VolumeSuperBlock->IncompatibleFeatures;
+    Volume->Flags                = VolumeSuperBlock->Flags;
+    Volume->BlocksInUseCount     = VolumeSuperBlock->BlocksInUseCount;
+    CopyMem (&Volume->VolumeUuid, &VolumeSuperBlock->VolumeUuid, sizeof (EFI_GUID));
+    CopyMem (Volume->VolumeName, VolumeSuperBlock->VolumeName, sizeof (Volume->VolumeName));
+    Volume->VolumeName[sizeof (Volume->VolumeName) - 1] = '\0';
+
+    DEBUG ((
+      DEBUG_VERBOSE,
+      "Volume %u (%a) role %04x at %llu block\n",
+      Volume->Index,
+      Volume->VolumeName,
+      Volume->Role,
+      Volume->SuperblockBlock
+      ));
+
+    ContainerInfo->NumberOfVolumes++;
+  }
+
+  FreePool (VolumeBlocks);
+  FreePool (Locations);
+}
+
+//
+// Releases private data together with the cached volume list.
+//
+STATIC
+VOID
+FreeApfsDriverLoaderPrivate (
+  IN APPLE_FILESYSTEM_DRIVER_INFO_PRIVATE_DATA  *Private
+  )
+{
+  if (Private->ContainerInfo.Volumes != NULL) {
+    FreePool (Private->ContainerInfo.Volumes);
+  }
+
+  FreePool (Private);
+}
+
+//
+// Function to parse GPT entries in legacy
+//
+EFI_STATUS
+EFIAPI
+LegacyApfsContainerScan (
+  IN EFI_DRIVER_BINDING_PROTOCOL  *This,
+  IN EFI_HANDLE                   ControllerHandle
+  )
+{
+  EFI_STATUS                  Status;
+  UINTN                       Index                        = 0;
+  UINT8                       *Block                       = NULL;
+  UINTN                       Lba                          = 0;
+  UINT32                      PartitionNumber              = 0;
+  UINT32                      PartitionEntrySize           = 0;
+  EFI_PARTITION_TABLE_HEADER  *GptHeader                   = NULL;
+  UINT32                      MediaId                      = 0;
+  UINT32                      BlockSize                    = 0;
+  EFI_BLOCK_IO_PROTOCOL       *BlockIo                     = NULL;
+  EFI_BLOCK_IO2_PROTOCOL      *BlockIo2                    = NULL;
+  EFI_DISK_IO_PROTOCOL        *DiskIo                      = NULL;
+  EFI_DISK_IO2_PROTOCOL       *DiskIo2                     = NULL;
+  EFI_PARTITION_ENTRY         *ApfsGptEntry                = NULL;
+
+  //
+  // Open I/O protocols
+  //
+  Status = gBS->OpenProtocol (
+    ControllerHandle,
+    &gEfiBlockIo2ProtocolGuid,
+    (VOID **) &BlockIo2,
+    This->DriverBindingHandle,
+    ControllerHandle,
+    EFI_OPEN_PROTOCOL_GET_PROTOCOL
+    );
+
+  if (EFI_ERROR (Status)) {
+    BlockIo2 = NULL;
+
+    Status = gBS->OpenProtocol (
+      ControllerHandle,
+      &gEfiBlockIoProtocolGuid,
+      (VOID **) &BlockIo,
+      This->DriverBindingHandle,
+      ControllerHandle,
+      EFI_OPEN_PROTOCOL_GET_PROTOCOL
+      );
+
+    if (EFI_ERROR (Status)) {
+      return EFI_UNSUPPORTED;
+    }
+  }
+
+  Status = gBS->OpenProtocol (
+    ControllerHandle,
+    &gEfiDiskIo2ProtocolGuid,
+    (VOID **) &DiskIo2,
+    This->DriverBindingHandle,
+    ControllerHandle,
+    EFI_OPEN_PROTOCOL_GET_PROTOCOL
+    );
+
+  if (EFI_ERROR (Status)) {
+    DiskIo2 = NULL;
+    Status = gBS->OpenProtocol (
+      ControllerHandle,
+      &gEfiDiskIoProtocolGuid,
+      (VOID **) &DiskIo,
+      This->DriverBindingHandle,
+      ControllerHandle,
+      EFI_OPEN_PROTOCOL_GET_PROTOCOL
+      );
+
+    if (EFI_ERROR (Status)){
+      return EFI_UNSUPPORTED;
+    }
+  }
+
+  if (BlockIo2 != NULL) {
+    BlockSize     = BlockIo2->Media->BlockSize;
+    MediaId       = BlockIo2->Media->MediaId;
+  } else if (BlockIo != NULL) {
+      BlockSize     = BlockIo->Media->BlockSize;
+      MediaId       = BlockIo->Media->MediaId;
+    } else {
+      return EFI_UNSUPPORTED;
+    }
+
+
+  Block = AllocateZeroPool ((UINTN)BlockSize);
+  if (Block == NULL) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  //
+  // Read GPT header first.
+  //
+  Status = ReadDisk (
+    DiskIo,
+    DiskIo2,
+    MediaId,
+    BlockSize,
+    BlockSize,
+    Block
+    );
+
+  if (EFI_ERROR (Status)) {
+    FreePool (Block);
+    return EFI_DEVICE_ERROR;
+  }
+
+  GptHeader = (EFI_PARTITION_TABLE_HEADER *) Block;
+  PartitionEntrySize = GptHeader->SizeOfPartitionEntry;
+
+  //
+  // Check GPT Header signature.
+  //
+  if (GptHeader->Header.Signature == EFI_PTAB_HEADER_ID) {
+    //
+    // Get partitions count.
+    //
+    PartitionNumber = GptHeader->NumberOfPartitionEntries;
     //
     // Get partitions array start_lba.
     //
@@ -372,15 +1018,658 @@ LegacyApfsContainerScan (
     }
   }
 
-  if (ApfsGptEntry == NULL)  {
-    FreePool (Block);
-    return EFI_UNSUPPORTED;
+  if (ApfsGptEntry == NULL)  {
+    FreePool (Block);
+    return EFI_UNSUPPORTED;
+  }
+  LegacyBaseOffset = MultU64x32 (ApfsGptEntry->StartingLBA, BlockSize);
+  FreePool(Block);
+
+  return EFI_SUCCESS;
+
+}
+
+//
+// Returns private data of EfiBootRecordInfo protocol installed on
+// ControllerHandle by this driver, or NULL when there is none.
+//
+STATIC
+APPLE_FILESYSTEM_DRIVER_INFO_PRIVATE_DATA *
+GetApfsDriverLoaderPrivate (
+  IN EFI_DRIVER_BINDING_PROTOCOL  *This,
+  IN EFI_HANDLE                   ControllerHandle
+  )
+{
+  EFI_STATUS                                   Status;
+  APPLE_FILESYSTEM_EFIBOOTRECORD_LOCATION_INFO *EfiBootRecordLocationInfo   = NULL;
+  APPLE_FILESYSTEM_DRIVER_INFO_PRIVATE_DATA    *Private                     = NULL;
+
+  Status = gBS->OpenProtocol (
+    ControllerHandle,
+    &gAppleFileSystemEfiBootRecordInfoProtocolGuid,
+    (VOID **) &EfiBootRecordLocationInfo,
+    This->DriverBindingHandle,
+    ControllerHandle,
+    EFI_OPEN_PROTOCOL_GET_PROTOCOL
+    );
+
+  if (EFI_ERROR (Status)) {
+    return NULL;
+  }
+
+  //
+  // Firmware ApfsJumpStart uses the same signature, so check the owner too.
+  //
+  Private = BASE_CR (
+    EfiBootRecordLocationInfo,
+    APPLE_FILESYSTEM_DRIVER_INFO_PRIVATE_DATA,
+    EfiBootRecordLocationInfo
+    );
+
+  if (Private->Signature != APPLE_FILESYSTEM_DRIVER_INFO_PRIVATE_DATA_SIGNATURE
+    || Private->DriverBindingHandle != This->DriverBindingHandle) {
+    return NULL;
+  }
+
+  return Private;
+}
+
+//
+// Opens Disk IO (V2 preferred) on ControllerHandle and returns current media id.
+//
+STATIC
+EFI_STATUS
+GetControllerDiskIo (
+  IN  EFI_DRIVER_BINDING_PROTOCOL  *This,
+  IN  EFI_HANDLE                   ControllerHandle,
+  OUT EFI_DISK_IO_PROTOCOL         **DiskIo,
+  OUT EFI_DISK_IO2_PROTOCOL        **DiskIo2,
+  OUT UINT32                       *MediaId
+  )
+{
+  EFI_STATUS                  Status;
+  EFI_BLOCK_IO_PROTOCOL       *BlockIo                     = NULL;
+  EFI_BLOCK_IO2_PROTOCOL      *BlockIo2                    = NULL;
+
+  *DiskIo  = NULL;
+  *DiskIo2 = NULL;
+
+  Status = gBS->OpenProtocol (
+    ControllerHandle,
+    &gEfiBlockIo2ProtocolGuid,
+    (VOID **) &BlockIo2,
+    This->DriverBindingHandle,
+    ControllerHandle,
+    EFI_OPEN_PROTOCOL_GET_PROTOCOL
+    );
+
+  if (EFI_ERROR (Status)) {
+    Status = gBS->OpenProtocol (
+      ControllerHandle,
+      &gEfiBlockIoProtocolGuid,
+      (VOID **) &BlockIo,
+      This->DriverBindingHandle,
+      ControllerHandle,
+      EFI_OPEN_PROTOCOL_GET_PROTOCOL
+      );
+
+    if (EFI_ERROR (Status)) {
+      return Status;
+    }
+
+    *MediaId = BlockIo->Media->MediaId;
+  } else {
+    *MediaId = BlockIo2->Media->MediaId;
+  }
+
+  Status = gBS->OpenProtocol (
+    ControllerHandle,
+    &gEfiDiskIo2ProtocolGuid,
+    (VOID **) DiskIo2,
+    This->DriverBindingHandle,
+    ControllerHandle,
+    EFI_OPEN_PROTOCOL_GET_PROTOCOL
+    );
+
+  if (EFI_ERROR (Status)) {
+    *DiskIo2 = NULL;
+    Status = gBS->OpenProtocol (
+      ControllerHandle,
+      &gEfiDiskIoProtocolGuid,
+      (VOID **) DiskIo,
+      This->DriverBindingHandle,
+      ControllerHandle,
+      EFI_OPEN_PROTOCOL_GET_PROTOCOL
+      );
+  }
+
+  return Status;
+}
+
+//
+// Checks whether the container on an already started controller differs
+// from the one seen at probe time. Costs a single container header read.
+//
+STATIC
+BOOLEAN
+ApfsContainerChanged (
+  IN EFI_DRIVER_BINDING_PROTOCOL                *This,
+  IN APPLE_FILESYSTEM_DRIVER_INFO_PRIVATE_DATA  *Private
+  )
+{
+  EFI_STATUS                  Status;
+  EFI_DISK_IO_PROTOCOL        *DiskIo                      = NULL;
+  EFI_DISK_IO2_PROTOCOL       *DiskIo2                     = NULL;
+  UINT32                      MediaId                      = 0;
+  APFS_BLOCK_HEADER           BlockHeader;
+
+  Status = GetControllerDiskIo (
+    This,
+    Private->ControllerHandle,
+    &DiskIo,
+    &DiskIo2,
+    &MediaId
+    );
+
+  if (EFI_ERROR (Status)) {
+    return TRUE;
+  }
+
+  if (MediaId != Private->MediaId) {
+    DEBUG ((DEBUG_VERBOSE, "Apfs Container media changed\n"));
+    return TRUE;
+  }
+
+  Status = ReadDisk (
+    DiskIo,
+    DiskIo2,
+    MediaId,
+    Private->ContainerOffset,
+    sizeof (BlockHeader),
+    (UINT8 *) &BlockHeader
+    );
+
+  if (EFI_ERROR (Status) || BlockHeader.Checksum != Private->ContainerChecksum) {
+    DEBUG ((DEBUG_VERBOSE, "Apfs Container contents changed\n"));
+    return TRUE;
+  }
+
+  return FALSE;
+}
+
+//
+// Returns CRC32 of ControllerHandle device path, or 0 when it has none.
+//
+STATIC
+UINT32
+GetControllerDevicePathHash (
+  IN EFI_HANDLE  ControllerHandle
+  )
+{
+  EFI_STATUS                  Status;
+  EFI_DEVICE_PATH_PROTOCOL    *DevicePath                  = NULL;
+  UINT32                      Hash                         = 0;
+
+  Status = gBS->HandleProtocol (
+    ControllerHandle,
+    &gEfiDevicePathProtocolGuid,
+    (VOID **) &DevicePath
+    );
+
+  if (EFI_ERROR (Status)) {
+    return 0;
+  }
+
+  Status = gBS->CalculateCrc32 (
+    DevicePath,
+    GetDevicePathSize (DevicePath),
+    &Hash
+    );
+
+  if (EFI_ERROR (Status)) {
+    return 0;
+  }
+
+  return Hash;
+}
+
+STATIC
+APFS_TOPOLOGY_HINT_ENTRY *
+FindTopologyHintEntry (
+  IN UINT32  DevicePathHash
+  )
+{
+  UINT32  Index;
+
+  if (DevicePathHash == 0) {
+    return NULL;
+  }
+
+  for (Index = 0; Index < TopologyHint.NumberOfEntries; ++Index) {
+    if (TopologyHint.Entries[Index].DevicePathHash == DevicePathHash) {
+      return &TopologyHint.Entries[Index];
+    }
+  }
+
+  return NULL;
+}
+
+//
+// Reads topology hint left by previous boot, a malformed one is discarded.
+//
+STATIC
+VOID
+LoadTopologyHint (
+  VOID
+  )
+{
+  EFI_STATUS  Status;
+  UINTN       Size;
+
+  Size = sizeof (TopologyHint);
+  Status = gRT->GetVariable (
+    APFS_TOPOLOGY_HINT_VARIABLE_NAME,
+    &gApfsTopologyHintVariableGuid,
+    NULL,
+    &Size,
+    &TopologyHint
+    );
+
+  if (EFI_ERROR (Status)
+    || Size < OFFSET_OF (APFS_TOPOLOGY_HINT, Entries)
+    || TopologyHint.Revision != APFS_TOPOLOGY_HINT_REVISION
+    || TopologyHint.NumberOfEntries > APFS_TOPOLOGY_HINT_MAX_ENTRIES
+    || Size != OFFSET_OF (APFS_TOPOLOGY_HINT, Entries)
+      + TopologyHint.NumberOfEntries * sizeof (APFS_TOPOLOGY_HINT_ENTRY)) {
+    ZeroMem (&TopologyHint, sizeof (TopologyHint));
+  }
+
+  TopologyHint.Revision = APFS_TOPOLOGY_HINT_REVISION;
+
+  DEBUG ((
+    DEBUG_VERBOSE,
+    "Apfs topology hint has %u entries\n",
+    TopologyHint.NumberOfEntries
+    ));
+}
+
+//
+// Writes topology hint, only called when it changed to spare NVRAM.
+//
+STATIC
+VOID
+SaveTopologyHint (
+  VOID
+  )
+{
+  EFI_STATUS  Status;
+  UINTN       Size                                         = 0;
+
+  if (TopologyHint.NumberOfEntries > 0) {
+    Size = OFFSET_OF (APFS_TOPOLOGY_HINT, Entries)
+      + TopologyHint.NumberOfEntries * sizeof (APFS_TOPOLOGY_HINT_ENTRY);
+  }
+
+  Status = gRT->SetVariable (
+    APFS_TOPOLOGY_HINT_VARIABLE_NAME,
+    &gApfsTopologyHintVariableGuid,
+    EFI_VARIABLE_NON_VOLATILE | EFI_VARIABLE_BOOTSERVICE_ACCESS,
+    Size,
+    &TopologyHint
+    );
+
+  if (EFI_ERROR (Status) && Size > 0) {
+    DEBUG ((DEBUG_WARN, "Failed to save Apfs topology hint with Status: %r\n", Status));
+  }
+}
+
+//
+// Records a controller with a started container, replacing the oldest
+// entry when the hint is full.
+//
+STATIC
+VOID
+UpdateTopologyHint (
+  IN UINT32          DevicePathHash,
+  IN CONST EFI_GUID  *ContainerUuid,
+  IN UINT64          ContainerOffset
+  )
+{
+  APFS_TOPOLOGY_HINT_ENTRY  *Entry;
+
+  if (DevicePathHash == 0) {
+    return;
+  }
+
+  Entry = FindTopologyHintEntry (DevicePathHash);
+  if (Entry != NULL) {
+    if (CompareGuid (&Entry->ContainerUuid, ContainerUuid)
+      && Entry->ContainerOffset == ContainerOffset) {
+      return;
+    }
+  } else {
+    if (TopologyHint.NumberOfEntries == APFS_TOPOLOGY_HINT_MAX_ENTRIES) {
+      CopyMem (
+        &TopologyHint.Entries[0],
+        &TopologyHint.Entries[1],
+        (APFS_TOPOLOGY_HINT_MAX_ENTRIES - 1) * sizeof (APFS_TOPOLOGY_HINT_ENTRY)
+        );
+      --TopologyHint.NumberOfEntries;
+    }
+
+    Entry = &TopologyHint.Entries[TopologyHint.NumberOfEntries++];
+    Entry->DevicePathHash = DevicePathHash;
+    Entry->Reserved       = 0;
+  }
+
+  DEBUG ((DEBUG_VERBOSE, "Apfs topology hint updated for %08x\n", DevicePathHash));
+
+  CopyGuid (&Entry->ContainerUuid, ContainerUuid);
+  Entry->ContainerOffset = ContainerOffset;
+
+  SaveTopologyHint ();
+}
+
+//
+// Forgets a controller on which probing found no container or a different
+// one than hinted.
+//
+STATIC
+VOID
+RemoveTopologyHint (
+  IN UINT32  DevicePathHash
+  )
+{
+  APFS_TOPOLOGY_HINT_ENTRY  *Entry;
+  UINTN                     Index;
+
+  Entry = FindTopologyHintEntry (DevicePathHash);
+  if (Entry == NULL) {
+    return;
+  }
+
+  DEBUG ((DEBUG_VERBOSE, "Apfs topology hint dropped for %08x\n", DevicePathHash));
+
+  Index = (UINTN) (Entry - TopologyHint.Entries);
+  CopyMem (
+    Entry,
+    Entry + 1,
+    (TopologyHint.NumberOfEntries - Index - 1) * sizeof (APFS_TOPOLOGY_HINT_ENTRY)
+    );
+  --TopologyHint.NumberOfEntries;
+
+  SaveTopologyHint ();
+}
+
+//
+// Legacy scan shortcut: checks that the hinted container is still at the
+// hinted offset by reading its superblock instead of parsing GPT.
+//
+STATIC
+BOOLEAN
+ApfsHintedContainerPresent (
+  IN EFI_DRIVER_BINDING_PROTOCOL     *This,
+  IN EFI_HANDLE                      ControllerHandle,
+  IN CONST APFS_TOPOLOGY_HINT_ENTRY  *Entry
+  )
+{
+  EFI_STATUS                  Status;
+  EFI_DISK_IO_PROTOCOL        *DiskIo                      = NULL;
+  EFI_DISK_IO2_PROTOCOL       *DiskIo2                     = NULL;
+  UINT32                      MediaId                      = 0;
+  APFS_NXSB                   ContainerHeader;
+  UINT8                       *ApfsBlock                   = NULL;
+  BOOLEAN                     Present                      = FALSE;
+
+  Status = GetControllerDiskIo (
+    This,
+    ControllerHandle,
+    &DiskIo,
+    &DiskIo2,
+    &MediaId
+    );
+
+  if (EFI_ERROR (Status)) {
+    return FALSE;
+  }
+
+  Status = ReadDisk (
+    DiskIo,
+    DiskIo2,
+    MediaId,
+    Entry->ContainerOffset,
+    sizeof (ContainerHeader),
+    (UINT8 *) &ContainerHeader
+    );
+
+  if (EFI_ERROR (Status)
+    || ContainerHeader.BlockHeader.NodeType != 0x80000001
+    || ContainerHeader.BlockHeader.NodeId != 1
+    || ContainerHeader.MagicNumber != CsbMagic
+    || ContainerHeader.BlockSize < sizeof (APFS_NXSB)
+    || !CompareGuid (&ContainerHeader.Uuid, &Entry->ContainerUuid)) {
+    return FALSE;
+  }
+
+  //
+  // Header matches, verify the checksum over the whole block before
+  // trusting the hinted offset.
+  //
+  ApfsBlock = AllocatePool (ContainerHeader.BlockSize);
+  if (ApfsBlock == NULL) {
+    return FALSE;
+  }
+
+  Status = ReadDisk (
+    DiskIo,
+    DiskIo2,
+    MediaId,
+    Entry->ContainerOffset,
+    ContainerHeader.BlockSize,
+    ApfsBlock
+    );
+
+  if (!EFI_ERROR (Status)
+    && ApfsBlockChecksumVerify (ApfsBlock, ContainerHeader.BlockSize)
+    && CompareMem (ApfsBlock, &ContainerHeader, sizeof (ContainerHeader)) == 0) {
+    Present = TRUE;
+  }
+
+  FreePool (ApfsBlock);
+
+  return Present;
+}
+
+//
+// Returns TRUE when a controller of a pending hint is in the handle database.
+// Missing ones were removed or replaced since previous boot, or were not
+// enumerated yet, either way the connect in progress will not start them.
+//
+STATIC
+BOOLEAN
+PendingHintsPresent (
+  VOID
+  )
+{
+  EFI_STATUS  Status;
+  EFI_HANDLE  *Handles;
+  UINTN       NumberOfHandles;
+  UINTN       HandleIndex;
+  UINTN       Index;
+  UINT32      DevicePathHash;
+  BOOLEAN     Present;
+
+  Status = gBS->LocateHandleBuffer (
+    ByProtocol,
+    &gEfiDevicePathProtocolGuid,
+    NULL,
+    &NumberOfHandles,
+    &Handles
+    );
+
+  if (EFI_ERROR (Status)) {
+    return FALSE;
+  }
+
+  Present = FALSE;
+  for (HandleIndex = 0; HandleIndex < NumberOfHandles && !Present; ++HandleIndex) {
+    DevicePathHash = GetControllerDevicePathHash (Handles[HandleIndex]);
+    for (Index = 0; Index < NumberOfPendingHints; ++Index) {
+      if (PendingHints[Index] == DevicePathHash) {
+        Present = TRUE;
+        break;
+      }
+    }
+  }
+
+  FreePool (Handles);
+
+  return Present;
+}
+
+//
+// Stops deferring controllers. The ones deferred so far are connected on
+// next timer tick, after the Supported or Start call in progress returns.
+//
+STATIC
+VOID
+StopDeferringControllers (
+  VOID
+  )
+{
+  DeferringControllers = FALSE;
+
+  if (NumberOfDeferredControllers > 0) {
+    gBS->SetTimer (ConnectDeferredEvent, TimerRelative, 0);
+  }
+}
+
+//
+// Defers a controller missing in topology hint while hinted controllers are
+// still to be started. Returns TRUE when ControllerHandle was deferred.
+//
+STATIC
+BOOLEAN
+DeferUnhintedController (
+  IN EFI_HANDLE  ControllerHandle
+  )
+{
+  EFI_HANDLE  *Controllers;
+  UINT32      DevicePathHash;
+  UINTN       Index;
+
+  if (!DeferringControllers) {
+    return FALSE;
+  }
+
+  DevicePathHash = GetControllerDevicePathHash (ControllerHandle);
+  for (Index = 0; Index < NumberOfPendingHints; ++Index) {
+    if (PendingHints[Index] == DevicePathHash) {
+      return FALSE;
+    }
+  }
+
+  for (Index = 0; Index < NumberOfDeferredControllers; ++Index) {
+    if (DeferredControllers[Index] == ControllerHandle) {
+      return TRUE;
+    }
+  }
+
+  //
+  // Only wait for hinted controllers which can still show up.
+  //
+  if (!PendingHintsPresent ()) {
+    DEBUG ((DEBUG_VERBOSE, "Apfs hinted controllers missing, not deferring\n"));
+    StopDeferringControllers ();
+    return FALSE;
+  }
+
+  Controllers = ReallocatePool (
+    NumberOfDeferredControllers * sizeof (EFI_HANDLE),
+    (NumberOfDeferredControllers + 1) * sizeof (EFI_HANDLE),
+    DeferredControllers
+    );
+
+  if (Controllers == NULL) {
+    return FALSE;
+  }
+
+  DeferredControllers = Controllers;
+  DeferredControllers[NumberOfDeferredControllers++] = ControllerHandle;
+
+  DEBUG ((DEBUG_VERBOSE, "Apfs controller %08x deferred\n", DevicePathHash));
+
+  return TRUE;
+}
+
+//
+// Stops deferring controllers and connects the ones deferred so far.
+// The connect that deferred them has already tested other drivers on them,
+// so only this driver is given priority and the connect is not recursive.
+//
+STATIC
+VOID
+ConnectDeferredControllers (
+  IN EFI_HANDLE  DriverBindingHandle
+  )
+{
+  EFI_HANDLE  *Controllers;
+  UINTN       NumberOfControllers;
+  EFI_HANDLE  DriverImageHandles[2];
+  UINTN       Index;
+
+  DeferringControllers        = FALSE;
+  Controllers                 = DeferredControllers;
+  NumberOfControllers         = NumberOfDeferredControllers;
+  DeferredControllers         = NULL;
+  NumberOfDeferredControllers = 0;
+
+  DriverImageHandles[0] = DriverBindingHandle;
+  DriverImageHandles[1] = NULL;
+
+  for (Index = 0; Index < NumberOfControllers; ++Index) {
+    gBS->ConnectController (Controllers[Index], DriverImageHandles, NULL, FALSE);
+  }
+
+  if (Controllers != NULL) {
+    FreePool (Controllers);
   }
-  LegacyBaseOffset = MultU64x32 (ApfsGptEntry->StartingLBA, BlockSize);
-  FreePool(Block);
+}
 
-  return EFI_SUCCESS;
+STATIC
+VOID
+EFIAPI
+ConnectDeferredNotify (
+  IN EFI_EVENT  Event,
+  IN VOID       *Context
+  )
+{
+  ConnectDeferredControllers ((EFI_HANDLE) Context);
+}
+
+//
+// Marks a hinted controller as probed on this boot. Deferred controllers
+// are connected once no hinted ones are left.
+//
+STATIC
+VOID
+ResolvePendingHint (
+  IN UINT32  DevicePathHash
+  )
+{
+  UINTN  Index;
 
+  for (Index = 0; Index < NumberOfPendingHints; ++Index) {
+    if (PendingHints[Index] == DevicePathHash) {
+      PendingHints[Index] = PendingHints[--NumberOfPendingHints];
+
+      if (NumberOfPendingHints == 0 && DeferringControllers) {
+        StopDeferringControllers ();
+      }
+
+      return;
+    }
+  }
 }
 
 /**
@@ -411,22 +1700,34 @@ ApfsDriverLoaderSupported (
   IN EFI_DEVICE_PATH_PROTOCOL     *RemainingDevicePath
   )
 {
-  EFI_STATUS                    Status;
-  APPLE_PARTITION_INFO_PROTOCOL *ApplePartitionInfo          = NULL;
-  EFI_PARTITION_INFO_PROTOCOL   *Edk2PartitionInfo           = NULL;
+  EFI_STATUS                                   Status;
+  APPLE_PARTITION_INFO_PROTOCOL                *ApplePartitionInfo          = NULL;
+  EFI_PARTITION_INFO_PROTOCOL                  *Edk2PartitionInfo           = NULL;
+  APPLE_FILESYSTEM_DRIVER_INFO_PRIVATE_DATA    *Private                     = NULL;
+  APFS_TOPOLOGY_HINT_ENTRY                     *HintEntry                   = NULL;
 
-  Status = gBS->OpenProtocol (
-    ControllerHandle,
-    &gAppleFileSystemEfiBootRecordInfoProtocolGuid,
-    NULL,
-    This->DriverBindingHandle,
-    ControllerHandle,
-    EFI_OPEN_PROTOCOL_TEST_PROTOCOL
-    );
+  //
+  // Already started by us: only rebind when the container has changed.
+  //
+  Private = GetApfsDriverLoaderPrivate (This, ControllerHandle);
+  if (Private != NULL) {
+    if (!ApfsContainerChanged (This, Private)) {
+      return EFI_ALREADY_STARTED;
+    }
+  } else {
+    Status = gBS->OpenProtocol (
+      ControllerHandle,
+      &gAppleFileSystemEfiBootRecordInfoProtocolGuid,
+      NULL,
+      This->DriverBindingHandle,
+      ControllerHandle,
+      EFI_OPEN_PROTOCOL_TEST_PROTOCOL
+      );
 
-   if (!EFI_ERROR (Status)) {
-    return EFI_UNSUPPORTED;
-   }
+    if (!EFI_ERROR (Status)) {
+      return EFI_UNSUPPORTED;
+    }
+  }
 
   //
   // We check for both DiskIO and BlockIO protocols.
@@ -482,6 +1783,21 @@ ApfsDriverLoaderSupported (
   }
 
   if (LegacyScan) {
+    HintEntry = FindTopologyHintEntry (GetControllerDevicePathHash (ControllerHandle));
+    if (HintEntry != NULL
+      && HintEntry->ContainerOffset != 0
+      && ApfsHintedContainerPresent (This, ControllerHandle, HintEntry)) {
+      LegacyBaseOffset = HintEntry->ContainerOffset;
+      return EFI_SUCCESS;
+    }
+
+    //
+    // Without partition info every disk is a candidate, defer the scan.
+    //
+    if (Private == NULL && DeferUnhintedController (ControllerHandle)) {
+      return EFI_NOT_READY;
+    }
+
     return LegacyApfsContainerScan(This, ControllerHandle);
   }
 
@@ -551,35 +1867,31 @@ ApfsDriverLoaderSupported (
     }
   }
 
+  if (Private == NULL && DeferUnhintedController (ControllerHandle)) {
+    return EFI_NOT_READY;
+  }
+
   return Status;
 }
 
-/**
-  Routine Description:
-
-    Start this driver on ControllerHandle by opening a Block IO and Disk IO
-    protocol, reading ApfsContainer if present.
-
-  Arguments:
-
-    This                  - Protocol instance pointer.
-    ControllerHandle      - Handle of device to bind driver to.
-    RemainingDevicePath   - Not used.
-
-  Returns:
-
-    EFI_SUCCESS           - This driver is added to DeviceHandle.
-    EFI_ALREADY_STARTED   - This driver is already running on DeviceHandle.
-    EFI_OUT_OF_RESOURCES  - Can not allocate the memory.
-    other                 - This driver does not support this device.
-
-**/
+//
+// Probes the container on ControllerHandle and starts apfs.efi from its
+// EfiBootRecord block. StaleApfsImageHandle is apfs.efi started on this
+// controller before a media change. It is reused when the jumpstart digest
+// still matches PreviousEfiBootRecordChecksum and unloaded before starting
+// a new one otherwise. It is set to NULL once it has been consumed.
+// HintMismatch is set when the controller holds no container or jumpstart,
+// or a container other than HintedContainerUuid.
+//
+STATIC
 EFI_STATUS
-EFIAPI
-ApfsDriverLoaderStart (
-  IN EFI_DRIVER_BINDING_PROTOCOL  *This,
-  IN EFI_HANDLE                   ControllerHandle,
-  IN EFI_DEVICE_PATH_PROTOCOL     *RemainingDevicePath
+ApfsContainerStart (
+  IN     EFI_DRIVER_BINDING_PROTOCOL  *This,
+  IN     EFI_HANDLE                   ControllerHandle,
+  IN     UINT64                       PreviousEfiBootRecordChecksum,
+  IN OUT EFI_HANDLE                   *StaleApfsImageHandle,
+  IN     CONST EFI_GUID               *HintedContainerUuid  OPTIONAL,
+  OUT    BOOLEAN                      *HintMismatch
   )
 {
   EFI_STATUS                                   Status;
@@ -600,7 +1912,11 @@ ApfsDriverLoaderStart (
   UINTN                                        AppleFileSystemDriverSize    = 0;
   APPLE_FILESYSTEM_DRIVER_INFO_PRIVATE_DATA    *Private                     = NULL;
   APPLE_FILESYSTEM_EFIBOOTRECORD_LOCATION_INFO *EfiBootRecordLocationInfo   = NULL;
+  UINT64                                       ContainerChecksum            = 0;
+  UINT64                                       EfiBootRecordChecksum        = 0;
+  EFI_HANDLE                                   ApfsImageHandle              = NULL;
 
+  *HintMismatch = FALSE;
 
   Status = gBS->OpenProtocol (
     ControllerHandle,
@@ -611,9 +1927,9 @@ ApfsDriverLoaderStart (
     EFI_OPEN_PROTOCOL_TEST_PROTOCOL
     );
 
-   if (!EFI_ERROR (Status)) {
+  if (!EFI_ERROR (Status)) {
     return EFI_UNSUPPORTED;
-   }
+  }
 
   DEBUG ((DEBUG_VERBOSE, "Apfs Container found.\n"));
 
@@ -706,6 +2022,8 @@ ApfsDriverLoaderStart (
   //
   if (ContainerSuperBlock->BlockHeader.NodeType != 0x80000001
       || ContainerSuperBlock->BlockHeader.NodeId != 1) {
+    FreePool (ApfsBlock);
+    *HintMismatch = TRUE;
     return EFI_UNSUPPORTED;
   }
 
@@ -717,6 +2035,7 @@ ApfsDriverLoaderStart (
 
   if (ContainerSuperBlock->MagicNumber != CsbMagic) {
     FreePool (ApfsBlock);
+    *HintMismatch = TRUE;
     return EFI_UNSUPPORTED;
   }
 
@@ -778,6 +2097,7 @@ ApfsDriverLoaderStart (
   //
   if (!ApfsBlockChecksumVerify((UINT8 *)ApfsBlock, ApfsBlockSize)) {
     FreePool (ApfsBlock);
+    *HintMismatch = TRUE;
     return EFI_UNSUPPORTED;
   }
 
@@ -786,6 +2106,11 @@ ApfsDriverLoaderStart (
   //
   ContainerSuperBlock = (APFS_NXSB *)ApfsBlock;
   CopyMem(&ContainerUuid, &ContainerSuperBlock->Uuid, 16);
+  ContainerChecksum = ContainerSuperBlock->BlockHeader.Checksum;
+
+  if (HintedContainerUuid != NULL && !CompareGuid (&ContainerUuid, HintedContainerUuid)) {
+    *HintMismatch = TRUE;
+  }
 
   //
   // Calculate Offset of EfiBootRecordBlock...
@@ -800,18 +2125,25 @@ ApfsDriverLoaderStart (
      ));
 
   //
-  // Read EfiBootRecordBlock.
+  // Read EfiBootRecordBlock into its own buffer, NXSB is still needed.
   //
+  EfiBootRecordBlock = AllocateZeroPool (ApfsBlockSize);
+  if (EfiBootRecordBlock == NULL) {
+    FreePool (ApfsBlock);
+    return EFI_OUT_OF_RESOURCES;
+  }
+
   Status = ReadDisk (
     DiskIo,
     DiskIo2,
     MediaId,
     EfiBootRecordBlockOffset,
     ApfsBlockSize,
-    ApfsBlock
+    (UINT8 *) EfiBootRecordBlock
     );
 
   if (EFI_ERROR (Status)) {
+    FreePool (EfiBootRecordBlock);
     FreePool (ApfsBlock);
     return EFI_DEVICE_ERROR;
   }
@@ -819,21 +2151,20 @@ ApfsDriverLoaderStart (
   //
   // Verify EfiBootRecordBlock checksum.
   //
-  if (!ApfsBlockChecksumVerify(ApfsBlock, ApfsBlockSize)) {
+  if (!ApfsBlockChecksumVerify((UINT8 *) EfiBootRecordBlock, ApfsBlockSize)
+    || EfiBootRecordBlock->MagicNumber != EfiBootRecordMagic) {
+    FreePool (EfiBootRecordBlock);
     FreePool (ApfsBlock);
+    *HintMismatch = TRUE;
     return EFI_UNSUPPORTED;
   }
 
-  EfiBootRecordBlock = (APFS_EFI_BOOT_RECORD *) ApfsBlock;
-  if (EfiBootRecordBlock->MagicNumber != EfiBootRecordMagic) {
-    FreePool(ApfsBlock);
-    return EFI_UNSUPPORTED;
-  }
+  EfiBootRecordChecksum = EfiBootRecordBlock->BlockHeader.Checksum;
 
   DEBUG ((
     DEBUG_VERBOSE,
     "EfiBootRecordBlock checksum: %08llx\n",
-    EfiBootRecordBlock->BlockHeader.Checksum
+    EfiBootRecordChecksum
     ));
   DEBUG ((
     DEBUG_VERBOSE,
@@ -861,45 +2192,88 @@ ApfsDriverLoaderStart (
     AppleFileSystemDriverSize
     ));
 
-  FreePool (ApfsBlock);
-
-  AppleFileSystemDriverBuffer = AllocateZeroPool (AppleFileSystemDriverSize);
+  FreePool (EfiBootRecordBlock);
 
-  if (AppleFileSystemDriverBuffer == NULL) {
+  Private = AllocateZeroPool (sizeof (APPLE_FILESYSTEM_DRIVER_INFO_PRIVATE_DATA));
+  if (Private == NULL) {
+    FreePool (ApfsBlock);
     return EFI_OUT_OF_RESOURCES;
   }
 
-  Status = ReadDisk (
+  //
+  // Container has a valid jumpstart. Cache its geometry and volume
+  // superblocks, while NXSB is in memory, so that consumers do not need
+  // to read them again.
+  //
+  ReadApfsContainerInfo (
     DiskIo,
     DiskIo2,
     MediaId,
-    ApfsDriverBootRecordOffset,
-    AppleFileSystemDriverSize,
-    AppleFileSystemDriverBuffer
+    ContainerSuperBlock,
+    &Private->ContainerInfo
     );
 
-  if (EFI_ERROR (Status)) {
-    return EFI_DEVICE_ERROR;
-  }
+  FreePool (ApfsBlock);
 
   //
-  // Fill public AppleFileSystemEfiBootRecordInfo protocol interface
+  // Same jumpstart as before the media change means apfs.efi started
+  // from it is still running, so it only needs to be connected again.
   //
+  if (*StaleApfsImageHandle != NULL && EfiBootRecordChecksum != PreviousEfiBootRecordChecksum) {
+    Status = gBS->UnloadImage (*StaleApfsImageHandle);
+    DEBUG ((DEBUG_VERBOSE, "Unloaded apfs.efi of previous jumpstart with Status: %r\n", Status));
+    *StaleApfsImageHandle = NULL;
+  }
 
-  Private = AllocatePool (sizeof (APPLE_FILESYSTEM_DRIVER_INFO_PRIVATE_DATA));
-  if (Private == NULL) {
-    return EFI_OUT_OF_RESOURCES;
+  ApfsImageHandle = *StaleApfsImageHandle;
+
+  if (ApfsImageHandle == NULL) {
+    AppleFileSystemDriverBuffer = AllocateZeroPool (AppleFileSystemDriverSize);
+
+    if (AppleFileSystemDriverBuffer == NULL) {
+      FreeApfsDriverLoaderPrivate (Private);
+      return EFI_OUT_OF_RESOURCES;
+    }
+
+    Status = ReadDisk (
+      DiskIo,
+      DiskIo2,
+      MediaId,
+      ApfsDriverBootRecordOffset,
+      AppleFileSystemDriverSize,
+      AppleFileSystemDriverBuffer
+      );
+
+    if (EFI_ERROR (Status)) {
+      FreePool (AppleFileSystemDriverBuffer);
+      FreeApfsDriverLoaderPrivate (Private);
+      return EFI_DEVICE_ERROR;
+    }
   }
 
-  Private->ControllerHandle  = ControllerHandle;
+  //
+  // Fill public AppleFileSystemEfiBootRecordInfo protocol interface
+  //
+  Private->Signature            = APPLE_FILESYSTEM_DRIVER_INFO_PRIVATE_DATA_SIGNATURE;
+  Private->ControllerHandle     = ControllerHandle;
+  Private->DriverBindingHandle  = This->DriverBindingHandle;
+  Private->ContainerBlockSize   = ApfsBlockSize;
+  Private->ContainerTotalBlocks = Private->ContainerInfo.TotalBlocks;
   EfiBootRecordLocationInfo = &Private->EfiBootRecordLocationInfo;
   EfiBootRecordLocationInfo->ControllerHandle = ControllerHandle;
   CopyMem(&EfiBootRecordLocationInfo->ContainerUuid, &ContainerUuid, 16);
+  Private->ContainerInfo.ControllerHandle = ControllerHandle;
+  Private->MediaId                = MediaId;
+  Private->ContainerOffset        = LegacyBaseOffset;
+  Private->ContainerChecksum      = ContainerChecksum;
+  Private->EfiBootRecordChecksum  = EfiBootRecordChecksum;
 
   Status = gBS->InstallMultipleProtocolInterfaces (
     &Private->ControllerHandle,
     &gAppleFileSystemEfiBootRecordInfoProtocolGuid,
     &Private->EfiBootRecordLocationInfo,
+    &gAppleFileSystemContainerInfoProtocolGuid,
+    &Private->ContainerInfo,
     NULL
     );
 
@@ -913,21 +2287,31 @@ ApfsDriverLoaderStart (
       FreePool (AppleFileSystemDriverBuffer);
     }
     if (Private != NULL) {
-      FreePool(Private);
+      FreeApfsDriverLoaderPrivate (Private);
     }
     return Status;
   }
 
-  Status = StartApfsDriver(
-    ControllerHandle,
-    AppleFileSystemDriverBuffer,
-    AppleFileSystemDriverSize
-    );
+  if (ApfsImageHandle != NULL) {
+    DEBUG ((DEBUG_VERBOSE, "Reconnecting already started apfs.efi\n"));
+    ConnectApfsDriver (ControllerHandle, ApfsImageHandle);
+    Status = EFI_SUCCESS;
+  } else {
+    Status = StartApfsDriver (
+      ControllerHandle,
+      AppleFileSystemDriverBuffer,
+      AppleFileSystemDriverSize,
+      &ApfsImageHandle
+      );
+  }
 
   if (EFI_ERROR (Status)) {
-    gBS->UninstallProtocolInterface (
+    gBS->UninstallMultipleProtocolInterfaces (
       ControllerHandle,
       &gAppleFileSystemEfiBootRecordInfoProtocolGuid,
+      &Private->EfiBootRecordLocationInfo,
+      &gAppleFileSystemContainerInfoProtocolGuid,
+      &Private->ContainerInfo,
       NULL
       );
 
@@ -935,21 +2319,22 @@ ApfsDriverLoaderStart (
       FreePool (AppleFileSystemDriverBuffer);
     }
     if (Private != NULL) {
-      FreePool(Private);
+      FreeApfsDriverLoaderPrivate (Private);
     }
 
     return EFI_UNSUPPORTED;
   }
 
+  Private->ApfsImageHandle = ApfsImageHandle;
+  *StaleApfsImageHandle    = NULL;
+
   //
-  // Free memory and close DiskIo protocol
+  // Free memory and close DiskIo protocol.
+  // Private data is kept alive while its protocols are installed.
   //
   if (AppleFileSystemDriverBuffer != NULL) {
     FreePool (AppleFileSystemDriverBuffer);
   }
-  if (Private != NULL) {
-    FreePool(Private);
-  }
   if (DiskIo2 != NULL) {
     gBS->CloseProtocol(
       ControllerHandle,
@@ -969,6 +2354,114 @@ ApfsDriverLoaderStart (
   return EFI_SUCCESS;
 }
 
+/**
+  Routine Description:
+
+    Start this driver on ControllerHandle by opening a Block IO and Disk IO
+    protocol, reading ApfsContainer if present.
+
+  Arguments:
+
+    This                  - Protocol instance pointer.
+    ControllerHandle      - Handle of device to bind driver to.
+    RemainingDevicePath   - Not used.
+
+  Returns:
+
+    EFI_SUCCESS           - This driver is added to DeviceHandle.
+    EFI_ALREADY_STARTED   - This driver is already running on DeviceHandle.
+    EFI_OUT_OF_RESOURCES  - Can not allocate the memory.
+    other                 - This driver does not support this device.
+
+**/
+EFI_STATUS
+EFIAPI
+ApfsDriverLoaderStart (
+  IN EFI_DRIVER_BINDING_PROTOCOL  *This,
+  IN EFI_HANDLE                   ControllerHandle,
+  IN EFI_DEVICE_PATH_PROTOCOL     *RemainingDevicePath
+  )
+{
+  EFI_STATUS                                   Status;
+  APPLE_FILESYSTEM_DRIVER_INFO_PRIVATE_DATA    *Private                     = NULL;
+  UINT32                                       DevicePathHash               = 0;
+  UINT64                                       PreviousEfiBootRecordChecksum = 0;
+  EFI_HANDLE                                   StaleApfsImageHandle         = NULL;
+  APFS_TOPOLOGY_HINT_ENTRY                     *HintEntry                   = NULL;
+  BOOLEAN                                      HintMismatch                 = FALSE;
+
+  Private = GetApfsDriverLoaderPrivate (This, ControllerHandle);
+  if (Private != NULL) {
+    //
+    // Supported reported changed container contents. Detach apfs.efi bound
+    // to old contents and drop cached data, remembering the jumpstart digest
+    // to reuse already started apfs.efi when it is the same.
+    //
+    PreviousEfiBootRecordChecksum = Private->EfiBootRecordChecksum;
+    StaleApfsImageHandle          = Private->ApfsImageHandle;
+
+    if (StaleApfsImageHandle != NULL) {
+      DisconnectApfsDriver (ControllerHandle, StaleApfsImageHandle);
+    }
+
+    Status = gBS->UninstallMultipleProtocolInterfaces (
+      ControllerHandle,
+      &gAppleFileSystemEfiBootRecordInfoProtocolGuid,
+      &Private->EfiBootRecordLocationInfo,
+      &gAppleFileSystemContainerInfoProtocolGuid,
+      &Private->ContainerInfo,
+      NULL
+      );
+
+    if (EFI_ERROR (Status)) {
+      return Status;
+    }
+
+    FreeApfsDriverLoaderPrivate (Private);
+    Private = NULL;
+  }
+
+  DevicePathHash = GetControllerDevicePathHash (ControllerHandle);
+  HintEntry      = FindTopologyHintEntry (DevicePathHash);
+
+  Status = ApfsContainerStart (
+    This,
+    ControllerHandle,
+    PreviousEfiBootRecordChecksum,
+    &StaleApfsImageHandle,
+    HintEntry != NULL ? &HintEntry->ContainerUuid : NULL,
+    &HintMismatch
+    );
+
+  //
+  // apfs.efi started for previous contents was not reused.
+  //
+  if (StaleApfsImageHandle != NULL) {
+    gBS->UnloadImage (StaleApfsImageHandle);
+  }
+
+  //
+  // Keep topology hint in line with what probing found. Failures which do
+  // not prove the hint wrong, like I/O errors, leave it in place.
+  //
+  if (!EFI_ERROR (Status)) {
+    Private = GetApfsDriverLoaderPrivate (This, ControllerHandle);
+    if (Private != NULL) {
+      UpdateTopologyHint (
+        DevicePathHash,
+        &Private->EfiBootRecordLocationInfo.ContainerUuid,
+        Private->ContainerOffset
+        );
+    }
+  } else if (HintMismatch) {
+    RemoveTopologyHint (DevicePathHash);
+  }
+
+  ResolvePendingHint (DevicePathHash);
+
+  return Status;
+}
+
 /**
 
   Routine Description:
@@ -996,6 +2489,7 @@ ApfsDriverLoaderStop (
 {
   EFI_STATUS                                   Status;
   APPLE_FILESYSTEM_EFIBOOTRECORD_LOCATION_INFO *EfiBootRecordLocationInfo   = NULL;
+  APPLE_FILESYSTEM_DRIVER_INFO_PRIVATE_DATA    *Private                     = NULL;
 
   Status = gBS->OpenProtocol(
     ControllerHandle,
@@ -1020,11 +2514,18 @@ ApfsDriverLoaderStop (
       ControllerHandle
       );
   } else {
+    Private = APPLE_FILESYSTEM_EFIBOOTRECORD_INFO_PRIVATE_DATA_FROM_THIS (EfiBootRecordLocationInfo);
     Status = gBS->UninstallMultipleProtocolInterfaces(
       EfiBootRecordLocationInfo->ControllerHandle,
       &gAppleFileSystemEfiBootRecordInfoProtocolGuid,
-      EfiBootRecordLocationInfo
+      EfiBootRecordLocationInfo,
+      &gAppleFileSystemContainerInfoProtocolGuid,
+      &Private->ContainerInfo,
+      NULL
       );
+    if (!EFI_ERROR (Status)) {
+      FreeApfsDriverLoaderPrivate (Private);
+    }
   }
 
   return Status;
@@ -1044,6 +2545,35 @@ EFI_DRIVER_BINDING_PROTOCOL gApfsDriverLoaderDriverBinding = {
   NULL,
 };
 
+//
+// Hinted controllers which did not start by boot time were either removed
+// or rejected by Supported. Drop them from topology hint, so that next boot
+// does not wait for them, and connect controllers still deferred.
+//
+STATIC
+VOID
+EFIAPI
+ApfsDriverLoaderReadyToBoot (
+  IN EFI_EVENT  Event,
+  IN VOID       *Context
+  )
+{
+  gBS->CloseEvent (Event);
+
+  if (NumberOfPendingHints > 0) {
+    DEBUG ((DEBUG_VERBOSE, "Apfs hinted controllers left at boot: %u\n", NumberOfPendingHints));
+  }
+
+  while (NumberOfPendingHints > 0) {
+    RemoveTopologyHint (PendingHints[--NumberOfPendingHints]);
+  }
+
+  ConnectDeferredControllers (gApfsDriverLoaderDriverBinding.DriverBindingHandle);
+
+  gBS->CloseEvent (ConnectDeferredEvent);
+  ConnectDeferredEvent = NULL;
+}
+
 /**
 
   Routine Description:
@@ -1070,6 +2600,8 @@ ApfsDriverLoaderInit (
 {
   EFI_STATUS                          Status;
   VOID                                *PartitionInfoInterface = NULL;
+  EFI_EVENT                           ReadyToBootEvent        = NULL;
+  UINTN                               Index;
 
   DEBUG ((
     DEBUG_VERBOSE,
@@ -1109,6 +2641,8 @@ ApfsDriverLoaderInit (
     LegacyScan = TRUE;
   }
 
+  LoadTopologyHint ();
+
   //
   // Install Driver Binding Instance
   //
@@ -1121,5 +2655,46 @@ ApfsDriverLoaderInit (
     &gApfsDriverLoaderComponentName2
     );
 
-  return Status;
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  //
+  // Defer controllers missing in topology hint until hinted ones are
+  // started by regular connect, or until none of the remaining ones is
+  // present. Hints still not started at boot are dropped.
+  //
+  if (TopologyHint.NumberOfEntries > 0) {
+    Status = gBS->CreateEvent (
+      EVT_TIMER | EVT_NOTIFY_SIGNAL,
+      TPL_CALLBACK,
+      ConnectDeferredNotify,
+      gApfsDriverLoaderDriverBinding.DriverBindingHandle,
+      &ConnectDeferredEvent
+      );
+
+    if (!EFI_ERROR (Status)) {
+      Status = EfiCreateEventReadyToBootEx (
+        TPL_CALLBACK,
+        ApfsDriverLoaderReadyToBoot,
+        NULL,
+        &ReadyToBootEvent
+        );
+
+      if (EFI_ERROR (Status)) {
+        gBS->CloseEvent (ConnectDeferredEvent);
+        ConnectDeferredEvent = NULL;
+      }
+    }
+
+    if (!EFI_ERROR (Status)) {
+      for (Index = 0; Index < TopologyHint.NumberOfEntries; ++Index) {
+        PendingHints[Index] = TopologyHint.Entries[Index].DevicePathHash;
+      }
+      NumberOfPendingHints = TopologyHint.NumberOfEntries;
+      DeferringControllers = TRUE;
+    }
+  }
+
+  return EFI_SUCCESS;
 }
@@ -35,7 +35,7 @@ typedef struct _UNKNOWNFIELD
 //
 typedef struct _APPLE_FILESYSTEM_DRIVER_INFO_PRIVATE_DATA
 {
-    UINT32                                       Magic;
+    UINT32                                       Signature;
     EFI_HANDLE                                   ControllerHandle;
     EFI_HANDLE                                   DriverBindingHandle;
     APPLE_FILESYSTEM_EFIBOOTRECORD_LOCATION_INFO EfiBootRecordLocationInfo;
@@ -50,6 +50,20 @@ typedef struct _APPLE_FILESYSTEM_DRIVER_INFO_PRIVATE_DATA
     EFI_BLOCK_IO_PROTOCOL                        *BlockIoInterface;
     UNKNOWNFIELD                                 *Unknown4;
     UINT64                                       UnknownAddress;
+    //
+    // Fields below are not present in Apple's ApfsJumpStart.
+    // Container and volume metadata cached at probe time.
+    //
+    APPLE_FILESYSTEM_CONTAINER_INFO              ContainerInfo;
+    //
+    // State last seen on this controller, used to detect media changes
+    // on rebind without running the whole probe again.
+    //
+    UINT32                                       MediaId;
+    UINT64                                       ContainerOffset;
+    UINT64                                       ContainerChecksum;
+    UINT64                                       EfiBootRecordChecksum;
+    EFI_HANDLE                                   ApfsImageHandle;
 } APPLE_FILESYSTEM_DRIVER_INFO_PRIVATE_DATA;
 
 #define APPLE_FILESYSTEM_EFIBOOTRECORD_INFO_PRIVATE_DATA_FROM_THIS(a) \
@@ -227,28 +241,30 @@ typedef struct APFS_APSB_
     // Volume#. First volume start with 0, (0x00) 
     //
     UINT32             VolumeNumber;
-    UINT8              Reserved_1[20];
+    UINT64             Features;
+    UINT64             ReadOnlyCompatibleFeatures;
     //
     // Case setting of the volume.
     // 1 = Not case sensitive
     // 8 = Case sensitive (0x01, Not C.S)
     //
-    UINT32             CaseSetting;
-    UINT8              Reserved_2[12];
+    UINT64             IncompatibleFeatures;
+    UINT64             UnmountTimestamp;
     //
-    // Size of volume in Blocks. Last volume has no
-    // size set and has available the rest of the blocks
+    // Reserved and quota sizes of volume in Blocks.
     //
-    UINT64             VolumeSize;
-    UINT64             Reserved_3;
+    UINT64             ReserveBlockCount;
+    UINT64             QuotaBlockCount;
     // 
     // Blocks in use in this volumes 
     //
     UINT64             BlocksInUseCount;
-    UINT8              Reserved_4[32];
+    UINT8              Reserved_1[20];
+    UINT32             RootTreeType;
+    UINT32             ExtentRefTreeType;
+    UINT32             SnapshotMetaTreeType;
     //
-    // Block# to initial block of catalog B-Tree Object
-    // Map (BTOM)
+    // Block# to volume Object Map (BTOM)
     //
     UINT64             BlockNumberToInitialBTOM;
     //
@@ -263,7 +279,7 @@ typedef struct APFS_APSB_
     // Block# to list of Snapshots
     //
     UINT64             BlockNumberToListOfSnapshots;
-    UINT8              Reserved_5[16];
+    UINT8              Reserved_2[16];
     //
     // Next CNID
     //
@@ -276,7 +292,7 @@ typedef struct APFS_APSB_
     // Number of folders on the volume
     //
     UINT64             NumberOfFolder;
-    UINT8              Reserved_6[40];
+    UINT8              Reserved_3[40];
     //
     // Volume UUID
     //
@@ -285,7 +301,10 @@ typedef struct APFS_APSB_
     // Time Volume last written/modified
     //
     UINT64             ModificationTimestamp;
-    UINT64             Reserved_7;
+    //
+    // Volume flags, encryption state
+    //
+    UINT64             Flags;
     //
     // Creator/APFS-version 
     // Ex. (hfs_convert (apfs- 687.0.0.1.7))
@@ -295,12 +314,137 @@ typedef struct APFS_APSB_
     // Time Volume created 
     //
     UINT64             CreationTimestamp;
+    UINT64             CreationCheckpointId;
     //
-    // ???
+    // Last 8 modifiers of the volume, same layout as creator
     //
+    UINT8              ModificationHistory[384];
+    //
+    // Null-terminated UTF-8 volume name
+    //
+    UINT8              VolumeName[256];
+    UINT32             NextDocumentId;
+    //
+    // Volume role (System, Preboot, Recovery, VM)
+    //
+    UINT16             Role;
+    UINT16             Reserved_4;
 } APFS_APSB;
 #pragma pack(pop)
 
+//
+// Object Map (OMAP) structure
+// Maps virtual object ids, like volume superblock ids, to physical blocks
+//
+#pragma pack(push, 1)
+typedef struct APFS_OMAP_
+{
+    APFS_BLOCK_HEADER  BlockHeader;
+    UINT32             Flags;
+    UINT32             SnapshotCount;
+    UINT32             TreeType;
+    UINT32             SnapshotTreeType;
+    //
+    // Block# of the object map B-Tree root node
+    //
+    UINT64             TreeBlock;
+    UINT64             SnapshotTreeBlock;
+    UINT64             MostRecentSnapshot;
+    UINT64             PendingRevertMin;
+    UINT64             PendingRevertMax;
+} APFS_OMAP;
+#pragma pack(pop)
+
+//
+// B-Tree node flags
+//
+#define APFS_BTREE_NODE_ROOT          0x0001
+#define APFS_BTREE_NODE_LEAF          0x0002
+#define APFS_BTREE_NODE_FIXED_KV_SIZE 0x0004
+
+//
+// B-Tree node header
+//
+#pragma pack(push, 1)
+typedef struct APFS_BTREE_NODE_
+{
+    APFS_BLOCK_HEADER  BlockHeader;
+    UINT16             Flags;
+    //
+    // Level in the tree, 0 for leaf nodes
+    //
+    UINT16             Level;
+    UINT32             KeyCount;
+    //
+    // Table of contents location relative to the end of this header
+    //
+    UINT16             TableSpaceOffset;
+    UINT16             TableSpaceLength;
+    UINT16             FreeSpaceOffset;
+    UINT16             FreeSpaceLength;
+    UINT16             KeyFreeListOffset;
+    UINT16             KeyFreeListLength;
+    UINT16             ValueFreeListOffset;
+    UINT16             ValueFreeListLength;
+} APFS_BTREE_NODE;
+#pragma pack(pop)
+
+//
+// Root nodes keep the tree info in the last bytes of the block,
+// values are addressed backwards from its start
+//
+#define APFS_BTREE_INFO_SIZE          40
+
+//
+// Table of contents entry of fixed size key/value nodes
+//
+#pragma pack(push, 1)
+typedef struct APFS_BTREE_KVOFF_
+{
+    UINT16             KeyOffset;
+    UINT16             ValueOffset;
+} APFS_BTREE_KVOFF;
+#pragma pack(pop)
+
+//
+// Object Map B-Tree key, sorted by ObjectId then CheckpointId
+//
+#pragma pack(push, 1)
+typedef struct APFS_OMAP_KEY_
+{
+    UINT64             ObjectId;
+    UINT64             CheckpointId;
+} APFS_OMAP_KEY;
+#pragma pack(pop)
+
+#define APFS_OMAP_VALUE_DELETED       0x00000001
+
+//
+// Object Map B-Tree leaf value
+//
+#pragma pack(push, 1)
+typedef struct APFS_OMAP_VALUE_
+{
+    UINT32             Flags;
+    UINT32             Size;
+    UINT64             PhysicalBlock;
+} APFS_OMAP_VALUE;
+#pragma pack(pop)
+
+//
+// Maximum supported depth of Object Map B-Tree
+//
+#define APFS_OMAP_MAX_DEPTH           8
+
+//
+// Volume superblock resolved through Object Map
+//
+typedef struct APFS_VOLUME_LOCATION_
+{
+    UINT64             ObjectId;
+    UINT64             PhysicalBlock;
+} APFS_VOLUME_LOCATION;
+
 //
 // JSDR block structure
 //
@@ -22,12 +22,18 @@ WITHOUT WARRANTIES OR REPRESENTATIONS OF ANY KIND, EITHER EXPRESS OR IMPLIED.
 #include <Library/BaseMemoryLib.h>
 #include <Library/MemoryAllocationLib.h>
 #include <Protocol/UgaDraw.h>
+#include <Protocol/GraphicsOutput.h>
 #include <Library/DebugLib.h>
 #include <Library/UefiBootServicesTableLib.h>
 #include <Protocol/AppleImageCodecProtocol.h>
 #include "AppleImageCodec.h"
 #include "lodepng.h"
 
+//
+// Decoder memory reused by every decode, see LodePNGDecoderScratch.
+//
+STATIC LodePNGDecoderScratch mDecoderScratch;
+
 STATIC
 EG_IMAGE *
 CreateEfiGraphicsImage (
@@ -83,6 +89,7 @@ DecodePngImage (
   EG_IMAGE          *NewImage    = NULL;
   EFI_UGA_PIXEL     *Pixel       = NULL;
   UINT8             *Data        = NULL;
+  UINT8             *DataWalker  = NULL;
   INTN              X            = 0;
   INTN              Y            = 0;
   UINT32            Width        = 0;
@@ -95,6 +102,7 @@ DecodePngImage (
   // Init lodepng state
   //
   lodepng_state_init (&State);
+  State.decoder.zlibsettings.scratch = &mDecoderScratch;
 
   //
   // It should return 0 on success
@@ -109,6 +117,7 @@ DecodePngImage (
     );
 
   if (Error) {
+    lodepng_state_cleanup (&State);
     return NULL;
   }
 
@@ -121,6 +130,7 @@ DecodePngImage (
   // Check existence of alpha layer
   //
   HasAlphaType = lodepng_is_alpha_type (Color);
+  lodepng_state_cleanup (&State);
 
   NewImage = CreateEfiGraphicsImage (
     Width,
@@ -133,12 +143,13 @@ DecodePngImage (
   }
 
   Pixel = (EFI_UGA_PIXEL*) NewImage->PixelData;
+  DataWalker = Data;
   for (Y = 0; Y < NewImage->Height; Y++) {
     for (X = 0; X < NewImage->Width; X++) {
-      Pixel->Red = *Data++;
-      Pixel->Green = *Data++;
-      Pixel->Blue = *Data++;
-      Pixel->Reserved = 0xFF - *Data++;
+      Pixel->Red = *DataWalker++;
+      Pixel->Green = *DataWalker++;
+      Pixel->Blue = *DataWalker++;
+      Pixel->Reserved = 0xFF - *DataWalker++;
       Pixel++;
     }
   }
@@ -254,6 +265,189 @@ GetImageDimsVersion (
   return Status;
 }
 
+STATIC
+VOID
+GetPixelMaskLayout (
+  IN  UINT32  Mask,
+  OUT UINT8   *Shift,
+  OUT UINT8   *Width
+  )
+{
+  *Shift = 0;
+  *Width = 0;
+
+  if (Mask == 0) {
+    return;
+  }
+
+  while ((Mask & 1U) == 0) {
+    Mask >>= 1U;
+    ++*Shift;
+  }
+
+  while ((Mask & 1U) != 0) {
+    Mask >>= 1U;
+    ++*Width;
+  }
+}
+
+STATIC
+UINT32
+ScalePixelComponent (
+  IN UINT8  Value,
+  IN UINT8  Shift,
+  IN UINT8  Width
+  )
+{
+  UINT32  Scaled;
+
+  if (Width == 0) {
+    return 0;
+  }
+
+  if (Width <= 8) {
+    Scaled = (UINT32) Value >> (8 - Width);
+  } else {
+    Scaled = (UINT32) Value << (Width - 8);
+  }
+
+  return Scaled << Shift;
+}
+
+//
+// Component positions of a PixelBitMask mode, in red, green, blue, reserved order.
+//
+typedef struct {
+  UINT8  Shift[4];
+  UINT8  Bits[4];
+} PIXEL_MASK_LAYOUT;
+
+//
+// lodepng row callbacks, they rearrange a row of RGBA8 pixels in place.
+//
+STATIC
+VOID
+StoreRowBlueGreenRed (
+  IN OUT UINT8       *Row,
+  IN     UINT32      Width,
+  IN     CONST VOID  *Context
+  )
+{
+  UINT32  Index;
+  UINT8   Red;
+
+  for (Index = 0; Index < Width; ++Index, Row += 4) {
+    Red    = Row[0];
+    Row[0] = Row[2];
+    Row[2] = Red;
+  }
+}
+
+STATIC
+VOID
+StoreRowBitMask (
+  IN OUT UINT8       *Row,
+  IN     UINT32      Width,
+  IN     CONST VOID  *Context
+  )
+{
+  CONST PIXEL_MASK_LAYOUT  *Layout;
+  UINT32                   Index;
+  UINT32                   *Pixel;
+
+  Layout = (CONST PIXEL_MASK_LAYOUT *) Context;
+
+  for (Index = 0; Index < Width; ++Index, Row += 4) {
+    Pixel  = (UINT32 *) Row;
+    *Pixel = ScalePixelComponent (Row[0], Layout->Shift[0], Layout->Bits[0])
+      | ScalePixelComponent (Row[1], Layout->Shift[1], Layout->Bits[1])
+      | ScalePixelComponent (Row[2], Layout->Shift[2], Layout->Bits[2])
+      | ScalePixelComponent (Row[3], Layout->Shift[3], Layout->Bits[3]);
+  }
+}
+
+//
+// Decodes PNG data straight into the Graphics Output pixel layout.
+// lodepng produces RGBA8, which has the same size as every supported target
+// format, so each row is converted in place as soon as the decoder finishes
+// it, and the caller receives the decoder output buffer without any copies.
+//
+STATIC
+EFI_STATUS
+DecodeImageDataGop (
+  VOID                               *Buffer,
+  UINTN                              BufferSize,
+  APPLE_IMAGE_CODEC_GOP_DECODE_INFO  *DecodeInfo,
+  VOID                               **RawImageData,
+  UINTN                              *RawImageDataSize
+  )
+{
+  EFI_GRAPHICS_OUTPUT_MODE_INFORMATION  *ModeInfo;
+  LodePNGState      State;
+  PIXEL_MASK_LAYOUT Layout;
+  UINT8             *Data        = NULL;
+  UINT32            Width        = 0;
+  UINT32            Height       = 0;
+  UINT32            Error        = 0;
+
+  if (DecodeInfo == NULL || DecodeInfo->ModeInfo == NULL) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  ModeInfo = DecodeInfo->ModeInfo;
+
+  lodepng_state_init (&State);
+  State.decoder.zlibsettings.scratch = &mDecoderScratch;
+
+  switch (ModeInfo->PixelFormat) {
+    case PixelRedGreenBlueReserved8BitPerColor:
+      //
+      // Matches lodepng RGBA8 output byte order.
+      //
+      break;
+
+    case PixelBlueGreenRedReserved8BitPerColor:
+    case PixelBltOnly:
+      State.decoder.convert_row = StoreRowBlueGreenRed;
+      break;
+
+    case PixelBitMask:
+      GetPixelMaskLayout (ModeInfo->PixelInformation.RedMask, &Layout.Shift[0], &Layout.Bits[0]);
+      GetPixelMaskLayout (ModeInfo->PixelInformation.GreenMask, &Layout.Shift[1], &Layout.Bits[1]);
+      GetPixelMaskLayout (ModeInfo->PixelInformation.BlueMask, &Layout.Shift[2], &Layout.Bits[2]);
+      GetPixelMaskLayout (ModeInfo->PixelInformation.ReservedMask, &Layout.Shift[3], &Layout.Bits[3]);
+      State.decoder.convert_row         = StoreRowBitMask;
+      State.decoder.convert_row_context = &Layout;
+      break;
+
+    default:
+      lodepng_state_cleanup (&State);
+      return EFI_UNSUPPORTED;
+  }
+
+  Error = lodepng_decode (
+    &Data,
+    &Width,
+    &Height,
+    &State,
+    Buffer,
+    BufferSize
+    );
+
+  lodepng_state_cleanup (&State);
+
+  if (Error) {
+    return EFI_UNSUPPORTED;
+  }
+
+  DecodeInfo->ImageWidth  = Width;
+  DecodeInfo->ImageHeight = Height;
+  *RawImageData           = Data;
+  *RawImageDataSize       = (UINTN) Width * Height * sizeof (UINT32);
+
+  return EFI_SUCCESS;
+}
+
 EFI_STATUS
 EFIAPI
 DecodeImageDataVersion (
@@ -269,6 +463,17 @@ DecodeImageDataVersion (
     Status = EFI_UNSUPPORTED;
     if (Version <= 1) {
       Status = DecodeImageData (Buffer, BufferSize, RawImageData, RawImageDataSize);
+    } else if (Version == APPLE_IMAGE_CODEC_DECODE_GOP_VERSION) {
+      //
+      // *RawImageData carries the caller's decode info in and the pixels out.
+      //
+      Status = DecodeImageDataGop (
+        Buffer,
+        BufferSize,
+        (APPLE_IMAGE_CODEC_GOP_DECODE_INFO *) *RawImageData,
+        (VOID **) RawImageData,
+        RawImageDataSize
+        );
     }
   }
   return Status;
@@ -279,7 +484,7 @@ DecodeImageDataVersion (
 //
 STATIC APPLE_IMAGE_CODEC_PROTOCOL gAppleImageCodec = {
   // Version
-  0x20000,
+  APPLE_IMAGE_CODEC_VERSION,
   // FileExt
   0,
   RecognizeImageData,
@@ -308,6 +513,7 @@ InitializeAppleImageCodec (
   EFI_STATUS                  Status;
   EFI_HANDLE                  NewHandle                 = NULL;
   APPLE_IMAGE_CODEC_PROTOCOL  *AppleImageCodecInterface = NULL;
+  UINT32                      Error;
 
   Status = gBS->LocateProtocol (
     &gAppleImageCodecProtocolGuid,
@@ -316,6 +522,14 @@ InitializeAppleImageCodec (
     );
 
   if (EFI_ERROR (Status)) {
+    //
+    // Decodes still work without the scratch memory, they just allocate their own
+    //
+    Error = lodepng_decoder_scratch_init (&mDecoderScratch);
+    if (Error) {
+      DEBUG ((DEBUG_VERBOSE, "AppleImageCodec: decoder scratch allocation failure - %u\n", Error));
+    }
+
     //
     // Install instance of Apple image codec protocol for
     // PNG files
@@ -326,6 +540,9 @@ InitializeAppleImageCodec (
       &gAppleImageCodec,
       NULL
       );
+    if (EFI_ERROR (Status)) {
+      lodepng_decoder_scratch_cleanup (&mDecoderScratch);
+    }
   } else {
     Status = EFI_ALREADY_STARTED;
   }
@@ -0,0 +1,513 @@
+/** @file
+
+lodepng decoder scratch host test.
+Checks that decodes sharing a LodePNGDecoderScratch give the same images as
+decodes without one, always hand the scratch back, fall back to allocating
+when it is taken, and save the pool allocations it exists for.
+
+Copyright (c) 2018, savvas
+
+All rights reserved.
+
+This program and the accompanying materials
+are licensed and made available under the terms and conditions of the BSD License
+which accompanies this distribution.  The full text of the license may be found at
+http://opensource.org/licenses/bsd-license.php
+
+THE PROGRAM IS DISTRIBUTED UNDER THE BSD LICENSE ON AN "AS IS" BASIS,
+WITHOUT WARRANTIES OR REPRESENTATIONS OF ANY KIND, EITHER EXPRESS OR IMPLIED.
+
+**/
+
+#include <Library/BaseMemoryLib.h>
+#include <Library/MemoryAllocationLib.h>
+#include <Library/UefiBootServicesTableLib.h>
+#include "../lodepng.h"
+#include "HostLib.h"
+
+#define TEST_PIXEL_SIZE         4
+#define TEST_STORED_BLOCK_SIZE  0xFFFFU
+
+//
+// Decodes of a small image with the scratch may only allocate the output
+// and, for a color conversion, the converted image
+//
+#define TEST_MAX_SCRATCH_ALLOCATIONS  2
+
+//
+// 16x12 RGBA image compressed by zlib with dynamic Huffman codes, the pixels
+// follow TestPixel with Variant 0
+//
+#define TEST_DYNAMIC_WIDTH   16
+#define TEST_DYNAMIC_HEIGHT  12
+
+STATIC CONST UINT8 mDynamicStream[] = {
+  0x78, 0xDA, 0xED, 0xD0, 0x31, 0x11, 0xC0, 0x30, 0x10, 0x03, 0x41, 0x41,
+  0x13, 0x04, 0x43, 0x7A, 0x28, 0x86, 0x22, 0x48, 0x61, 0xE0, 0x5C, 0xE1,
+  0xCC, 0x08, 0x44, 0x9A, 0xDB, 0x4A, 0x8D, 0x24, 0xE5, 0x48, 0x3E, 0x9F,
+  0x46, 0x97, 0x83, 0x53, 0x06, 0x53, 0x4A, 0x8B, 0x2C, 0xC6, 0x57, 0xA3,
+  0xCB, 0xC1, 0x29, 0x83, 0x29, 0xA5, 0x4D, 0x36, 0xE3, 0xAB, 0xD1, 0xE5,
+  0xE0, 0x94, 0xC1, 0x94, 0xD2, 0x43, 0x1E, 0xC6, 0x57, 0xA3, 0xCB, 0xC1,
+  0x29, 0x83, 0x29, 0xF5, 0x7F, 0xF0, 0x7F, 0x80, 0x2F, 0x10, 0x67, 0xC1,
+  0x50
+};
+
+typedef struct {
+  CONST CHAR8  *Name;
+  UINT8        *Png;
+  UINTN        PngSize;
+  BOOLEAN      Small;
+} TEST_IMAGE;
+
+STATIC EFI_ALLOCATE_POOL  mOriginalAllocatePool;
+STATIC UINTN              mNumberOfAllocations;
+
+STATIC
+EFI_STATUS
+EFIAPI
+TestAllocatePool (
+  IN  EFI_MEMORY_TYPE  PoolType,
+  IN  UINTN            Size,
+  OUT VOID             **Buffer
+  )
+{
+  ++mNumberOfAllocations;
+  return mOriginalAllocatePool (PoolType, Size, Buffer);
+}
+
+STATIC
+UINT8
+TestPixel (
+  IN UINTN  Variant,
+  IN UINTN  X,
+  IN UINTN  Y,
+  IN UINTN  Channel
+  )
+{
+  switch (Channel) {
+    case 0:
+      return (UINT8) ((X / 4) * 64 + Variant);
+    case 1:
+      return (UINT8) ((Y % 4) * 80);
+    case 2:
+      return (UINT8) (((X + Y) % 2) != 0 ? 0x40 : 0xC0);
+    default:
+      return 0xFF;
+  }
+}
+
+STATIC
+VOID
+TestWriteBe32 (
+  OUT UINT8   *Buffer,
+  IN  UINT32  Value
+  )
+{
+  Buffer[0] = (UINT8) (Value >> 24U);
+  Buffer[1] = (UINT8) (Value >> 16U);
+  Buffer[2] = (UINT8) (Value >> 8U);
+  Buffer[3] = (UINT8) Value;
+}
+
+//
+// Builds an RGBA PNG holding Stream in one IDAT chunk
+//
+STATIC
+UINT8 *
+TestBuildPng (
+  IN  UINT32       Width,
+  IN  UINT32       Height,
+  IN  CONST UINT8  *Stream,
+  IN  UINTN        StreamSize,
+  OUT UINTN        *PngSize
+  )
+{
+  STATIC CONST UINT8  Signature[] = { 0x89, 0x50, 0x4E, 0x47, 0x0D, 0x0A, 0x1A, 0x0A };
+  UINT8               Header[13];
+  UINT8               *Png;
+  size_t              Size;
+  unsigned            Error;
+
+  Png = AllocatePool (sizeof (Signature));
+  if (Png == NULL) {
+    return NULL;
+  }
+
+  CopyMem (Png, Signature, sizeof (Signature));
+  Size = sizeof (Signature);
+
+  TestWriteBe32 (&Header[0], Width);
+  TestWriteBe32 (&Header[4], Height);
+  Header[8]  = 8;
+  Header[9]  = LCT_RGBA;
+  Header[10] = 0;
+  Header[11] = 0;
+  Header[12] = 0;
+
+  Error = lodepng_chunk_create (&Png, &Size, sizeof (Header), "IHDR", Header);
+  if (!Error) {
+    Error = lodepng_chunk_create (&Png, &Size, (unsigned) StreamSize, "IDAT", Stream);
+  }
+
+  if (!Error) {
+    Error = lodepng_chunk_create (&Png, &Size, 0, "IEND", NULL);
+  }
+
+  if (Error) {
+    FreePool (Png);
+    return NULL;
+  }
+
+  *PngSize = Size;
+  return Png;
+}
+
+//
+// Builds an RGBA PNG of TestPixel stored uncompressed
+//
+STATIC
+UINT8 *
+TestBuildStoredPng (
+  IN  UINT32  Width,
+  IN  UINT32  Height,
+  IN  UINTN   Variant,
+  OUT UINTN   *PngSize
+  )
+{
+  UINT8   *Raw;
+  UINT8   *Stream;
+  UINT8   *Png;
+  UINTN   ScanlineSize;
+  UINTN   RawSize;
+  UINTN   X;
+  UINTN   Y;
+  UINTN   Channel;
+  UINTN   Offset;
+  UINTN   Size;
+  UINTN   Position;
+  UINT32  Adler1;
+  UINT32  Adler2;
+
+  ScanlineSize = 1 + Width * TEST_PIXEL_SIZE;
+  RawSize      = Height * ScanlineSize;
+
+  Raw    = AllocatePool (RawSize);
+  Stream = AllocatePool (2 + (RawSize / TEST_STORED_BLOCK_SIZE + 1) * 5 + RawSize + 4);
+  if (Raw == NULL || Stream == NULL) {
+    return NULL;
+  }
+
+  for (Y = 0; Y < Height; ++Y) {
+    Raw[Y * ScanlineSize] = 0;
+    for (X = 0; X < Width; ++X) {
+      for (Channel = 0; Channel < TEST_PIXEL_SIZE; ++Channel) {
+        Raw[Y * ScanlineSize + 1 + X * TEST_PIXEL_SIZE + Channel] = TestPixel (Variant, X, Y, Channel);
+      }
+    }
+  }
+
+  Stream[0] = 0x78;
+  Stream[1] = 0x01;
+  Position  = 2;
+
+  for (Offset = 0; Offset < RawSize; Offset += Size) {
+    Size = MIN (RawSize - Offset, TEST_STORED_BLOCK_SIZE);
+    Stream[Position++] = (UINT8) (Offset + Size == RawSize ? 1 : 0);
+    Stream[Position++] = (UINT8) Size;
+    Stream[Position++] = (UINT8) (Size >> 8U);
+    Stream[Position++] = (UINT8) ~Size;
+    Stream[Position++] = (UINT8) (~Size >> 8U);
+    CopyMem (&Stream[Position], &Raw[Offset], Size);
+    Position += Size;
+  }
+
+  Adler1 = 1;
+  Adler2 = 0;
+  for (Offset = 0; Offset < RawSize; ++Offset) {
+    Adler1 = (Adler1 + Raw[Offset]) % 65521U;
+    Adler2 = (Adler2 + Adler1) % 65521U;
+  }
+
+  TestWriteBe32 (&Stream[Position], (Adler2 << 16U) | Adler1);
+  Position += 4;
+
+  Png = TestBuildPng (Width, Height, Stream, Position, PngSize);
+
+  FreePool (Stream);
+  FreePool (Raw);
+  return Png;
+}
+
+STATIC
+unsigned
+TestDecode (
+  IN  CONST TEST_IMAGE       *Image,
+  IN  LodePNGColorType       ColorType,
+  IN  LodePNGDecoderScratch  *Scratch  OPTIONAL,
+  OUT UINT8                  **Pixels,
+  OUT UINTN                  *PixelsSize
+  )
+{
+  LodePNGState  State;
+  unsigned      Width;
+  unsigned      Height;
+  unsigned      Error;
+
+  *Pixels = NULL;
+
+  lodepng_state_init (&State);
+  State.info_raw.colortype           = ColorType;
+  State.decoder.zlibsettings.scratch = Scratch;
+
+  mNumberOfAllocations = 0;
+  Error = lodepng_decode (Pixels, &Width, &Height, &State, Image->Png, Image->PngSize);
+  *PixelsSize = lodepng_get_raw_size (Width, Height, &State.info_raw);
+  lodepng_state_cleanup (&State);
+
+  if (Error && *Pixels != NULL) {
+    FreePool (*Pixels);
+    *Pixels = NULL;
+  }
+
+  return Error;
+}
+
+//
+// Decodes Image with the scratch and without it and compares the results
+//
+STATIC
+BOOLEAN
+TestImage (
+  IN CONST TEST_IMAGE       *Image,
+  IN LodePNGColorType       ColorType,
+  IN LodePNGDecoderScratch  *Scratch
+  )
+{
+  LodePNGDecoderScratch  Saved;
+  UINT8                  *Expected;
+  UINTN                  ExpectedSize;
+  UINTN                  ExpectedAllocations;
+  UINT8                  *Pixels;
+  UINTN                  PixelsSize;
+  UINTN                  Allocations;
+  unsigned               Error;
+  BOOLEAN                Passed;
+
+  CopyMem (&Saved, Scratch, sizeof (Saved));
+
+  Error = TestDecode (Image, ColorType, NULL, &Expected, &ExpectedSize);
+  ExpectedAllocations = mNumberOfAllocations;
+  if (Error) {
+    HostPrint ("%s: decode error %u\n", Image->Name, Error);
+    return FALSE;
+  }
+
+  Error = TestDecode (Image, ColorType, Scratch, &Pixels, &PixelsSize);
+  Allocations = mNumberOfAllocations;
+  if (Error) {
+    HostPrint ("%s: decode error %u with scratch\n", Image->Name, Error);
+    FreePool (Expected);
+    return FALSE;
+  }
+
+  Passed = TRUE;
+
+  if (PixelsSize != ExpectedSize || CompareMem (Pixels, Expected, ExpectedSize) != 0) {
+    HostPrint ("%s: decode with scratch differs\n", Image->Name);
+    Passed = FALSE;
+  }
+
+  if (CompareMem (&Saved, Scratch, sizeof (Saved)) != 0) {
+    HostPrint ("%s: scratch not handed back\n", Image->Name);
+    Passed = FALSE;
+  }
+
+  if (Image->Small && Scratch->buffer != NULL
+   && (Allocations > TEST_MAX_SCRATCH_ALLOCATIONS || Allocations >= ExpectedAllocations)) {
+    HostPrint (
+      "%s: %llu allocations with scratch, %llu without\n",
+      Image->Name,
+      (unsigned long long) Allocations,
+      (unsigned long long) ExpectedAllocations
+      );
+    Passed = FALSE;
+  }
+
+  FreePool (Pixels);
+  FreePool (Expected);
+  return Passed;
+}
+
+//
+// A failing decode must hand the scratch back as well
+//
+STATIC
+BOOLEAN
+TestError (
+  IN CONST TEST_IMAGE       *Image,
+  IN LodePNGDecoderScratch  *Scratch
+  )
+{
+  LodePNGDecoderScratch  Saved;
+  UINT8                  *Pixels;
+  UINTN                  PixelsSize;
+
+  CopyMem (&Saved, Scratch, sizeof (Saved));
+
+  if (TestDecode (Image, LCT_RGBA, Scratch, &Pixels, &PixelsSize) == 0) {
+    HostPrint ("%s: broken image decoded\n", Image->Name);
+    FreePool (Pixels);
+    return FALSE;
+  }
+
+  if (CompareMem (&Saved, Scratch, sizeof (Saved)) != 0) {
+    HostPrint ("%s: scratch not handed back after an error\n", Image->Name);
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+int
+main (
+  int   argc,
+  char  *argv[]
+  )
+{
+  STATIC CONST LodePNGColorType  ColorTypes[] = { LCT_RGBA, LCT_RGB };
+
+  TEST_IMAGE             Images[4];
+  TEST_IMAGE             Broken[3];
+  UINT8                  InvalidStream[sizeof (mDynamicStream)];
+  LodePNGDecoderScratch  Scratch;
+  LodePNGDecoderScratch  Taken;
+  UINTN                  Round;
+  UINTN                  Index;
+  UINTN                  Color;
+  UINTN                  NumberOfImages;
+  BOOLEAN                Passed;
+
+  mOriginalAllocatePool = gBS->AllocatePool;
+  gBS->AllocatePool     = TestAllocatePool;
+
+  Images[0].Name  = "Dynamic 16x12";
+  Images[0].Png   = TestBuildPng (
+    TEST_DYNAMIC_WIDTH,
+    TEST_DYNAMIC_HEIGHT,
+    mDynamicStream,
+    sizeof (mDynamicStream),
+    &Images[0].PngSize
+    );
+  Images[0].Small = TRUE;
+
+  Images[1].Name  = "Stored 16x12";
+  Images[1].Png   = TestBuildStoredPng (16, 12, 1, &Images[1].PngSize);
+  Images[1].Small = TRUE;
+
+  Images[2].Name  = "Stored 48x40";
+  Images[2].Png   = TestBuildStoredPng (48, 40, 2, &Images[2].PngSize);
+  Images[2].Small = TRUE;
+
+  //
+  // Scanlines exceed LODEPNG_SCRATCH_BUFFER_SIZE, only the trees are reused
+  //
+  Images[3].Name  = "Stored 300x120";
+  Images[3].Png   = TestBuildStoredPng (300, 120, 3, &Images[3].PngSize);
+  Images[3].Small = FALSE;
+
+  NumberOfImages = ARRAY_SIZE (Images);
+  for (Index = 0; Index < NumberOfImages; ++Index) {
+    if (Images[Index].Png == NULL) {
+      HostPrint ("%s: PNG build failure\n", Images[Index].Name);
+      return 1;
+    }
+  }
+
+  //
+  // The first image ends inside its IDAT chunk, the others fail while inflating
+  //
+  CopyMem (&Broken[0], &Images[1], sizeof (Broken[0]));
+  Broken[0].Name     = "Truncated file";
+  Broken[0].PngSize -= 12 + 16;
+
+  Broken[1].Name  = "Truncated stream";
+  Broken[1].Png   = TestBuildPng (
+    TEST_DYNAMIC_WIDTH,
+    TEST_DYNAMIC_HEIGHT,
+    mDynamicStream,
+    sizeof (mDynamicStream) / 2,
+    &Broken[1].PngSize
+    );
+
+  //
+  // Block type 3 is reserved
+  //
+  CopyMem (InvalidStream, mDynamicStream, sizeof (InvalidStream));
+  InvalidStream[2] |= 0x06U;
+
+  Broken[2].Name  = "Invalid block type";
+  Broken[2].Png   = TestBuildPng (
+    TEST_DYNAMIC_WIDTH,
+    TEST_DYNAMIC_HEIGHT,
+    InvalidStream,
+    sizeof (InvalidStream),
+    &Broken[2].PngSize
+    );
+
+  if (Broken[1].Png == NULL || Broken[2].Png == NULL) {
+    HostPrint ("Broken PNG build failure\n");
+    return 1;
+  }
+
+  if (lodepng_decoder_scratch_init (&Scratch) != 0) {
+    HostPrint ("Scratch allocation failure\n");
+    return 1;
+  }
+
+  Passed = TRUE;
+
+  //
+  // Consecutive decodes of different images reuse the same scratch
+  //
+  for (Round = 0; Passed && Round < 3; ++Round) {
+    for (Index = 0; Passed && Index < NumberOfImages; ++Index) {
+      for (Color = 0; Passed && Color < ARRAY_SIZE (ColorTypes); ++Color) {
+        Passed = TestImage (&Images[Index], ColorTypes[Color], &Scratch);
+      }
+    }
+  }
+
+  for (Index = 0; Passed && Index < ARRAY_SIZE (Broken); ++Index) {
+    Passed = TestError (&Broken[Index], &Scratch);
+  }
+
+  //
+  // A nested decode finds the scratch taken and allocates its own memory
+  //
+  CopyMem (&Taken, &Scratch, sizeof (Taken));
+  Scratch.trees  = NULL;
+  Scratch.buffer = NULL;
+
+  for (Index = 0; Passed && Index < NumberOfImages; ++Index) {
+    Passed = TestImage (&Images[Index], LCT_RGB, &Scratch);
+  }
+
+  CopyMem (&Scratch, &Taken, sizeof (Scratch));
+  lodepng_decoder_scratch_cleanup (&Scratch);
+
+  for (Index = 0; Index < NumberOfImages; ++Index) {
+    FreePool (Images[Index].Png);
+  }
+
+  FreePool (Broken[1].Png);
+  FreePool (Broken[2].Png);
+
+  gBS->AllocatePool = mOriginalAllocatePool;
+
+  if (!Passed) {
+    return 1;
+  }
+
+  HostPrint ("DecoderScratchTest: %llu images passed\n", (unsigned long long) NumberOfImages);
+  return 0;
+}
@@ -0,0 +1,555 @@
+/** @file
+
+AppleImageCodec Graphics Output decode host test.
+Decodes filtered, interlaced, color converted and palette images for every
+Graphics Output pixel format and compares them against the EFI_UGA_PIXEL
+output of the same images.
+
+Copyright (c) 2018, savvas
+
+All rights reserved.
+
+This program and the accompanying materials
+are licensed and made available under the terms and conditions of the BSD License
+which accompanies this distribution.  The full text of the license may be found at
+http://opensource.org/licenses/bsd-license.php
+
+THE PROGRAM IS DISTRIBUTED UNDER THE BSD LICENSE ON AN "AS IS" BASIS,
+WITHOUT WARRANTIES OR REPRESENTATIONS OF ANY KIND, EITHER EXPRESS OR IMPLIED.
+
+**/
+
+#include <Protocol/AppleImageCodecProtocol.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/MemoryAllocationLib.h>
+#include <Library/UefiBootServicesTableLib.h>
+#include <AppleUiSupport.h>
+#include "../lodepng.h"
+#include "HostLib.h"
+
+#define TEST_STORED_BLOCK_SIZE  0xFFFFU
+#define TEST_PALETTE_SIZE       4
+
+//
+// PNG color types
+//
+#define TEST_COLOR_PALETTE  3
+#define TEST_COLOR_RGB      2
+#define TEST_COLOR_RGBA     6
+
+typedef struct {
+  CONST CHAR8  *Name;
+  UINT32       Width;
+  UINT32       Height;
+  UINT8        ColorType;
+  UINT8        BitDepth;
+  BOOLEAN      Interlaced;
+} TEST_IMAGE;
+
+typedef struct {
+  CONST CHAR8                *Name;
+  EFI_GRAPHICS_PIXEL_FORMAT  PixelFormat;
+  EFI_PIXEL_BITMASK          PixelInformation;
+} TEST_FORMAT;
+
+//
+// Every row uses the next filter type, so rows are only final once the row
+// below them has been unfiltered. Odd sizes leave no Adam7 pass empty and make
+// the 2-bit palette rows end in the middle of a byte.
+//
+STATIC CONST TEST_IMAGE mImages[] = {
+  { "RGBA 13x11",            13, 11, TEST_COLOR_RGBA,    8, FALSE },
+  { "RGBA 13x11 interlaced", 13, 11, TEST_COLOR_RGBA,    8, TRUE  },
+  { "RGB 13x11",             13, 11, TEST_COLOR_RGB,     8, FALSE },
+  { "Palette 2-bit 5x7",      5,  7, TEST_COLOR_PALETTE, 2, FALSE }
+};
+
+STATIC CONST TEST_FORMAT mFormats[] = {
+  { "RGB",                PixelRedGreenBlueReserved8BitPerColor, { 0, 0, 0, 0 } },
+  { "BGR",                PixelBlueGreenRedReserved8BitPerColor, { 0, 0, 0, 0 } },
+  { "BltOnly",            PixelBltOnly,                          { 0, 0, 0, 0 } },
+  { "BitMask 10:10:10:2", PixelBitMask, { 0x000003FFU, 0x000FFC00U, 0x3FF00000U, 0xC0000000U } },
+  { "BitMask 5:6:5",      PixelBitMask, { 0x0000F800U, 0x000007E0U, 0x0000001FU, 0x00000000U } }
+};
+
+STATIC CONST UINT8 mPalette[TEST_PALETTE_SIZE * 3] = {
+  0x10, 0x80, 0xF0,
+  0xFF, 0x00, 0x00,
+  0x00, 0xFF, 0x7F,
+  0x33, 0x66, 0x99
+};
+
+//
+// Adam7 pass origins and steps, a single pass covers non-interlaced images
+//
+STATIC CONST UINT8 mPassStartX[] = { 0, 4, 0, 2, 0, 1, 0 };
+STATIC CONST UINT8 mPassStartY[] = { 0, 0, 4, 0, 2, 0, 1 };
+STATIC CONST UINT8 mPassStepX[]  = { 8, 8, 4, 4, 2, 2, 1 };
+STATIC CONST UINT8 mPassStepY[]  = { 8, 8, 8, 4, 4, 2, 2 };
+
+STATIC APPLE_IMAGE_CODEC_PROTOCOL  *mImageCodec;
+
+STATIC
+UINT8
+TestSample (
+  IN UINTN  X,
+  IN UINTN  Y,
+  IN UINTN  Channel
+  )
+{
+  return (UINT8) (X * 37U + Y * 59U + Channel * 101U + X * Y * 7U);
+}
+
+STATIC
+UINTN
+TestBitsPerPixel (
+  IN CONST TEST_IMAGE  *Image
+  )
+{
+  switch (Image->ColorType) {
+    case TEST_COLOR_RGBA:
+      return 4U * Image->BitDepth;
+    case TEST_COLOR_RGB:
+      return 3U * Image->BitDepth;
+    default:
+      return Image->BitDepth;
+  }
+}
+
+//
+// Stores the pixel at X, Y of the image as pixel Index of a packed row
+//
+STATIC
+VOID
+TestStorePixel (
+  IN     CONST TEST_IMAGE  *Image,
+  IN OUT UINT8             *Row,
+  IN     UINTN             Index,
+  IN     UINTN             X,
+  IN     UINTN             Y
+  )
+{
+  UINTN  Channel;
+  UINTN  Channels;
+  UINTN  Bit;
+
+  if (Image->ColorType == TEST_COLOR_PALETTE) {
+    Bit            = Index * Image->BitDepth;
+    Row[Bit / 8U] |= (UINT8) (((X + 3U * Y) % TEST_PALETTE_SIZE) << (8U - Image->BitDepth - Bit % 8U));
+    return;
+  }
+
+  Channels = TestBitsPerPixel (Image) / 8U;
+  for (Channel = 0; Channel < Channels; ++Channel) {
+    Row[Index * Channels + Channel] = TestSample (X, Y, Channel);
+  }
+}
+
+STATIC
+UINT8
+TestPaeth (
+  IN UINT8  Left,
+  IN UINT8  Above,
+  IN UINT8  UpperLeft
+  )
+{
+  INTN  Estimate;
+  UINTN  DistanceLeft;
+  UINTN  DistanceAbove;
+  UINTN  DistanceUpperLeft;
+
+  Estimate          = (INTN) Left + Above - UpperLeft;
+  DistanceLeft      = Estimate >= Left ? Estimate - Left : Left - Estimate;
+  DistanceAbove     = Estimate >= Above ? Estimate - Above : Above - Estimate;
+  DistanceUpperLeft = Estimate >= UpperLeft ? Estimate - UpperLeft : UpperLeft - Estimate;
+
+  if (DistanceLeft <= DistanceAbove && DistanceLeft <= DistanceUpperLeft) {
+    return Left;
+  }
+
+  return DistanceAbove <= DistanceUpperLeft ? Above : UpperLeft;
+}
+
+//
+// Appends the filtered scanlines of one Adam7 pass, or of the whole image,
+// to Raw and returns their size
+//
+STATIC
+UINTN
+TestFilterPass (
+  IN  CONST TEST_IMAGE  *Image,
+  IN  UINTN             Pass,
+  OUT UINT8             *Raw
+  )
+{
+  UINT8  *Row;
+  UINT8  *Above;
+  UINTN  Width;
+  UINTN  Height;
+  UINTN  RowSize;
+  UINTN  PixelSize;
+  UINTN  Position;
+  UINTN  X;
+  UINTN  Y;
+  UINTN  Index;
+  UINT8  Filter;
+  UINT8  Left;
+  UINT8  UpperLeft;
+  UINT8  Predicted;
+
+  Width  = (Image->Width + mPassStepX[Pass] - 1U - mPassStartX[Pass]) / mPassStepX[Pass];
+  Height = (Image->Height + mPassStepY[Pass] - 1U - mPassStartY[Pass]) / mPassStepY[Pass];
+  if (!Image->Interlaced) {
+    Width  = Image->Width;
+    Height = Image->Height;
+  }
+
+  RowSize   = (Width * TestBitsPerPixel (Image) + 7U) / 8U;
+  PixelSize = MAX (TestBitsPerPixel (Image) / 8U, 1U);
+  Row       = AllocateZeroPool (RowSize);
+  Above     = AllocateZeroPool (RowSize);
+  Position  = 0;
+
+  for (Y = 0; Y < Height; ++Y) {
+    ZeroMem (Row, RowSize);
+    for (X = 0; X < Width; ++X) {
+      if (Image->Interlaced) {
+        TestStorePixel (Image, Row, X, mPassStartX[Pass] + X * mPassStepX[Pass], mPassStartY[Pass] + Y * mPassStepY[Pass]);
+      } else {
+        TestStorePixel (Image, Row, X, X, Y);
+      }
+    }
+
+    Filter          = (UINT8) (Y % 5U);
+    Raw[Position++] = Filter;
+
+    for (Index = 0; Index < RowSize; ++Index) {
+      Left      = Index >= PixelSize ? Row[Index - PixelSize] : 0;
+      UpperLeft = Index >= PixelSize ? Above[Index - PixelSize] : 0;
+
+      switch (Filter) {
+        case 1:
+          Predicted = Left;
+          break;
+        case 2:
+          Predicted = Above[Index];
+          break;
+        case 3:
+          Predicted = (UINT8) (((UINTN) Left + Above[Index]) / 2U);
+          break;
+        case 4:
+          Predicted = TestPaeth (Left, Above[Index], UpperLeft);
+          break;
+        default:
+          Predicted = 0;
+          break;
+      }
+
+      Raw[Position++] = (UINT8) (Row[Index] - Predicted);
+    }
+
+    CopyMem (Above, Row, RowSize);
+  }
+
+  FreePool (Above);
+  FreePool (Row);
+  return Position;
+}
+
+STATIC
+VOID
+TestWriteBe32 (
+  OUT UINT8   *Buffer,
+  IN  UINT32  Value
+  )
+{
+  Buffer[0] = (UINT8) (Value >> 24U);
+  Buffer[1] = (UINT8) (Value >> 16U);
+  Buffer[2] = (UINT8) (Value >> 8U);
+  Buffer[3] = (UINT8) Value;
+}
+
+//
+// Builds Image as a PNG with its scanlines stored uncompressed
+//
+STATIC
+UINT8 *
+TestBuildPng (
+  IN  CONST TEST_IMAGE  *Image,
+  OUT UINTN             *PngSize
+  )
+{
+  STATIC CONST UINT8  Signature[] = { 0x89, 0x50, 0x4E, 0x47, 0x0D, 0x0A, 0x1A, 0x0A };
+  UINT8               Header[13];
+  UINT8               *Raw;
+  UINT8               *Stream;
+  UINT8               *Png;
+  UINTN               RawSize;
+  UINTN               Position;
+  UINTN               Offset;
+  UINTN               Size;
+  UINTN               Pass;
+  UINT32              Adler1;
+  UINT32              Adler2;
+  size_t              PngBufferSize;
+  unsigned            Error;
+
+  //
+  // Every pass row is at most a full image row
+  //
+  Size   = 2U * Image->Height * (1U + (Image->Width * TestBitsPerPixel (Image) + 7U) / 8U) + 16U;
+  Raw    = AllocatePool (Size);
+  Stream = AllocatePool (2 + (Size / TEST_STORED_BLOCK_SIZE + 1) * 5 + Size + 4);
+  Png    = AllocatePool (sizeof (Signature));
+  if (Raw == NULL || Stream == NULL || Png == NULL) {
+    return NULL;
+  }
+
+  RawSize = 0;
+  for (Pass = 0; Pass < (Image->Interlaced ? ARRAY_SIZE (mPassStartX) : 1U); ++Pass) {
+    RawSize += TestFilterPass (Image, Pass, &Raw[RawSize]);
+  }
+
+  Stream[0] = 0x78;
+  Stream[1] = 0x01;
+  Position  = 2;
+
+  for (Offset = 0; Offset < RawSize; Offset += Size) {
+    Size = MIN (RawSize - Offset, TEST_STORED_BLOCK_SIZE);
+    Stream[Position++] = (UINT8) (Offset + Size == RawSize ? 1 : 0);
+    Stream[Position++] = (UINT8) Size;
+    Stream[Position++] = (UINT8) (Size >> 8U);
+    Stream[Position++] = (UINT8) ~Size;
+    Stream[Position++] = (UINT8) (~Size >> 8U);
+    CopyMem (&Stream[Position], &Raw[Offset], Size);
+    Position += Size;
+  }
+
+  Adler1 = 1;
+  Adler2 = 0;
+  for (Offset = 0; Offset < RawSize; ++Offset) {
+    Adler1 = (Adler1 + Raw[Offset]) % 65521U;
+    Adler2 = (Adler2 + Adler1) % 65521U;
+  }
+
+  TestWriteBe32 (&Stream[Position], (Adler2 << 16U) | Adler1);
+  Position += 4;
+
+  CopyMem (Png, Signature, sizeof (Signature));
+  PngBufferSize = sizeof (Signature);
+
+  TestWriteBe32 (&Header[0], Image->Width);
+  TestWriteBe32 (&Header[4], Image->Height);
+  Header[8]  = Image->BitDepth;
+  Header[9]  = Image->ColorType;
+  Header[10] = 0;
+  Header[11] = 0;
+  Header[12] = Image->Interlaced ? 1 : 0;
+
+  Error = lodepng_chunk_create (&Png, &PngBufferSize, sizeof (Header), "IHDR", Header);
+  if (!Error && Image->ColorType == TEST_COLOR_PALETTE) {
+    Error = lodepng_chunk_create (&Png, &PngBufferSize, sizeof (mPalette), "PLTE", mPalette);
+  }
+
+  if (!Error) {
+    Error = lodepng_chunk_create (&Png, &PngBufferSize, (unsigned) Position, "IDAT", Stream);
+  }
+
+  if (!Error) {
+    Error = lodepng_chunk_create (&Png, &PngBufferSize, 0, "IEND", NULL);
+  }
+
+  FreePool (Stream);
+  FreePool (Raw);
+
+  if (Error) {
+    FreePool (Png);
+    return NULL;
+  }
+
+  *PngSize = PngBufferSize;
+  return Png;
+}
+
+STATIC
+UINT32
+TestMaskComponent (
+  IN UINT8   Value,
+  IN UINT32  Mask
+  )
+{
+  UINT32  Shift;
+  UINT32  Bits;
+
+  if (Mask == 0) {
+    return 0;
+  }
+
+  for (Shift = 0; (Mask & (1U << Shift)) == 0; ++Shift) {
+  }
+
+  for (Bits = 0; Shift + Bits < 32 && (Mask & (1U << (Shift + Bits))) != 0; ++Bits) {
+  }
+
+  return (Bits <= 8 ? (UINT32) Value >> (8 - Bits) : (UINT32) Value << (Bits - 8)) << Shift;
+}
+
+//
+// The pixel Format expects for a pixel of the EFI_UGA_PIXEL output,
+// whose reserved byte holds inverted alpha
+//
+STATIC
+UINT32
+TestExpectedPixel (
+  IN CONST TEST_FORMAT    *Format,
+  IN CONST EFI_UGA_PIXEL  *Uga
+  )
+{
+  UINT8  Alpha;
+
+  Alpha = (UINT8) (0xFFU - Uga->Reserved);
+
+  switch (Format->PixelFormat) {
+    case PixelRedGreenBlueReserved8BitPerColor:
+      return Uga->Red | ((UINT32) Uga->Green << 8U) | ((UINT32) Uga->Blue << 16U) | ((UINT32) Alpha << 24U);
+
+    case PixelBitMask:
+      return TestMaskComponent (Uga->Red, Format->PixelInformation.RedMask)
+        | TestMaskComponent (Uga->Green, Format->PixelInformation.GreenMask)
+        | TestMaskComponent (Uga->Blue, Format->PixelInformation.BlueMask)
+        | TestMaskComponent (Alpha, Format->PixelInformation.ReservedMask);
+
+    default:
+      return Uga->Blue | ((UINT32) Uga->Green << 8U) | ((UINT32) Uga->Red << 16U) | ((UINT32) Alpha << 24U);
+  }
+}
+
+STATIC
+BOOLEAN
+TestFormat (
+  IN CONST TEST_IMAGE     *Image,
+  IN CONST TEST_FORMAT    *Format,
+  IN UINT8                *Png,
+  IN UINTN                PngSize,
+  IN CONST EFI_UGA_PIXEL  *Uga
+  )
+{
+  EFI_STATUS                            Status;
+  EFI_GRAPHICS_OUTPUT_MODE_INFORMATION  ModeInfo;
+  APPLE_IMAGE_CODEC_GOP_DECODE_INFO     DecodeInfo;
+  EFI_UGA_PIXEL                         *Pixels;
+  UINTN                                 PixelsSize;
+  UINT8                                 *Pixel;
+  UINT32                                Expected;
+  UINT32                                Actual;
+  UINTN                                 Index;
+  BOOLEAN                               Passed;
+
+  ZeroMem (&ModeInfo, sizeof (ModeInfo));
+  ModeInfo.HorizontalResolution = 1024;
+  ModeInfo.VerticalResolution   = 768;
+  ModeInfo.PixelsPerScanLine    = 1024;
+  ModeInfo.PixelFormat          = Format->PixelFormat;
+  CopyMem (&ModeInfo.PixelInformation, &Format->PixelInformation, sizeof (ModeInfo.PixelInformation));
+
+  DecodeInfo.ModeInfo    = &ModeInfo;
+  DecodeInfo.ImageWidth  = 0;
+  DecodeInfo.ImageHeight = 0;
+
+  Pixels = (EFI_UGA_PIXEL *) &DecodeInfo;
+  Status = mImageCodec->DecodeImageDataVer (Png, PngSize, APPLE_IMAGE_CODEC_DECODE_GOP_VERSION, &Pixels, &PixelsSize);
+  if (EFI_ERROR (Status)) {
+    HostPrint ("%s %s: decode failure - %llx\n", Image->Name, Format->Name, (unsigned long long) Status);
+    return FALSE;
+  }
+
+  if (DecodeInfo.ImageWidth != Image->Width || DecodeInfo.ImageHeight != Image->Height
+   || PixelsSize != (UINTN) Image->Width * Image->Height * sizeof (UINT32)) {
+    HostPrint (
+      "%s %s: %ux%u image of %llu bytes\n",
+      Image->Name,
+      Format->Name,
+      DecodeInfo.ImageWidth,
+      DecodeInfo.ImageHeight,
+      (unsigned long long) PixelsSize
+      );
+    FreePool (Pixels);
+    return FALSE;
+  }
+
+  Passed = TRUE;
+  Pixel  = (UINT8 *) Pixels;
+
+  for (Index = 0; Passed && Index < (UINTN) Image->Width * Image->Height; ++Index, Pixel += 4) {
+    Expected = TestExpectedPixel (Format, &Uga[Index]);
+    Actual   = Pixel[0] | ((UINT32) Pixel[1] << 8U) | ((UINT32) Pixel[2] << 16U) | ((UINT32) Pixel[3] << 24U);
+    if (Actual != Expected) {
+      HostPrint (
+        "%s %s: pixel %llu is %08x instead of %08x\n",
+        Image->Name,
+        Format->Name,
+        (unsigned long long) Index,
+        Actual,
+        Expected
+        );
+      Passed = FALSE;
+    }
+  }
+
+  FreePool (Pixels);
+  return Passed;
+}
+
+int
+main (
+  int   argc,
+  char  *argv[]
+  )
+{
+  EFI_STATUS     Status;
+  UINT8          *Png;
+  UINTN          PngSize;
+  EFI_UGA_PIXEL  *Uga;
+  UINTN          UgaSize;
+  UINTN          Image;
+  UINTN          Format;
+  BOOLEAN        Passed;
+
+  InitializeAppleImageCodec (gImageHandle, gST);
+
+  if (EFI_ERROR (gBS->LocateProtocol (&gAppleImageCodecProtocolGuid, NULL, (VOID **) &mImageCodec))) {
+    HostPrint ("AppleImageCodec failed to install\n");
+    return 1;
+  }
+
+  Passed = TRUE;
+
+  for (Image = 0; Passed && Image < ARRAY_SIZE (mImages); ++Image) {
+    Png = TestBuildPng (&mImages[Image], &PngSize);
+    if (Png == NULL) {
+      HostPrint ("%s: PNG build failure\n", mImages[Image].Name);
+      return 1;
+    }
+
+    Status = mImageCodec->DecodeImageDataVer (Png, PngSize, 1, &Uga, &UgaSize);
+    if (EFI_ERROR (Status) || UgaSize != (UINTN) mImages[Image].Width * mImages[Image].Height * sizeof (*Uga)) {
+      HostPrint ("%s: EFI_UGA_PIXEL decode failure - %llx\n", mImages[Image].Name, (unsigned long long) Status);
+      FreePool (Png);
+      return 1;
+    }
+
+    for (Format = 0; Passed && Format < ARRAY_SIZE (mFormats); ++Format) {
+      Passed = TestFormat (&mImages[Image], &mFormats[Format], Png, PngSize, Uga);
+    }
+
+    FreePool (Uga);
+    FreePool (Png);
+  }
+
+  if (!Passed) {
+    return 1;
+  }
+
+  HostPrint ("GopDecodeTest: %llu images passed\n", (unsigned long long) ARRAY_SIZE (mImages));
+  return 0;
+}
@@ -0,0 +1,453 @@
+/** @file
+
+lodepng IDAT span inflate host test.
+Decodes the same image data split into IDAT chunks in many ways and checks
+the result against the known pixels and the contiguous inflate path.
+
+Copyright (c) 2018, savvas
+
+All rights reserved.
+
+This program and the accompanying materials
+are licensed and made available under the terms and conditions of the BSD License
+which accompanies this distribution.  The full text of the license may be found at
+http://opensource.org/licenses/bsd-license.php
+
+THE PROGRAM IS DISTRIBUTED UNDER THE BSD LICENSE ON AN "AS IS" BASIS,
+WITHOUT WARRANTIES OR REPRESENTATIONS OF ANY KIND, EITHER EXPRESS OR IMPLIED.
+
+**/
+
+#include <Library/BaseMemoryLib.h>
+#include <Library/MemoryAllocationLib.h>
+#include <Library/UefiBootServicesTableLib.h>
+#include "../lodepng.h"
+#include "HostLib.h"
+
+//
+// 16x12 8-bit RGBA image without filtering, see TestPixel
+//
+#define TEST_WIDTH          16
+#define TEST_HEIGHT         12
+#define TEST_PIXEL_SIZE     4
+#define TEST_SCANLINE_SIZE  (1 + TEST_WIDTH * TEST_PIXEL_SIZE)
+#define TEST_RAW_SIZE       (TEST_HEIGHT * TEST_SCANLINE_SIZE)
+
+//
+// Odd stored block size, so that block headers straddle chunk boundaries
+//
+#define TEST_STORED_BLOCK_SIZE  97
+#define TEST_STORED_SIZE        (2 + ((TEST_RAW_SIZE + TEST_STORED_BLOCK_SIZE - 1) / TEST_STORED_BLOCK_SIZE) * 5 + TEST_RAW_SIZE + 4)
+
+#define TEST_RANDOM_SPLITS  200
+
+//
+// Scanlines of TestPixel compressed by zlib with dynamic and fixed Huffman codes
+//
+STATIC CONST UINT8 mDynamicStream[] = {
+  0x78, 0xDA, 0xED, 0xD0, 0x31, 0x11, 0xC0, 0x30, 0x10, 0x03, 0x41, 0x41,
+  0x13, 0x04, 0x43, 0x7A, 0x28, 0x86, 0x22, 0x48, 0x61, 0xE0, 0x5C, 0xE1,
+  0xCC, 0x08, 0x44, 0x9A, 0xDB, 0x4A, 0x8D, 0x24, 0xE5, 0x48, 0x3E, 0x9F,
+  0x46, 0x97, 0x83, 0x53, 0x06, 0x53, 0x4A, 0x8B, 0x2C, 0xC6, 0x57, 0xA3,
+  0xCB, 0xC1, 0x29, 0x83, 0x29, 0xA5, 0x4D, 0x36, 0xE3, 0xAB, 0xD1, 0xE5,
+  0xE0, 0x94, 0xC1, 0x94, 0xD2, 0x43, 0x1E, 0xC6, 0x57, 0xA3, 0xCB, 0xC1,
+  0x29, 0x83, 0x29, 0xF5, 0x7F, 0xF0, 0x7F, 0x80, 0x2F, 0x10, 0x67, 0xC1,
+  0x50
+};
+
+STATIC CONST UINT8 mFixedStream[] = {
+  0x78, 0x01, 0x63, 0x60, 0x60, 0x38, 0xF0, 0x9F, 0x81, 0xC1, 0xE1, 0x3F,
+  0x8C, 0x76, 0x00, 0xD2, 0x0E, 0x48, 0x74, 0x03, 0x90, 0x6E, 0x40, 0xA2,
+  0x0F, 0x00, 0xE9, 0x03, 0x48, 0x34, 0x03, 0x43, 0x00, 0x90, 0x08, 0x00,
+  0x6A, 0x86, 0xD2, 0x0E, 0x40, 0xDA, 0x01, 0x89, 0x6E, 0x00, 0xD2, 0x0D,
+  0x48, 0xF4, 0x01, 0x20, 0x7D, 0x00, 0x89, 0x66, 0x60, 0x58, 0x00, 0x24,
+  0x16, 0x00, 0x35, 0x43, 0x69, 0x07, 0x20, 0xED, 0x80, 0x44, 0x37, 0x00,
+  0xE9, 0x06, 0x24, 0xFA, 0x00, 0x90, 0x3E, 0x80, 0x44, 0x33, 0x30, 0x7C,
+  0x00, 0x12, 0x1F, 0x80, 0x9A, 0xA1, 0xB4, 0x03, 0x90, 0x76, 0x40, 0xA2,
+  0x1B, 0x80, 0x74, 0x03, 0x12, 0x7D, 0x00, 0x48, 0x1F, 0x40, 0xA2, 0x19,
+  0x46, 0xC3, 0x60, 0x34, 0x0C, 0x80, 0x34, 0x00, 0x10, 0x67, 0xC1, 0x50
+};
+
+//
+// Fixed IDAT chunk sizes, 0 puts the whole stream into one chunk
+//
+STATIC CONST UINTN mTestChunkSizes[] = { 0, 1, 2, 3, 5, 8, 13, 64 };
+
+STATIC UINT8   mStoredStream[TEST_STORED_SIZE];
+STATIC UINT8   mExpected[TEST_WIDTH * TEST_HEIGHT * TEST_PIXEL_SIZE];
+STATIC UINT32  mSeed = 1;
+
+STATIC
+UINT32
+TestRandom (
+  VOID
+  )
+{
+  mSeed = mSeed * 1103515245U + 12345U;
+  return mSeed >> 16U;
+}
+
+STATIC
+UINT8
+TestPixel (
+  IN UINTN  X,
+  IN UINTN  Y,
+  IN UINTN  Channel
+  )
+{
+  switch (Channel) {
+    case 0:
+      return (UINT8) ((X / 4) * 64);
+    case 1:
+      return (UINT8) ((Y % 4) * 80);
+    case 2:
+      return (UINT8) (((X + Y) % 2) != 0 ? 0x40 : 0xC0);
+    default:
+      return 0xFF;
+  }
+}
+
+STATIC
+VOID
+TestWriteBe32 (
+  OUT UINT8   *Buffer,
+  IN  UINT32  Value
+  )
+{
+  Buffer[0] = (UINT8) (Value >> 24U);
+  Buffer[1] = (UINT8) (Value >> 16U);
+  Buffer[2] = (UINT8) (Value >> 8U);
+  Buffer[3] = (UINT8) Value;
+}
+
+//
+// Builds the expected pixels and a zlib stream of stored blocks holding them
+//
+STATIC
+VOID
+TestBuildImage (
+  VOID
+  )
+{
+  UINT8   Raw[TEST_RAW_SIZE];
+  UINTN   X;
+  UINTN   Y;
+  UINTN   Channel;
+  UINTN   Offset;
+  UINTN   Size;
+  UINTN   Position;
+  UINT32  Adler1;
+  UINT32  Adler2;
+
+  for (Y = 0; Y < TEST_HEIGHT; ++Y) {
+    Raw[Y * TEST_SCANLINE_SIZE] = 0;
+    for (X = 0; X < TEST_WIDTH; ++X) {
+      for (Channel = 0; Channel < TEST_PIXEL_SIZE; ++Channel) {
+        mExpected[(Y * TEST_WIDTH + X) * TEST_PIXEL_SIZE + Channel] = TestPixel (X, Y, Channel);
+        Raw[Y * TEST_SCANLINE_SIZE + 1 + X * TEST_PIXEL_SIZE + Channel] = TestPixel (X, Y, Channel);
+      }
+    }
+  }
+
+  mStoredStream[0] = 0x78;
+  mStoredStream[1] = 0x01;
+  Position = 2;
+
+  for (Offset = 0; Offset < TEST_RAW_SIZE; Offset += Size) {
+    Size = MIN (TEST_RAW_SIZE - Offset, TEST_STORED_BLOCK_SIZE);
+    mStoredStream[Position++] = (UINT8) (Offset + Size == TEST_RAW_SIZE ? 1 : 0);
+    mStoredStream[Position++] = (UINT8) Size;
+    mStoredStream[Position++] = (UINT8) (Size >> 8U);
+    mStoredStream[Position++] = (UINT8) ~Size;
+    mStoredStream[Position++] = (UINT8) (~Size >> 8U);
+    CopyMem (&mStoredStream[Position], &Raw[Offset], Size);
+    Position += Size;
+  }
+
+  Adler1 = 1;
+  Adler2 = 0;
+  for (Offset = 0; Offset < TEST_RAW_SIZE; ++Offset) {
+    Adler1 = (Adler1 + Raw[Offset]) % 65521U;
+    Adler2 = (Adler2 + Adler1) % 65521U;
+  }
+
+  TestWriteBe32 (&mStoredStream[Position], (Adler2 << 16U) | Adler1);
+}
+
+//
+// Returns the size of the next IDAT chunk, random splits may be empty
+//
+STATIC
+UINTN
+TestNextChunkSize (
+  IN UINTN  ChunkSize,
+  IN UINTN  Remaining
+  )
+{
+  if (ChunkSize == 0) {
+    return Remaining;
+  }
+
+  if (ChunkSize == MAX_UINTN) {
+    ChunkSize = TestRandom () % 24;
+  }
+
+  return MIN (ChunkSize, Remaining);
+}
+
+//
+// Builds a PNG holding Stream in IDAT chunks of ChunkSize bytes,
+// MAX_UINTN picks a random size for every chunk
+//
+STATIC
+UINT8 *
+TestBuildPng (
+  IN  CONST UINT8  *Stream,
+  IN  UINTN        StreamSize,
+  IN  UINTN        ChunkSize,
+  OUT UINTN        *PngSize
+  )
+{
+  STATIC CONST UINT8  Signature[] = { 0x89, 0x50, 0x4E, 0x47, 0x0D, 0x0A, 0x1A, 0x0A };
+  UINT8               Header[13];
+  UINT8               *Png;
+  size_t              Size;
+  UINTN               Offset;
+  UINTN               Length;
+  unsigned            Error;
+
+  Png = AllocatePool (sizeof (Signature));
+  if (Png == NULL) {
+    return NULL;
+  }
+
+  CopyMem (Png, Signature, sizeof (Signature));
+  Size = sizeof (Signature);
+
+  TestWriteBe32 (&Header[0], TEST_WIDTH);
+  TestWriteBe32 (&Header[4], TEST_HEIGHT);
+  Header[8]  = 8;
+  Header[9]  = LCT_RGBA;
+  Header[10] = 0;
+  Header[11] = 0;
+  Header[12] = 0;
+
+  Error = lodepng_chunk_create (&Png, &Size, sizeof (Header), "IHDR", Header);
+
+  Offset = 0;
+  do {
+    Length = TestNextChunkSize (ChunkSize, StreamSize - Offset);
+    if (!Error) {
+      Error = lodepng_chunk_create (&Png, &Size, (unsigned) Length, "IDAT", Stream + Offset);
+    }
+    Offset += Length;
+  } while (Offset < StreamSize);
+
+  //
+  // The inflator must stop at the last IDAT chunk
+  //
+  if (!Error) {
+    Error = lodepng_chunk_create (&Png, &Size, 4, "teSt", (CONST UINT8 *) "IDAT");
+  }
+
+  if (!Error) {
+    Error = lodepng_chunk_create (&Png, &Size, 0, "IEND", NULL);
+  }
+
+  if (Error) {
+    FreePool (Png);
+    return NULL;
+  }
+
+  *PngSize = Size;
+  return Png;
+}
+
+//
+// Inflates the concatenated IDAT data like before span inflate
+//
+STATIC
+unsigned
+TestContiguousZlib (
+  unsigned char                    **Out,
+  size_t                           *OutSize,
+  const unsigned char              *In,
+  size_t                           InSize,
+  const LodePNGDecompressSettings  *Settings
+  )
+{
+  LodePNGDecompressSettings  Contiguous;
+
+  lodepng_decompress_settings_init (&Contiguous);
+  return lodepng_zlib_decompress (Out, OutSize, In, InSize, &Contiguous);
+}
+
+STATIC
+unsigned
+TestDecode (
+  IN  CONST UINT8  *Png,
+  IN  UINTN        PngSize,
+  IN  BOOLEAN      Contiguous,
+  OUT UINT8        **Image
+  )
+{
+  LodePNGState  State;
+  unsigned      Width;
+  unsigned      Height;
+  unsigned      Error;
+
+  *Image = NULL;
+
+  lodepng_state_init (&State);
+  if (Contiguous) {
+    State.decoder.zlibsettings.custom_zlib = TestContiguousZlib;
+  }
+
+  Error = lodepng_decode (Image, &Width, &Height, &State, Png, PngSize);
+  lodepng_state_cleanup (&State);
+
+  if (!Error && (Width != TEST_WIDTH || Height != TEST_HEIGHT)) {
+    Error = 1;
+  }
+
+  if (Error && *Image != NULL) {
+    FreePool (*Image);
+    *Image = NULL;
+  }
+
+  return Error;
+}
+
+STATIC
+BOOLEAN
+TestStream (
+  IN CONST CHAR8  *Name,
+  IN CONST UINT8  *Stream,
+  IN UINTN        StreamSize,
+  IN UINTN        ChunkSize
+  )
+{
+  UINT8     *Png;
+  UINTN     PngSize;
+  UINT8     *Image;
+  UINT8     *ContiguousImage;
+  unsigned  Error;
+  BOOLEAN   Passed;
+
+  Png = TestBuildPng (Stream, StreamSize, ChunkSize, &PngSize);
+  if (Png == NULL) {
+    HostPrint ("%s: PNG build failure\n", Name);
+    return FALSE;
+  }
+
+  Error = TestDecode (Png, PngSize, FALSE, &Image);
+  if (Error) {
+    HostPrint ("%s, chunk size %lld: decode error %u\n", Name, (long long) ChunkSize, Error);
+    FreePool (Png);
+    return FALSE;
+  }
+
+  Passed = (BOOLEAN) (CompareMem (Image, mExpected, sizeof (mExpected)) == 0);
+  if (!Passed) {
+    HostPrint ("%s, chunk size %lld: wrong pixels\n", Name, (long long) ChunkSize);
+  }
+
+  if (Passed) {
+    Error = TestDecode (Png, PngSize, TRUE, &ContiguousImage);
+    Passed = (BOOLEAN) (!Error && CompareMem (ContiguousImage, Image, sizeof (mExpected)) == 0);
+    if (!Passed) {
+      HostPrint ("%s, chunk size %lld: contiguous decode differs\n", Name, (long long) ChunkSize);
+    }
+
+    if (ContiguousImage != NULL) {
+      FreePool (ContiguousImage);
+    }
+  }
+
+  FreePool (Image);
+  FreePool (Png);
+
+  return Passed;
+}
+
+//
+// Truncated data must fail in every split instead of reading past the last chunk
+//
+STATIC
+BOOLEAN
+TestTruncated (
+  IN CONST CHAR8  *Name,
+  IN CONST UINT8  *Stream,
+  IN UINTN        StreamSize
+  )
+{
+  UINT8     *Png;
+  UINTN     PngSize;
+  UINT8     *Image;
+  UINTN     Index;
+  UINTN     Cut;
+
+  for (Cut = 1; Cut < StreamSize; Cut += 7) {
+    for (Index = 0; Index < ARRAY_SIZE (mTestChunkSizes); ++Index) {
+      Png = TestBuildPng (Stream, StreamSize - Cut, mTestChunkSizes[Index], &PngSize);
+      if (Png == NULL) {
+        HostPrint ("%s: PNG build failure\n", Name);
+        return FALSE;
+      }
+
+      if (TestDecode (Png, PngSize, FALSE, &Image) == 0) {
+        HostPrint ("%s, %llu bytes cut: truncated data decoded\n", Name, (unsigned long long) Cut);
+        FreePool (Image);
+        FreePool (Png);
+        return FALSE;
+      }
+
+      FreePool (Png);
+    }
+  }
+
+  return TRUE;
+}
+
+int
+main (
+  int   argc,
+  char  *argv[]
+  )
+{
+  STATIC CONST struct {
+    CONST CHAR8  *Name;
+    CONST UINT8  *Data;
+    UINTN        Size;
+  } Streams[] = {
+    { "Stored",  mStoredStream,  sizeof (mStoredStream)  },
+    { "Fixed",   mFixedStream,   sizeof (mFixedStream)   },
+    { "Dynamic", mDynamicStream, sizeof (mDynamicStream) }
+  };
+
+  UINTN  Stream;
+  UINTN  Index;
+
+  TestBuildImage ();
+
+  for (Stream = 0; Stream < ARRAY_SIZE (Streams); ++Stream) {
+    for (Index = 0; Index < ARRAY_SIZE (mTestChunkSizes); ++Index) {
+      if (!TestStream (Streams[Stream].Name, Streams[Stream].Data, Streams[Stream].Size, mTestChunkSizes[Index])) {
+        return 1;
+      }
+    }
+
+    for (Index = 0; Index < TEST_RANDOM_SPLITS; ++Index) {
+      if (!TestStream (Streams[Stream].Name, Streams[Stream].Data, Streams[Stream].Size, MAX_UINTN)) {
+        return 1;
+      }
+    }
+
+    if (!TestTruncated (Streams[Stream].Name, Streams[Stream].Data, Streams[Stream].Size)) {
+      return 1;
+    }
+  }
+
+  HostPrint ("InflateSpanTest: %u streams passed\n", (unsigned) ARRAY_SIZE (Streams));
+  return 0;
+}
@@ -54,7 +54,8 @@ static void lodepng_free(void* ptr)
       gBS->FreePool(ptr);
 }
 
-static void* lodepng_realloc(void* ptr, size_t new_size)
+// Pool allocations do not know their size, so the caller passes the old one
+static void* lodepng_realloc(void* ptr, size_t old_size, size_t new_size)
 {
     void* new_ptr;
     if (!ptr) {
@@ -66,7 +67,7 @@ static void* lodepng_realloc(void* ptr, size_t new_size)
     } else {
         new_ptr = lodepng_malloc(new_size);
         if (new_ptr != NULL) {
-            gBS->CopyMem(new_ptr, ptr, new_size);
+            gBS->CopyMem(new_ptr, ptr, old_size < new_size ? old_size : new_size);
             lodepng_free (ptr);
             return new_ptr;
         }
@@ -135,8 +136,9 @@ static void* lodepng_malloc(size_t size)
   return malloc(size);
 }
 
-static void* lodepng_realloc(void* ptr, size_t new_size)
+static void* lodepng_realloc(void* ptr, size_t old_size, size_t new_size)
 {
+  (void)old_size;
 #ifdef LODEPNG_MAX_ALLOC
   if(new_size > LODEPNG_MAX_ALLOC) return 0;
 #endif
@@ -149,7 +151,7 @@ static void lodepng_free(void* ptr)
 }
 #else /*LODEPNG_COMPILE_ALLOCATORS*/
 void* lodepng_malloc(size_t size);
-void* lodepng_realloc(void* ptr, size_t new_size);
+void* lodepng_realloc(void* ptr, size_t old_size, size_t new_size);
 void lodepng_free(void* ptr);
 #endif /*LODEPNG_COMPILE_ALLOCATORS*/
 
@@ -207,8 +209,8 @@ About uivector, ucvector and string:
 -As with many other structs in this file, the init and cleanup functions serve as ctor and dtor.
 */
 
-#ifdef LODEPNG_COMPILE_ZLIB
-/*dynamic vector of unsigned ints*/
+#if defined(LODEPNG_COMPILE_ZLIB) && defined(LODEPNG_COMPILE_ENCODER)
+/*dynamic vector of unsigned ints, only the encoder needs it*/
 typedef struct uivector
 {
   unsigned* data;
@@ -229,7 +231,7 @@ static unsigned uivector_reserve(uivector* p, size_t allocsize)
   if(allocsize > p->allocsize)
   {
     size_t newsize = (allocsize > p->allocsize * 2) ? allocsize : (allocsize * 3 / 2);
-    void* data = lodepng_realloc(p->data, newsize);
+    void* data = lodepng_realloc(p->data, p->allocsize, newsize);
     if(data)
     {
       p->allocsize = newsize;
@@ -263,7 +265,6 @@ static void uivector_init(uivector* p)
   p->size = p->allocsize = 0;
 }
 
-#ifdef LODEPNG_COMPILE_ENCODER
 /*returns 1 if success, 0 if failure ==> nothing done*/
 static unsigned uivector_push_back(uivector* p, unsigned c)
 {
@@ -271,8 +272,7 @@ static unsigned uivector_push_back(uivector* p, unsigned c)
   p->data[p->size - 1] = c;
   return 1;
 }
-#endif /*LODEPNG_COMPILE_ENCODER*/
-#endif /*LODEPNG_COMPILE_ZLIB*/
+#endif /*defined(LODEPNG_COMPILE_ZLIB) && defined(LODEPNG_COMPILE_ENCODER)*/
 
 /* /////////////////////////////////////////////////////////////////////////// */
 
@@ -282,6 +282,7 @@ typedef struct ucvector
   unsigned char* data;
   size_t size; /*used size*/
   size_t allocsize; /*allocated size*/
+  unsigned external; /*data is owned by someone else, it is never reallocated or freed*/
 } ucvector;
 
 /*returns 1 if success, 0 if failure ==> nothing done*/
@@ -290,7 +291,9 @@ static unsigned ucvector_reserve(ucvector* p, size_t allocsize)
   if(allocsize > p->allocsize)
   {
     size_t newsize = (allocsize > p->allocsize * 2) ? allocsize : (allocsize * 3 / 2);
-    void* data = lodepng_realloc(p->data, newsize);
+    void* data;
+    if(p->external) return 0; /*error: an external buffer cannot grow*/
+    data = lodepng_realloc(p->data, p->allocsize, newsize);
     if(data)
     {
       p->allocsize = newsize;
@@ -314,7 +317,7 @@ static unsigned ucvector_resize(ucvector* p, size_t size)
 static void ucvector_cleanup(void* p)
 {
   ((ucvector*)p)->size = ((ucvector*)p)->allocsize = 0;
-  lodepng_free(((ucvector*)p)->data);
+  if(!((ucvector*)p)->external) lodepng_free(((ucvector*)p)->data);
   ((ucvector*)p)->data = NULL;
 }
 
@@ -322,7 +325,19 @@ static void ucvector_init(ucvector* p)
 {
   p->data = NULL;
   p->size = p->allocsize = 0;
+  p->external = 0;
 }
+
+#ifdef LODEPNG_COMPILE_DECODER
+/*uses the allocsize bytes of buffer, which stays owned by the caller, as empty vector*/
+static void ucvector_init_external(ucvector* p, unsigned char* buffer, size_t allocsize)
+{
+  p->data = buffer;
+  p->size = 0;
+  p->allocsize = allocsize;
+  p->external = 1;
+}
+#endif /*LODEPNG_COMPILE_DECODER*/
 #endif /*LODEPNG_COMPILE_PNG*/
 
 #ifdef LODEPNG_COMPILE_ZLIB
@@ -332,6 +347,7 @@ static void ucvector_init_buffer(ucvector* p, unsigned char* buffer, size_t size
 {
   p->data = buffer;
   p->allocsize = p->size = size;
+  p->external = 0;
 }
 #endif /*LODEPNG_COMPILE_ZLIB*/
 
@@ -504,23 +520,180 @@ static void addBitsToStreamReversed(size_t* bitpointer, ucvector* bitstream, uns
 
 #ifdef LODEPNG_COMPILE_DECODER
 
-#define READBIT(bitpointer, bitstream) ((bitstream[bitpointer >> 3] >> (bitpointer & 0x7)) & (unsigned char)1)
+/*
+Compressed input of the inflator. The zlib stream is read in place as a chain of spans:
+either one contiguous buffer, or the payloads of consecutive IDAT chunks of the PNG file,
+so the chunks never have to be concatenated first. Byte positions are absolute in the
+whole stream, the span holding the current position is cached, so the sequential reads
+of the inflator only look up the next span when they cross a chunk boundary.
+Bits are read through a bit buffer refilled a byte at a time, so the span is only
+checked once per byte and not for every bit.
+*/
+typedef struct InflateInput
+{
+  const unsigned char* data; /*current span*/
+  size_t size; /*size of the current span*/
+  size_t base; /*position of the first byte of the current span in the stream*/
+  const unsigned char* chunk; /*IDAT chunk of the current span, 0 for a contiguous buffer*/
+  const unsigned char* end; /*end of the PNG buffer holding the chunks*/
+  const unsigned char* firstdata; /*first span, used to rewind*/
+  size_t firstsize;
+  const unsigned char* firstchunk;
+  size_t bits; /*bit buffer, its lowest bit is the stream bit at bitpos*/
+  size_t bitpos; /*stream bit position of the bit buffer*/
+  unsigned bitcount; /*number of bits in the bit buffer, they always end at a byte boundary*/
+} InflateInput;
+
+static void InflateInput_init(InflateInput* input, const unsigned char* data, size_t size)
+{
+  input->data = input->firstdata = data;
+  input->size = input->firstsize = size;
+  input->base = 0;
+  input->chunk = input->firstchunk = 0;
+  input->end = 0;
+  input->bits = 0;
+  input->bitpos = 0;
+  input->bitcount = 0;
+}
 
-static unsigned char readBitFromStream(size_t* bitpointer, const unsigned char* bitstream)
+#ifdef LODEPNG_COMPILE_PNG
+/*chunk is the first IDAT chunk, the chunks up to IEND must have been validated against end*/
+static void InflateInput_initIdat(InflateInput* input, const unsigned char* chunk, const unsigned char* end)
 {
-  unsigned char result = (unsigned char)(READBIT(*bitpointer, bitstream));
-  ++(*bitpointer);
-  return result;
+  InflateInput_init(input, lodepng_chunk_data_const(chunk), lodepng_chunk_length(chunk));
+  input->chunk = input->firstchunk = chunk;
+  input->end = end;
+}
+
+/*moves to the payload of the next IDAT chunk, returns 0 if there is none*/
+static unsigned InflateInput_nextSpan(InflateInput* input)
+{
+  const unsigned char* chunk = input->chunk;
+  unsigned length;
+
+  if(!chunk) return 0;
+  for(;;)
+  {
+    chunk = lodepng_chunk_next_const(chunk);
+    if(chunk < input->chunk || (size_t)(input->end - chunk) < 12) return 0;
+    length = lodepng_chunk_length(chunk);
+    if(length > (size_t)(input->end - chunk) - 12) return 0;
+    if(lodepng_chunk_type_equals(chunk, "IEND")) return 0;
+    if(lodepng_chunk_type_equals(chunk, "IDAT")) break;
+  }
+
+  input->base += input->size;
+  input->data = lodepng_chunk_data_const(chunk);
+  input->size = length;
+  input->chunk = chunk;
+  return 1;
+}
+#else /*LODEPNG_COMPILE_PNG*/
+static unsigned InflateInput_nextSpan(InflateInput* input)
+{
+  (void)input;
+  return 0;
+}
+#endif /*LODEPNG_COMPILE_PNG*/
+
+/*selects the span containing byte pos, returns 0 if pos is past the end of the stream*/
+static unsigned InflateInput_seek(InflateInput* input, size_t pos)
+{
+  if(pos < input->base)
+  {
+    input->data = input->firstdata;
+    input->size = input->firstsize;
+    input->base = 0;
+    input->chunk = input->firstchunk;
+  }
+  while(pos - input->base >= input->size)
+  {
+    if(!InflateInput_nextSpan(input)) return 0;
+  }
+  return 1;
+}
+
+static unsigned char InflateInput_byteSlow(InflateInput* input, size_t pos)
+{
+  if(!InflateInput_seek(input, pos)) return 0;
+  return input->data[pos - input->base];
+}
+
+/*copies size bytes starting at byte pos, span by span, returns 0 if the stream is too short*/
+static unsigned InflateInput_copy(unsigned char* out, InflateInput* input, size_t pos, size_t size)
+{
+  while(size > 0)
+  {
+    size_t avail;
+    if(!InflateInput_seek(input, pos)) return 0;
+    avail = input->size - (pos - input->base);
+    if(avail > size) avail = size;
+    memcpy(out, (void*)(input->data + (pos - input->base)), avail);
+    out += avail;
+    pos += avail;
+    size -= avail;
+  }
+  return 1;
 }
 
-static unsigned readBitsFromStream(size_t* bitpointer, const unsigned char* bitstream, size_t nbits)
+/*byte pos of the stream, the common case of pos inside the current span is resolved inline*/
+#define INFLATEBYTE(input, pos) ((size_t)((pos) - (input)->base) < (input)->size ? \
+                                 (input)->data[(pos) - (input)->base] : InflateInput_byteSlow(input, pos))
+
+/*maximum bits peekBitsFromStream can return, with up to 7 bits skipped they fit a 32-bit bit buffer*/
+#define MAX_PEEK_BITS 15
+
+/*largest bit count of the bit buffer that still leaves room for another byte*/
+#define BIT_BUFFER_REFILL (sizeof(size_t) * 8 - 8)
+
+/*fills the bit buffer a byte at a time while a whole byte still fits in it*/
+static void refillBitBuffer(InflateInput* input)
 {
-  unsigned result = 0, i;
-  for(i = 0; i != nbits; ++i)
+  while(input->bitcount <= BIT_BUFFER_REFILL)
   {
-    result += ((unsigned)READBIT(*bitpointer, bitstream)) << i;
-    ++(*bitpointer);
+    input->bits |= (size_t)INFLATEBYTE(input, (input->bitpos + input->bitcount) >> 3) << input->bitcount;
+    input->bitcount += 8;
   }
+}
+
+/*returns the stream bits starting at bitpointer in the lowest bits of the result, at least nbits of them
+are valid, nbits is at most MAX_PEEK_BITS. Bits past the end of the stream read as 0.*/
+static size_t peekBitsFromStream(size_t bitpointer, InflateInput* input, unsigned nbits)
+{
+  size_t skip = bitpointer - input->bitpos;
+  if(bitpointer < input->bitpos || skip >= input->bitcount)
+  {
+    /*the bits are not buffered, which only happens after stored blocks: restart at the byte holding them*/
+    input->bits = 0;
+    input->bitcount = 0;
+    input->bitpos = bitpointer & ~(size_t)7;
+    refillBitBuffer(input);
+    skip = bitpointer & 7;
+  }
+  else if(skip + nbits <= input->bitcount)
+  {
+    return input->bits >> skip; /*common case, all the bits are buffered*/
+  }
+  /*drop the bits before bitpointer, then top the buffer up again*/
+  input->bits >>= skip;
+  input->bitcount -= (unsigned)skip;
+  input->bitpos = bitpointer;
+  refillBitBuffer(input);
+  return input->bits;
+}
+
+static unsigned char readBitFromStream(size_t* bitpointer, InflateInput* input)
+{
+  unsigned char result = (unsigned char)(peekBitsFromStream(*bitpointer, input, 1) & 1u);
+  ++(*bitpointer);
+  return result;
+}
+
+/*nbits is at most MAX_PEEK_BITS*/
+static unsigned readBitsFromStream(size_t* bitpointer, InflateInput* input, size_t nbits)
+{
+  unsigned result = (unsigned)(peekBitsFromStream(*bitpointer, input, (unsigned)nbits) & ((1u << nbits) - 1u));
+  (*bitpointer) += nbits;
   return result;
 }
 #endif /*LODEPNG_COMPILE_DECODER*/
@@ -575,8 +748,12 @@ typedef struct HuffmanTree
   unsigned* lengths; /*the lengths of the codes of the 1d-tree*/
   unsigned maxbitlen; /*maximum number of bits a single code can get*/
   unsigned numcodes; /*number of symbols in the alphabet = number of codes*/
+  unsigned external; /*the arrays are storage of the caller, they are neither allocated nor freed*/
 } HuffmanTree;
 
+/*number of unsigned values HuffmanTree_initStorage needs for a tree of numcodes codes*/
+#define HUFFMAN_STORAGE_SIZE(numcodes) ((numcodes) * 4)
+
 /*function used for debug purposes to draw the tree in ascii art with C++*/
 /*
 static void HuffmanTree_draw(HuffmanTree* tree)
@@ -590,19 +767,34 @@ static void HuffmanTree_draw(HuffmanTree* tree)
   std::cout << std::endl;
 }*/
 
+#ifdef LODEPNG_COMPILE_ENCODER
 static void HuffmanTree_init(HuffmanTree* tree)
 {
   tree->tree2d = 0;
   tree->tree1d = 0;
   tree->lengths = 0;
+  tree->external = 0;
 }
 
 static void HuffmanTree_cleanup(HuffmanTree* tree)
 {
+  if(tree->external) return;
   lodepng_free(tree->tree2d);
   lodepng_free(tree->tree1d);
   lodepng_free(tree->lengths);
 }
+#endif /*LODEPNG_COMPILE_ENCODER*/
+
+#ifdef LODEPNG_COMPILE_DECODER
+/*makes the tree use storage of HUFFMAN_STORAGE_SIZE(numcodes) values for its arrays instead of allocating them*/
+static void HuffmanTree_initStorage(HuffmanTree* tree, unsigned* storage, unsigned numcodes)
+{
+  tree->tree2d = storage;
+  tree->tree1d = storage + numcodes * 2;
+  tree->lengths = storage + numcodes * 3;
+  tree->external = 1;
+}
+#endif /*LODEPNG_COMPILE_DECODER*/
 
 /*the tree representation used by the decoder. return value is error*/
 static unsigned HuffmanTree_make2DTree(HuffmanTree* tree)
@@ -611,8 +803,11 @@ static unsigned HuffmanTree_make2DTree(HuffmanTree* tree)
   unsigned treepos = 0; /*position in the tree (1 of the numcodes columns)*/
   unsigned n, i;
 
-  tree->tree2d = (unsigned*)lodepng_malloc(tree->numcodes * 2 * sizeof(unsigned));
-  if(!tree->tree2d) return 83; /*alloc fail*/
+  if(!tree->external)
+  {
+    tree->tree2d = (unsigned*)lodepng_malloc(tree->numcodes * 2 * sizeof(unsigned));
+    if(!tree->tree2d) return 83; /*alloc fail*/
+  }
 
   /*
   convert tree1d[] to tree2d[][]. In the 2D array, a value of 32767 means
@@ -672,42 +867,38 @@ value is error.
 */
 static unsigned HuffmanTree_makeFromLengths2(HuffmanTree* tree)
 {
-  uivector blcount;
-  uivector nextcode;
-  unsigned error = 0;
+  /*deflate code lengths are at most 15 bits*/
+  unsigned blcount[16];
+  unsigned nextcode[16];
   unsigned bits, n;
 
-  uivector_init(&blcount);
-  uivector_init(&nextcode);
-
-  tree->tree1d = (unsigned*)lodepng_malloc(tree->numcodes * sizeof(unsigned));
-  if(!tree->tree1d) error = 83; /*alloc fail*/
+  if(tree->maxbitlen > 15) return 55; /*the tree cannot be made from these lengths*/
 
-  if(!uivector_resizev(&blcount, tree->maxbitlen + 1, 0)
-  || !uivector_resizev(&nextcode, tree->maxbitlen + 1, 0))
-    error = 83; /*alloc fail*/
-
-  if(!error)
+  if(!tree->external)
   {
-    /*step 1: count number of instances of each code length*/
-    for(bits = 0; bits != tree->numcodes; ++bits) ++blcount.data[tree->lengths[bits]];
-    /*step 2: generate the nextcode values*/
-    for(bits = 1; bits <= tree->maxbitlen; ++bits)
-    {
-      nextcode.data[bits] = (nextcode.data[bits - 1] + blcount.data[bits - 1]) << 1;
-    }
-    /*step 3: generate all the codes*/
-    for(n = 0; n != tree->numcodes; ++n)
-    {
-      if(tree->lengths[n] != 0) tree->tree1d[n] = nextcode.data[tree->lengths[n]]++;
-    }
+    tree->tree1d = (unsigned*)lodepng_malloc(tree->numcodes * sizeof(unsigned));
+    if(!tree->tree1d) return 83; /*alloc fail*/
   }
 
-  uivector_cleanup(&blcount);
-  uivector_cleanup(&nextcode);
+  for(bits = 0; bits <= tree->maxbitlen; ++bits) blcount[bits] = nextcode[bits] = 0;
+  /*step 1: count number of instances of each code length*/
+  for(bits = 0; bits != tree->numcodes; ++bits)
+  {
+    if(tree->lengths[bits] > tree->maxbitlen) return 55; /*the tree cannot be made from these lengths*/
+    ++blcount[tree->lengths[bits]];
+  }
+  /*step 2: generate the nextcode values*/
+  for(bits = 1; bits <= tree->maxbitlen; ++bits)
+  {
+    nextcode[bits] = (nextcode[bits - 1] + blcount[bits - 1]) << 1;
+  }
+  /*step 3: generate all the codes*/
+  for(n = 0; n != tree->numcodes; ++n)
+  {
+    if(tree->lengths[n] != 0) tree->tree1d[n] = nextcode[tree->lengths[n]]++;
+  }
 
-  if(!error) return HuffmanTree_make2DTree(tree);
-  else return error;
+  return HuffmanTree_make2DTree(tree);
 }
 
 /*
@@ -719,8 +910,11 @@ static unsigned HuffmanTree_makeFromLengths(HuffmanTree* tree, const unsigned* b
                                             size_t numcodes, unsigned maxbitlen)
 {
   unsigned i;
-  tree->lengths = (unsigned*)lodepng_malloc(numcodes * sizeof(unsigned));
-  if(!tree->lengths) return 83; /*alloc fail*/
+  if(!tree->external)
+  {
+    tree->lengths = (unsigned*)lodepng_malloc(numcodes * sizeof(unsigned));
+    if(!tree->lengths) return 83; /*alloc fail*/
+  }
   for(i = 0; i != numcodes; ++i) tree->lengths[i] = bitlen[i];
   tree->numcodes = (unsigned)numcodes; /*number of symbols*/
   tree->maxbitlen = maxbitlen;
@@ -945,7 +1139,8 @@ static unsigned HuffmanTree_makeFromFrequencies(HuffmanTree* tree, const unsigne
   while(!frequencies[numcodes - 1] && numcodes > mincodes) --numcodes; /*trim zeroes*/
   tree->maxbitlen = maxbitlen;
   tree->numcodes = (unsigned)numcodes; /*number of symbols*/
-  tree->lengths = (unsigned*)lodepng_realloc(tree->lengths, numcodes * sizeof(unsigned));
+  tree->lengths = (unsigned*)lodepng_realloc(tree->lengths, tree->lengths ? tree->numcodes * sizeof(unsigned) : 0,
+                                             numcodes * sizeof(unsigned));
   if(!tree->lengths) return 83; /*alloc fail*/
   /*initialize all lengths to 0*/
   memset(tree->lengths, 0, numcodes * sizeof(unsigned));
@@ -969,9 +1164,8 @@ static unsigned HuffmanTree_getLength(const HuffmanTree* tree, unsigned index)
 /*get the literal and length code tree of a deflated block with fixed tree, as per the deflate specification*/
 static unsigned generateFixedLitLenTree(HuffmanTree* tree)
 {
-  unsigned i, error = 0;
-  unsigned* bitlen = (unsigned*)lodepng_malloc(NUM_DEFLATE_CODE_SYMBOLS * sizeof(unsigned));
-  if(!bitlen) return 83; /*alloc fail*/
+  unsigned i;
+  unsigned bitlen[NUM_DEFLATE_CODE_SYMBOLS];
 
   /*288 possible codes: 0-255=literals, 256=endcode, 257-285=lengthcodes, 286-287=unused*/
   for(i =   0; i <= 143; ++i) bitlen[i] = 8;
@@ -979,25 +1173,18 @@ static unsigned generateFixedLitLenTree(HuffmanTree* tree)
   for(i = 256; i <= 279; ++i) bitlen[i] = 7;
   for(i = 280; i <= 287; ++i) bitlen[i] = 8;
 
-  error = HuffmanTree_makeFromLengths(tree, bitlen, NUM_DEFLATE_CODE_SYMBOLS, 15);
-
-  lodepng_free(bitlen);
-  return error;
+  return HuffmanTree_makeFromLengths(tree, bitlen, NUM_DEFLATE_CODE_SYMBOLS, 15);
 }
 
 /*get the distance code tree of a deflated block with fixed tree, as specified in the deflate specification*/
 static unsigned generateFixedDistanceTree(HuffmanTree* tree)
 {
-  unsigned i, error = 0;
-  unsigned* bitlen = (unsigned*)lodepng_malloc(NUM_DISTANCE_SYMBOLS * sizeof(unsigned));
-  if(!bitlen) return 83; /*alloc fail*/
+  unsigned i;
+  unsigned bitlen[NUM_DISTANCE_SYMBOLS];
 
   /*there are 32 distance codes, but 30-31 are unused*/
   for(i = 0; i != NUM_DISTANCE_SYMBOLS; ++i) bitlen[i] = 5;
-  error = HuffmanTree_makeFromLengths(tree, bitlen, NUM_DISTANCE_SYMBOLS, 15);
-
-  lodepng_free(bitlen);
-  return error;
+  return HuffmanTree_makeFromLengths(tree, bitlen, NUM_DISTANCE_SYMBOLS, 15);
 }
 
 #ifdef LODEPNG_COMPILE_DECODER
@@ -1006,18 +1193,21 @@ static unsigned generateFixedDistanceTree(HuffmanTree* tree)
 returns the code, or (unsigned)(-1) if error happened
 inbitlength is the length of the complete buffer, in bits (so its byte length times 8)
 */
-static unsigned huffmanDecodeSymbol(const unsigned char* in, size_t* bp,
+static unsigned huffmanDecodeSymbol(InflateInput* in, size_t* bp,
                                     const HuffmanTree* codetree, size_t inbitlength)
 {
   unsigned treepos = 0, ct;
+  /*codes are at most 15 bits long, the whole code is fetched from the bit buffer at once*/
+  size_t bits = peekBitsFromStream(*bp, in, MAX_PEEK_BITS);
   for(;;)
   {
     if(*bp >= inbitlength) return (unsigned)(-1); /*error: end of input memory reached without endcode*/
     /*
-    decode the symbol from the tree. The "readBitFromStream" code is inlined in
-    the expression below because this is the biggest bottleneck while decoding
+    decode the symbol from the tree. This is the biggest bottleneck while decoding,
+    so the bits are taken straight from the peeked bits
     */
-    ct = codetree->tree2d[(treepos << 1) + READBIT(*bp, in)];
+    ct = codetree->tree2d[(treepos << 1) + (unsigned)(bits & 1u)];
+    bits >>= 1;
     ++(*bp);
     if(ct < codetree->numcodes) return ct; /*the symbol is decoded, return it*/
     else treepos = ct - codetree->numcodes; /*symbol not yet decoded, instead move tree position*/
@@ -1033,17 +1223,47 @@ static unsigned huffmanDecodeSymbol(const unsigned char* in, size_t* bp,
 /* / Inflator (Decompressor)                                                / */
 /* ////////////////////////////////////////////////////////////////////////// */
 
+/*
+Storage of the Huffman trees and code lengths of dynamic blocks. One instance serves all blocks
+of a stream, it is taken from LodePNGDecoderScratch or allocated at the first dynamic block.
+*/
+typedef struct InflateTrees
+{
+  unsigned ll[HUFFMAN_STORAGE_SIZE(NUM_DEFLATE_CODE_SYMBOLS)];
+  unsigned d[HUFFMAN_STORAGE_SIZE(NUM_DISTANCE_SYMBOLS)];
+  unsigned cl[HUFFMAN_STORAGE_SIZE(NUM_CODE_LENGTH_CODES)];
+  unsigned bitlen_ll[NUM_DEFLATE_CODE_SYMBOLS];
+  unsigned bitlen_d[NUM_DISTANCE_SYMBOLS];
+  unsigned bitlen_cl[NUM_CODE_LENGTH_CODES];
+} InflateTrees;
+
+/*the trees of fixed blocks never change, they are built once into static storage and shared*/
+static unsigned fixed_storage_ll[HUFFMAN_STORAGE_SIZE(NUM_DEFLATE_CODE_SYMBOLS)];
+static unsigned fixed_storage_d[HUFFMAN_STORAGE_SIZE(NUM_DISTANCE_SYMBOLS)];
+static HuffmanTree fixed_tree_ll;
+static HuffmanTree fixed_tree_d;
+static unsigned fixed_trees_built = 0;
+
 /*get the tree of a deflated block with fixed tree, as specified in the deflate specification*/
-static void getTreeInflateFixed(HuffmanTree* tree_ll, HuffmanTree* tree_d)
+static unsigned getTreeInflateFixed(const HuffmanTree** tree_ll, const HuffmanTree** tree_d)
 {
-  /*TODO: check for out of memory errors*/
-  generateFixedLitLenTree(tree_ll);
-  generateFixedDistanceTree(tree_d);
+  if(!fixed_trees_built)
+  {
+    HuffmanTree_initStorage(&fixed_tree_ll, fixed_storage_ll, NUM_DEFLATE_CODE_SYMBOLS);
+    HuffmanTree_initStorage(&fixed_tree_d, fixed_storage_d, NUM_DISTANCE_SYMBOLS);
+    CERROR_TRY_RETURN(generateFixedLitLenTree(&fixed_tree_ll));
+    CERROR_TRY_RETURN(generateFixedDistanceTree(&fixed_tree_d));
+    fixed_trees_built = 1;
+  }
+
+  *tree_ll = &fixed_tree_ll;
+  *tree_d = &fixed_tree_d;
+  return 0;
 }
 
 /*get the tree of a deflated block with dynamic tree, the tree itself is also Huffman compressed with a known tree*/
-static unsigned getTreeInflateDynamic(HuffmanTree* tree_ll, HuffmanTree* tree_d,
-                                      const unsigned char* in, size_t* bp, size_t inlength)
+static unsigned getTreeInflateDynamic(HuffmanTree* tree_ll, HuffmanTree* tree_d, InflateTrees* trees,
+                                      InflateInput* in, size_t* bp, size_t inlength)
 {
   /*make sure that length values that aren't filled in will be 0, or a wrong tree will be generated*/
   unsigned error = 0;
@@ -1051,10 +1271,10 @@ static unsigned getTreeInflateDynamic(HuffmanTree* tree_ll, HuffmanTree* tree_d,
   size_t inbitlength = inlength * 8;
 
   /*see comments in deflateDynamic for explanation of the context and these variables, it is analogous*/
-  unsigned* bitlen_ll = 0; /*lit,len code lengths*/
-  unsigned* bitlen_d = 0; /*dist code lengths*/
+  unsigned* bitlen_ll = trees->bitlen_ll; /*lit,len code lengths*/
+  unsigned* bitlen_d = trees->bitlen_d; /*dist code lengths*/
   /*code length code lengths ("clcl"), the bit lengths of the huffman tree used to compress bitlen_ll and bitlen_d*/
-  unsigned* bitlen_cl = 0;
+  unsigned* bitlen_cl = trees->bitlen_cl;
   HuffmanTree tree_cl; /*the code tree for code length codes (the huffman tree for compressed huffman trees)*/
 
   if((*bp) + 14 > (inlength << 3)) return 49; /*error: the bit pointer is or will go past the memory*/
@@ -1068,15 +1288,11 @@ static unsigned getTreeInflateDynamic(HuffmanTree* tree_ll, HuffmanTree* tree_d,
 
   if((*bp) + HCLEN * 3 > (inlength << 3)) return 50; /*error: the bit pointer is or will go past the memory*/
 
-  HuffmanTree_init(&tree_cl);
+  HuffmanTree_initStorage(&tree_cl, trees->cl, NUM_CODE_LENGTH_CODES);
 
   while(!error)
   {
     /*read the code length codes out of 3 * (amount of code length codes) bits*/
-
-    bitlen_cl = (unsigned*)lodepng_malloc(NUM_CODE_LENGTH_CODES * sizeof(unsigned));
-    if(!bitlen_cl) ERROR_BREAK(83 /*alloc fail*/);
-
     for(i = 0; i != NUM_CODE_LENGTH_CODES; ++i)
     {
       if(i < HCLEN) bitlen_cl[CLCL_ORDER[i]] = readBitsFromStream(bp, in, 3);
@@ -1087,9 +1303,6 @@ static unsigned getTreeInflateDynamic(HuffmanTree* tree_ll, HuffmanTree* tree_d,
     if(error) break;
 
     /*now we can use this tree to read the lengths for the tree that this function will return*/
-    bitlen_ll = (unsigned*)lodepng_malloc(NUM_DEFLATE_CODE_SYMBOLS * sizeof(unsigned));
-    bitlen_d = (unsigned*)lodepng_malloc(NUM_DISTANCE_SYMBOLS * sizeof(unsigned));
-    if(!bitlen_ll || !bitlen_d) ERROR_BREAK(83 /*alloc fail*/);
     for(i = 0; i != NUM_DEFLATE_CODE_SYMBOLS; ++i) bitlen_ll[i] = 0;
     for(i = 0; i != NUM_DISTANCE_SYMBOLS; ++i) bitlen_d[i] = 0;
 
@@ -1181,33 +1394,34 @@ static unsigned getTreeInflateDynamic(HuffmanTree* tree_ll, HuffmanTree* tree_d,
     break; /*end of error-while*/
   }
 
-  lodepng_free(bitlen_cl);
-  lodepng_free(bitlen_ll);
-  lodepng_free(bitlen_d);
-  HuffmanTree_cleanup(&tree_cl);
-
   return error;
 }
 
-/*inflate a block with dynamic of fixed Huffman tree*/
-static unsigned inflateHuffmanBlock(ucvector* out, const unsigned char* in, size_t* bp,
-                                    size_t* pos, size_t inlength, unsigned btype)
+/*inflate a block with dynamic of fixed Huffman tree, trees is the storage for dynamic trees*/
+static unsigned inflateHuffmanBlock(ucvector* out, InflateInput* in, size_t* bp,
+                                    size_t* pos, size_t inlength, unsigned btype, InflateTrees* trees)
 {
   unsigned error = 0;
-  HuffmanTree tree_ll; /*the huffman tree for literal and length codes*/
-  HuffmanTree tree_d; /*the huffman tree for distance codes*/
+  HuffmanTree dynamic_ll;
+  HuffmanTree dynamic_d;
+  const HuffmanTree* tree_ll; /*the huffman tree for literal and length codes*/
+  const HuffmanTree* tree_d; /*the huffman tree for distance codes*/
   size_t inbitlength = inlength * 8;
 
-  HuffmanTree_init(&tree_ll);
-  HuffmanTree_init(&tree_d);
-
-  if(btype == 1) getTreeInflateFixed(&tree_ll, &tree_d);
-  else if(btype == 2) error = getTreeInflateDynamic(&tree_ll, &tree_d, in, bp, inlength);
+  if(btype == 1) error = getTreeInflateFixed(&tree_ll, &tree_d);
+  else
+  {
+    HuffmanTree_initStorage(&dynamic_ll, trees->ll, NUM_DEFLATE_CODE_SYMBOLS);
+    HuffmanTree_initStorage(&dynamic_d, trees->d, NUM_DISTANCE_SYMBOLS);
+    error = getTreeInflateDynamic(&dynamic_ll, &dynamic_d, trees, in, bp, inlength);
+    tree_ll = &dynamic_ll;
+    tree_d = &dynamic_d;
+  }
 
   while(!error) /*decode all symbols until end reached, breaks at end code*/
   {
     /*code_ll is literal, length or end code*/
-    unsigned code_ll = huffmanDecodeSymbol(in, bp, &tree_ll, inbitlength);
+    unsigned code_ll = huffmanDecodeSymbol(in, bp, tree_ll, inbitlength);
     if(code_ll <= 255) /*literal symbol*/
     {
       /*ucvector_push_back would do the same, but for some reason the two lines below run 10% faster*/
@@ -1230,7 +1444,7 @@ static unsigned inflateHuffmanBlock(ucvector* out, const unsigned char* in, size
       length += readBitsFromStream(bp, in, numextrabits_l);
 
       /*part 3: get distance code*/
-      code_d = huffmanDecodeSymbol(in, bp, &tree_d, inbitlength);
+      code_d = huffmanDecodeSymbol(in, bp, tree_d, inbitlength);
       if(code_d > 29)
       {
         if(code_d == (unsigned)(-1)) /*huffmanDecodeSymbol returns (unsigned)(-1) in case of error*/
@@ -1278,16 +1492,13 @@ static unsigned inflateHuffmanBlock(ucvector* out, const unsigned char* in, size
     }
   }
 
-  HuffmanTree_cleanup(&tree_ll);
-  HuffmanTree_cleanup(&tree_d);
-
   return error;
 }
 
-static unsigned inflateNoCompression(ucvector* out, const unsigned char* in, size_t* bp, size_t* pos, size_t inlength)
+static unsigned inflateNoCompression(ucvector* out, InflateInput* in, size_t* bp, size_t* pos, size_t inlength)
 {
   size_t p;
-  unsigned LEN, NLEN, n, error = 0;
+  unsigned LEN, NLEN, error = 0;
 
   /*go to first boundary of byte*/
   while(((*bp) & 0x7) != 0) ++(*bp);
@@ -1295,8 +1506,8 @@ static unsigned inflateNoCompression(ucvector* out, const unsigned char* in, siz
 
   /*read LEN (2 bytes) and NLEN (2 bytes)*/
   if(p + 4 >= inlength) return 52; /*error, bit pointer will jump past memory*/
-  LEN = in[p] + 256u * in[p + 1]; p += 2;
-  NLEN = in[p] + 256u * in[p + 1]; p += 2;
+  LEN = INFLATEBYTE(in, p) + 256u * INFLATEBYTE(in, p + 1); p += 2;
+  NLEN = INFLATEBYTE(in, p) + 256u * INFLATEBYTE(in, p + 1); p += 2;
 
   /*check if 16-bit NLEN is really the one's complement of LEN*/
   if(LEN + NLEN != 65535) return 21; /*error: NLEN is not one's complement of LEN*/
@@ -1305,40 +1516,59 @@ static unsigned inflateNoCompression(ucvector* out, const unsigned char* in, siz
 
   /*read the literal data: LEN bytes are now stored in the out buffer*/
   if(p + LEN > inlength) return 23; /*error: reading outside of in buffer*/
-  for(n = 0; n < LEN; ++n) out->data[(*pos)++] = in[p++];
+  if(!InflateInput_copy(out->data + *pos, in, p, LEN)) return 23;
+  (*pos) += LEN;
+  p += LEN;
 
   (*bp) = p * 8;
 
   return error;
 }
 
+/*inflates the deflate stream starting at bit bp of in, insize is the stream size in bytes*/
 static unsigned lodepng_inflatev(ucvector* out,
-                                 const unsigned char* in, size_t insize,
+                                 InflateInput* in, size_t bp, size_t insize,
                                  const LodePNGDecompressSettings* settings)
 {
-  /*bit pointer in the "in" data, current byte is bp >> 3, current bit is bp & 0x7 (from lsb to msb of the byte)*/
-  size_t bp = 0;
+  /*bp is the bit pointer in the "in" data, current byte is bp >> 3, current bit is bp & 0x7 (from lsb to msb of the byte)*/
   unsigned BFINAL = 0;
   size_t pos = 0; /*byte position in the out buffer*/
   unsigned error = 0;
+  LodePNGDecoderScratch* scratch = settings->scratch;
+  InflateTrees* trees = 0;
 
-  (void)settings;
+  /*take the trees of the scratch for this stream, a nested inflate finds them taken*/
+  if(scratch)
+  {
+    trees = (InflateTrees*)scratch->trees;
+    scratch->trees = 0;
+  }
+  if(!trees) scratch = 0;
 
   while(!BFINAL)
   {
     unsigned BTYPE;
-    if(bp + 2 >= insize * 8) return 52; /*error, bit pointer will jump past memory*/
+    if(bp + 2 >= insize * 8) ERROR_BREAK(52); /*error, bit pointer will jump past memory*/
     BFINAL = readBitFromStream(&bp, in);
     BTYPE = 1u * readBitFromStream(&bp, in);
     BTYPE += 2u * readBitFromStream(&bp, in);
 
-    if(BTYPE == 3) return 20; /*error: invalid BTYPE*/
-    else if(BTYPE == 0) error = inflateNoCompression(out, in, &bp, &pos, insize); /*no compression*/
-    else error = inflateHuffmanBlock(out, in, &bp, &pos, insize, BTYPE); /*compression, BTYPE 01 or 10*/
+    if(BTYPE == 3) ERROR_BREAK(20); /*error: invalid BTYPE*/
+    if(BTYPE == 2 && !trees)
+    {
+      trees = (InflateTrees*)lodepng_malloc(sizeof(InflateTrees));
+      if(!trees) ERROR_BREAK(83); /*alloc fail*/
+    }
+
+    if(BTYPE == 0) error = inflateNoCompression(out, in, &bp, &pos, insize); /*no compression*/
+    else error = inflateHuffmanBlock(out, in, &bp, &pos, insize, BTYPE, trees); /*compression, BTYPE 01 or 10*/
 
-    if(error) return error;
+    if(error) break;
   }
 
+  if(scratch) scratch->trees = trees;
+  else lodepng_free(trees);
+
   return error;
 }
 
@@ -1348,8 +1578,10 @@ unsigned lodepng_inflate(unsigned char** out, size_t* outsize,
 {
   unsigned error;
   ucvector v;
+  InflateInput input;
   ucvector_init_buffer(&v, *out, *outsize);
-  error = lodepng_inflatev(&v, in, insize, settings);
+  InflateInput_init(&input, in, insize);
+  error = lodepng_inflatev(&v, &input, 0, insize, settings);
   *out = v.data;
   *outsize = v.size;
   return error;
@@ -2185,25 +2417,26 @@ static unsigned adler32(const unsigned char* data, unsigned len)
 
 #ifdef LODEPNG_COMPILE_DECODER
 
-unsigned lodepng_zlib_decompress(unsigned char** out, size_t* outsize, const unsigned char* in,
-                                 size_t insize, const LodePNGDecompressSettings* settings)
+/*checks the 2 byte zlib header at the start of in*/
+static unsigned zlib_checkHeader(InflateInput* in, size_t insize)
 {
-  unsigned error = 0;
-  unsigned CM, CINFO, FDICT;
+  unsigned CMF, FLG, CM, CINFO, FDICT;
 
   if(insize < 2) return 53; /*error, size of zlib data too small*/
+  CMF = INFLATEBYTE(in, 0);
+  FLG = INFLATEBYTE(in, 1);
   /*read information from zlib header*/
-  if((in[0] * 256 + in[1]) % 31 != 0)
+  if((CMF * 256 + FLG) % 31 != 0)
   {
     /*error: 256 * in[0] + in[1] must be a multiple of 31, the FCHECK value is supposed to be made that way*/
     return 24;
   }
 
-  CM = in[0] & 15;
-  CINFO = (in[0] >> 4) & 15;
-  /*FCHECK = in[1] & 31;*/ /*FCHECK is already tested above*/
-  FDICT = (in[1] >> 5) & 1;
-  /*FLEVEL = (in[1] >> 6) & 3;*/ /*FLEVEL is not used here*/
+  CM = CMF & 15;
+  CINFO = (CMF >> 4) & 15;
+  /*FCHECK = FLG & 31;*/ /*FCHECK is already tested above*/
+  FDICT = (FLG >> 5) & 1;
+  /*FLEVEL = (FLG >> 6) & 3;*/ /*FLEVEL is not used here*/
 
   if(CM != 8 || CINFO > 7)
   {
@@ -2217,19 +2450,65 @@ unsigned lodepng_zlib_decompress(unsigned char** out, size_t* outsize, const uns
     return 26;
   }
 
-  error = inflate(out, outsize, in + 2, insize - 2, settings);
-  if(error) return error;
+  return 0;
+}
 
-  if(!settings->ignore_adler32)
+/*compares the adler32 checksum stored in the last 4 bytes of in against the inflated data*/
+static unsigned zlib_checkAdler32(InflateInput* in, size_t insize,
+                                  const unsigned char* out, size_t outsize,
+                                  const LodePNGDecompressSettings* settings)
+{
+  unsigned char stored[4];
+
+  if(settings->ignore_adler32) return 0;
+  if(insize < 4 || !InflateInput_copy(stored, in, insize - 4, 4)) return 53; /*error, size of zlib data too small*/
+  if(adler32(out, (unsigned)outsize) != lodepng_read32bitInt(stored))
   {
-    unsigned ADLER32 = lodepng_read32bitInt(&in[insize - 4]);
-    unsigned checksum = adler32(*out, (unsigned)(*outsize));
-    if(checksum != ADLER32) return 58; /*error, adler checksum not correct, data must be corrupted*/
+    return 58; /*error, adler checksum not correct, data must be corrupted*/
   }
 
   return 0; /*no error*/
 }
 
+unsigned lodepng_zlib_decompress(unsigned char** out, size_t* outsize, const unsigned char* in,
+                                 size_t insize, const LodePNGDecompressSettings* settings)
+{
+  unsigned error;
+  InflateInput input;
+
+  InflateInput_init(&input, in, insize);
+  error = zlib_checkHeader(&input, insize);
+  if(error) return error;
+
+  error = inflate(out, outsize, in + 2, insize - 2, settings);
+  if(error) return error;
+
+  return zlib_checkAdler32(&input, insize, *out, *outsize, settings);
+}
+
+#ifdef LODEPNG_COMPILE_PNG
+/*
+inflates the zlib stream spread over the IDAT chunks starting at chunk, directly from the
+PNG buffer. insize is the summed length of the IDAT chunk payloads.
+*/
+static unsigned zlib_decompress_idat(ucvector* out, const unsigned char* chunk, const unsigned char* end,
+                                     size_t insize, const LodePNGDecompressSettings* settings)
+{
+  unsigned error;
+  InflateInput input;
+
+  InflateInput_initIdat(&input, chunk, end);
+  error = zlib_checkHeader(&input, insize);
+  if(error) return error;
+
+  /*the deflate data starts after the 2 byte zlib header*/
+  error = lodepng_inflatev(out, &input, 16, insize, settings);
+  if(error) return error;
+
+  return zlib_checkAdler32(&input, insize, out->data, out->size, settings);
+}
+#endif /*LODEPNG_COMPILE_PNG*/
+
 static unsigned zlib_decompress(unsigned char** out, size_t* outsize, const unsigned char* in,
                                 size_t insize, const LodePNGDecompressSettings* settings)
 {
@@ -2361,9 +2640,31 @@ void lodepng_decompress_settings_init(LodePNGDecompressSettings* settings)
   settings->custom_zlib = 0;
   settings->custom_inflate = 0;
   settings->custom_context = 0;
+
+  settings->scratch = 0;
+}
+
+unsigned lodepng_decoder_scratch_init(LodePNGDecoderScratch* scratch)
+{
+  const HuffmanTree* tree_ll;
+  const HuffmanTree* tree_d;
+
+  scratch->trees = lodepng_malloc(sizeof(InflateTrees));
+  scratch->buffer = (unsigned char*)lodepng_malloc(LODEPNG_SCRATCH_BUFFER_SIZE);
+  CERROR_TRY_RETURN(getTreeInflateFixed(&tree_ll, &tree_d));
+  if(!scratch->trees || !scratch->buffer) return 83; /*alloc fail*/
+  return 0;
+}
+
+void lodepng_decoder_scratch_cleanup(LodePNGDecoderScratch* scratch)
+{
+  lodepng_free(scratch->trees);
+  lodepng_free(scratch->buffer);
+  scratch->trees = 0;
+  scratch->buffer = 0;
 }
 
-const LodePNGDecompressSettings lodepng_default_decompress_settings = {0, 0, 0, 0};
+const LodePNGDecompressSettings lodepng_default_decompress_settings = {0, 0, 0, 0, 0};
 
 #endif /*LODEPNG_COMPILE_DECODER*/
 
@@ -2560,7 +2861,7 @@ unsigned lodepng_chunk_append(unsigned char** out, size_t* outlength, const unsi
   size_t new_length = (*outlength) + total_chunk_length;
   if(new_length < total_chunk_length || new_length < (*outlength)) return 77; /*integer overflow happened*/
 
-  new_buffer = (unsigned char*)lodepng_realloc(*out, new_length);
+  new_buffer = (unsigned char*)lodepng_realloc(*out, *outlength, new_length);
   if(!new_buffer) return 83; /*alloc fail*/
   (*out) = new_buffer;
   (*outlength) = new_length;
@@ -2578,7 +2879,7 @@ unsigned lodepng_chunk_create(unsigned char** out, size_t* outlength, unsigned l
   unsigned char *chunk, *new_buffer;
   size_t new_length = (*outlength) + length + 12;
   if(new_length < length + 12 || new_length < (*outlength)) return 77; /*integer overflow happened*/
-  new_buffer = (unsigned char*)lodepng_realloc(*out, new_length);
+  new_buffer = (unsigned char*)lodepng_realloc(*out, *outlength, new_length);
   if(!new_buffer) return 83; /*alloc fail*/
   (*out) = new_buffer;
   (*outlength) = new_length;
@@ -2707,7 +3008,7 @@ unsigned lodepng_palette_add(LodePNGColorMode* info,
   if(!info->palette) /*allocate palette if empty*/
   {
     /*room for 256 colors with 4 bytes each*/
-    data = (unsigned char*)lodepng_realloc(info->palette, 1024);
+    data = (unsigned char*)lodepng_realloc(info->palette, 0, 1024);
     if(!data) return 83; /*alloc fail*/
     else info->palette = data;
   }
@@ -2912,8 +3213,9 @@ void lodepng_clear_text(LodePNGInfo* info)
 
 unsigned lodepng_add_text(LodePNGInfo* info, const char* key, const char* str)
 {
-  char** new_keys = (char**)(lodepng_realloc(info->text_keys, sizeof(char*) * (info->text_num + 1)));
-  char** new_strings = (char**)(lodepng_realloc(info->text_strings, sizeof(char*) * (info->text_num + 1)));
+  size_t oldsize = sizeof(char*) * info->text_num;
+  char** new_keys = (char**)(lodepng_realloc(info->text_keys, oldsize, oldsize + sizeof(char*)));
+  char** new_strings = (char**)(lodepng_realloc(info->text_strings, oldsize, oldsize + sizeof(char*)));
   if(!new_keys || !new_strings)
   {
     lodepng_free(new_keys);
@@ -2982,10 +3284,11 @@ void lodepng_clear_itext(LodePNGInfo* info)
 unsigned lodepng_add_itext(LodePNGInfo* info, const char* key, const char* langtag,
                            const char* transkey, const char* str)
 {
-  char** new_keys = (char**)(lodepng_realloc(info->itext_keys, sizeof(char*) * (info->itext_num + 1)));
-  char** new_langtags = (char**)(lodepng_realloc(info->itext_langtags, sizeof(char*) * (info->itext_num + 1)));
-  char** new_transkeys = (char**)(lodepng_realloc(info->itext_transkeys, sizeof(char*) * (info->itext_num + 1)));
-  char** new_strings = (char**)(lodepng_realloc(info->itext_strings, sizeof(char*) * (info->itext_num + 1)));
+  size_t oldsize = sizeof(char*) * info->itext_num;
+  char** new_keys = (char**)(lodepng_realloc(info->itext_keys, oldsize, oldsize + sizeof(char*)));
+  char** new_langtags = (char**)(lodepng_realloc(info->itext_langtags, oldsize, oldsize + sizeof(char*)));
+  char** new_transkeys = (char**)(lodepng_realloc(info->itext_transkeys, oldsize, oldsize + sizeof(char*)));
+  char** new_strings = (char**)(lodepng_realloc(info->itext_strings, oldsize, oldsize + sizeof(char*)));
   if(!new_keys || !new_langtags || !new_transkeys || !new_strings)
   {
     lodepng_free(new_keys);
@@ -4178,7 +4481,8 @@ static unsigned unfilterScanline(unsigned char* recon, const unsigned char* scan
   return 0;
 }
 
-static unsigned unfilter(unsigned char* out, const unsigned char* in, unsigned w, unsigned h, unsigned bpp)
+static unsigned unfilter(unsigned char* out, const unsigned char* in, unsigned w, unsigned h, unsigned bpp,
+                         const LodePNGDecoderSettings* convert)
 {
   /*
   For PNG filter method 0
@@ -4186,6 +4490,7 @@ static unsigned unfilter(unsigned char* out, const unsigned char* in, unsigned w
   out must have enough bytes allocated already, in must have the scanlines + 1 filtertype byte per scanline
   w and h are image dimensions or dimensions of reduced image, bpp is bits per pixel
   in and out are allowed to be the same memory address (but aren't the same size since in has the extra filter bytes)
+  if convert is not 0, its convert_row is called on each row of out once it is final
   */
 
   unsigned y;
@@ -4203,8 +4508,11 @@ static unsigned unfilter(unsigned char* out, const unsigned char* in, unsigned w
 
     CERROR_TRY_RETURN(unfilterScanline(&out[outindex], &in[inindex + 1], prevline, bytewidth, filterType, linebytes));
 
+    /*the previous row is final once the row below it no longer needs it for unfiltering*/
+    if(convert && prevline) convert->convert_row(prevline, w, convert->convert_row_context);
     prevline = &out[outindex];
   }
+  if(convert && prevline) convert->convert_row(prevline, w, convert->convert_row_context);
 
   return 0;
 }
@@ -4299,9 +4607,11 @@ static void removePaddingBits(unsigned char* out, const unsigned char* in,
 
 /*out must be buffer big enough to contain full image, and in must contain the full decompressed data from
 the IDAT chunks (with filter index bytes and possible padding bits)
+if convert is not 0, its convert_row is called on each row of out once it is final
 return value is error*/
 static unsigned postProcessScanlines(unsigned char* out, unsigned char* in,
-                                     unsigned w, unsigned h, const LodePNGInfo* info_png)
+                                     unsigned w, unsigned h, const LodePNGInfo* info_png,
+                                     const LodePNGDecoderSettings* convert)
 {
   /*
   This function converts the filtered-padded-interlaced data into pure 2D image buffer with the PNG's colortype.
@@ -4317,11 +4627,11 @@ static unsigned postProcessScanlines(unsigned char* out, unsigned char* in,
   {
     if(bpp < 8 && w * bpp != ((w * bpp + 7) / 8) * 8)
     {
-      CERROR_TRY_RETURN(unfilter(in, in, w, h, bpp));
+      CERROR_TRY_RETURN(unfilter(in, in, w, h, bpp, 0));
       removePaddingBits(out, in, w * bpp, ((w * bpp + 7) / 8) * 8, h);
     }
     /*we can immediately filter into the out buffer, no other steps needed*/
-    else CERROR_TRY_RETURN(unfilter(out, in, w, h, bpp));
+    else CERROR_TRY_RETURN(unfilter(out, in, w, h, bpp, convert));
   }
   else /*interlace_method is 1 (Adam7)*/
   {
@@ -4332,7 +4642,7 @@ static unsigned postProcessScanlines(unsigned char* out, unsigned char* in,
 
     for(i = 0; i != 7; ++i)
     {
-      CERROR_TRY_RETURN(unfilter(&in[padded_passstart[i]], &in[filter_passstart[i]], passw[i], passh[i], bpp));
+      CERROR_TRY_RETURN(unfilter(&in[padded_passstart[i]], &in[filter_passstart[i]], passw[i], passh[i], bpp, 0));
       /*TODO: possible efficiency improvement: if in this reduced image the bits fit nicely in 1 scanline,
       move bytes instead of bits or move not at all*/
       if(bpp < 8)
@@ -4345,6 +4655,12 @@ static unsigned postProcessScanlines(unsigned char* out, unsigned char* in,
     }
 
     Adam7_deinterlace(out, in, w, h, bpp);
+
+    /*rows only become final during the last pass, so interlaced images are converted afterwards*/
+    if(convert)
+    {
+      for(i = 0; i != h; ++i) convert->convert_row(&out[(size_t)i * w * 4], w, convert->convert_row_context);
+    }
   }
 
   return 0;
@@ -4738,18 +5054,65 @@ static unsigned readChunk_iCCP(LodePNGInfo* info, const LodePNGDecompressSetting
 }
 #endif /*LODEPNG_COMPILE_ANCILLARY_CHUNKS*/
 
-/*read a PNG, the result will be in the same color type as the PNG (hence "generic")*/
+/*
+inflate the IDAT chunks starting at chunk into out. The built in inflator reads them in place,
+custom zlib decoders take a contiguous buffer, so for those the chunk data is concatenated first.
+*/
+static unsigned decompressIdat(ucvector* out, const unsigned char* chunk, const unsigned char* end,
+                               size_t idatsize, const LodePNGDecompressSettings* settings)
+{
+  unsigned error = 0;
+  ucvector idat;
+  size_t pos = 0;
+
+  if(!settings->custom_zlib && !settings->custom_inflate)
+  {
+    return zlib_decompress_idat(out, chunk, end, idatsize, settings);
+  }
+
+  ucvector_init(&idat);
+  if(!ucvector_resize(&idat, idatsize)) return 83; /*alloc fail*/
+  while(pos < idatsize)
+  {
+    unsigned chunkLength = lodepng_chunk_length(chunk);
+    if(lodepng_chunk_type_equals(chunk, "IDAT"))
+    {
+      memcpy(idat.data + pos, (void*)lodepng_chunk_data_const(chunk), chunkLength);
+      pos += chunkLength;
+    }
+    chunk = lodepng_chunk_next_const(chunk);
+  }
+
+  error = zlib_decompress(&out->data, &out->size, idat.data, idat.size, settings);
+  ucvector_cleanup(&idat);
+  return error;
+}
+
+/*
+read a PNG, the result will be in the same color type as the PNG (hence "generic").
+buffer is the scratch buffer of LODEPNG_SCRATCH_BUFFER_SIZE bytes or 0, the scanlines are
+inflated in it and, if a color conversion follows, the result is stored at its start.
+*/
+/*whether the decoder output goes through decoder.convert_row*/
+static unsigned decoderConvertsRows(const LodePNGState* state)
+{
+  return state->decoder.convert_row && state->decoder.color_convert
+      && state->info_raw.colortype == LCT_RGBA && state->info_raw.bitdepth == 8;
+}
+
 static void decodeGeneric(unsigned char** out, unsigned* w, unsigned* h,
                           LodePNGState* state,
-                          const unsigned char* in, size_t insize)
+                          const unsigned char* in, size_t insize, unsigned char* buffer)
 {
   unsigned char IEND = 0;
   const unsigned char* chunk;
   size_t i;
-  ucvector idat; /*the data from idat chunks*/
+  const unsigned char* idat = 0; /*the first idat chunk, the compressed data is read from the chunks in place*/
+  size_t idatsize = 0; /*summed length of the data of all idat chunks*/
   ucvector scanlines;
   size_t predict;
   size_t outsize = 0;
+  size_t pixelsize = 0; /*bytes of the scratch buffer used by the result*/
 
   /*for unknown chunk order*/
   unsigned unknown = 0;
@@ -4768,11 +5131,10 @@ static void decodeGeneric(unsigned char** out, unsigned* w, unsigned* h,
     CERROR_RETURN(state->error, 92); /*overflow possible due to amount of pixels*/
   }
 
-  ucvector_init(&idat);
   chunk = &in[33]; /*first byte of the first chunk after the header*/
 
   /*loop through the chunks, ignoring unknown chunks and stopping at IEND chunk.
-  IDAT data is put at the start of the in buffer*/
+  IDAT chunks are only validated and counted here, their data is inflated from the in buffer later*/
   while(!IEND && !state->error)
   {
     unsigned chunkLength;
@@ -4806,11 +5168,8 @@ static void decodeGeneric(unsigned char** out, unsigned* w, unsigned* h,
     /*IDAT chunk, containing compressed image data*/
     if(lodepng_chunk_type_equals(chunk, "IDAT"))
     {
-      size_t oldsize = idat.size;
-      size_t newsize;
-      if(lodepng_addofl(oldsize, chunkLength, &newsize)) CERROR_BREAK(state->error, 95);
-      if(!ucvector_resize(&idat, newsize)) CERROR_BREAK(state->error, 83 /*alloc fail*/);
-      for(i = 0; i != chunkLength; ++i) idat.data[oldsize + i] = data[i];
+      if(lodepng_addofl(idatsize, chunkLength, &idatsize)) CERROR_BREAK(state->error, 95);
+      if(!idat) idat = chunk;
 #ifdef LODEPNG_COMPILE_ANCILLARY_CHUNKS
       critical_pos = 3;
 #endif /*LODEPNG_COMPILE_ANCILLARY_CHUNKS*/
@@ -4947,36 +5306,73 @@ static void decodeGeneric(unsigned char** out, unsigned* w, unsigned* h,
     if(*w > 1) predict += lodepng_get_raw_size_idat((*w + 0) >> 1, (*h + 1) >> 1, color);
     predict += lodepng_get_raw_size_idat((*w + 0), (*h + 0) >> 1, color);
   }
-  if(!state->error && !ucvector_reserve(&scanlines, predict)) state->error = 83; /*alloc fail*/
+  outsize = lodepng_get_raw_size(*w, *h, &state->info_png.color);
+  /*the result only stays in the scratch buffer when it is converted into a new buffer afterwards.
+  Custom zlib decoders may reallocate the scanlines, so they always get a buffer of their own.*/
+  if(state->decoder.color_convert && !lodepng_color_mode_equal(&state->info_raw, &state->info_png.color))
+  {
+    pixelsize = outsize;
+  }
+  if(buffer && !state->decoder.zlibsettings.custom_zlib && !state->decoder.zlibsettings.custom_inflate
+     && pixelsize <= LODEPNG_SCRATCH_BUFFER_SIZE && predict <= LODEPNG_SCRATCH_BUFFER_SIZE - pixelsize)
+  {
+    ucvector_init_external(&scanlines, buffer + pixelsize, predict);
+  }
+  else
+  {
+    buffer = 0;
+    if(!state->error && !ucvector_reserve(&scanlines, predict)) state->error = 83; /*alloc fail*/
+  }
+  if(!state->error && !idat) state->error = 53; /*no IDAT chunk, size of zlib data too small*/
   if(!state->error)
   {
-    state->error = zlib_decompress(&scanlines.data, &scanlines.size, idat.data,
-                                   idat.size, &state->decoder.zlibsettings);
+    state->error = decompressIdat(&scanlines, idat, in + insize, idatsize, &state->decoder.zlibsettings);
     if(!state->error && scanlines.size != predict) state->error = 91; /*decompressed size doesn't match prediction*/
   }
-  ucvector_cleanup(&idat);
 
   if(!state->error)
   {
-    outsize = lodepng_get_raw_size(*w, *h, &state->info_png.color);
-    *out = (unsigned char*)lodepng_malloc(outsize);
+    if(buffer && pixelsize) *out = buffer;
+    else *out = (unsigned char*)lodepng_malloc(outsize);
     if(!*out) state->error = 83; /*alloc fail*/
   }
   if(!state->error)
   {
+    /*without color conversion the PNG itself is RGBA 8-bit, its rows are converted while unfiltering*/
+    const LodePNGDecoderSettings* convert = 0;
+    if(decoderConvertsRows(state) && lodepng_color_mode_equal(&state->info_raw, &state->info_png.color))
+    {
+      convert = &state->decoder;
+    }
     for(i = 0; i < outsize; i++) (*out)[i] = 0;
-    state->error = postProcessScanlines(*out, scanlines.data, *w, *h, &state->info_png);
+    state->error = postProcessScanlines(*out, scanlines.data, *w, *h, &state->info_png, convert);
   }
   ucvector_cleanup(&scanlines);
 }
 
-unsigned lodepng_decode(unsigned char** out, unsigned* w, unsigned* h,
-                        LodePNGState* state,
-                        const unsigned char* in, size_t insize)
+/*converts to RGBA 8-bit a few rows at a time, passing each row to convert_row right after it is written*/
+static void convertRowsRGBA8(unsigned char* out, const unsigned char* in, const LodePNGColorMode* mode_in,
+                             unsigned w, unsigned h, const LodePNGDecoderSettings* settings)
 {
-  *out = 0;
-  decodeGeneric(out, w, h, state, in, insize);
-  if(state->error) return state->error;
+  size_t linebits = (size_t)w * lodepng_get_bpp(mode_in);
+  unsigned y = 0, end;
+
+  while(y != h)
+  {
+    /*input rows have no padding bits, each batch of rows must start at a byte*/
+    end = y + 1;
+    while(end != h && ((size_t)end * linebits) % 8 != 0) ++end;
+    getPixelColorsRGBA8(&out[(size_t)y * w * 4], (size_t)(end - y) * w, 1, &in[(size_t)y * linebits / 8], mode_in);
+    for(; y != end; ++y) settings->convert_row(&out[(size_t)y * w * 4], w, settings->convert_row_context);
+  }
+}
+
+static void decodeConvert(unsigned char** out, unsigned* w, unsigned* h,
+                          LodePNGState* state,
+                          const unsigned char* in, size_t insize, unsigned char* buffer)
+{
+  decodeGeneric(out, w, h, state, in, insize, buffer);
+  if(state->error) return;
   if(!state->decoder.color_convert || lodepng_color_mode_equal(&state->info_raw, &state->info_png.color))
   {
     /*same color type, no copying or converting of data needed*/
@@ -4985,7 +5381,6 @@ unsigned lodepng_decode(unsigned char** out, unsigned* w, unsigned* h,
     if(!state->decoder.color_convert)
     {
       state->error = lodepng_color_mode_copy(&state->info_raw, &state->info_png.color);
-      if(state->error) return state->error;
     }
   }
   else
@@ -4999,7 +5394,7 @@ unsigned lodepng_decode(unsigned char** out, unsigned* w, unsigned* h,
     if(!(state->info_raw.colortype == LCT_RGB || state->info_raw.colortype == LCT_RGBA)
        && !(state->info_raw.bitdepth == 8))
     {
-      return 56; /*unsupported color mode conversion*/
+      CERROR_RETURN(state->error, 56); /*unsupported color mode conversion*/
     }
 
     outsize = lodepng_get_raw_size(*w, *h, &state->info_raw);
@@ -5008,9 +5403,38 @@ unsigned lodepng_decode(unsigned char** out, unsigned* w, unsigned* h,
     {
       state->error = 83; /*alloc fail*/
     }
+    else if(decoderConvertsRows(state))
+    {
+      convertRowsRGBA8(*out, data, &state->info_png.color, *w, *h, &state->decoder);
+    }
     else state->error = lodepng_convert(*out, data, &state->info_raw,
                                         &state->info_png.color, *w, *h);
-    lodepng_free(data);
+    if(data != buffer) lodepng_free(data);
+  }
+}
+
+unsigned lodepng_decode(unsigned char** out, unsigned* w, unsigned* h,
+                        LodePNGState* state,
+                        const unsigned char* in, size_t insize)
+{
+  LodePNGDecoderScratch* scratch = state->decoder.zlibsettings.scratch;
+  unsigned char* buffer = 0;
+
+  /*take the scratch buffer for this decode, a nested decode finds it taken*/
+  if(scratch)
+  {
+    buffer = scratch->buffer;
+    scratch->buffer = 0;
+  }
+
+  *out = 0;
+  decodeConvert(out, w, h, state, in, insize, buffer);
+
+  if(buffer)
+  {
+    /*the scratch buffer is never handed out, not even with an error*/
+    if(*out == buffer) *out = 0;
+    scratch->buffer = buffer;
   }
   return state->error;
 }
@@ -5065,6 +5489,8 @@ unsigned lodepng_decode24_file(unsigned char** out, unsigned* w, unsigned* h, co
 void lodepng_decoder_settings_init(LodePNGDecoderSettings* settings)
 {
   settings->color_convert = 1;
+  settings->convert_row = 0;
+  settings->convert_row_context = 0;
 #ifdef LODEPNG_COMPILE_ANCILLARY_CHUNKS
   settings->read_text_chunks = 1;
   settings->remember_unknown_chunks = 0;
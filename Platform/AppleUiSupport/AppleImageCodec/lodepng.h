@@ -85,7 +85,8 @@ the custom_zlib field of the compress and decompress settings*/
 #endif
 /*Compile the default allocators (C's free, malloc and realloc). If you disable this,
 you can define the functions lodepng_free, lodepng_malloc and lodepng_realloc in your
-source files with custom allocators.*/
+source files with custom allocators. lodepng_realloc is given the old size of the buffer
+as well, for allocators which cannot query it.*/
 #ifndef LODEPNG_NO_COMPILE_ALLOCATORS
 #define LODEPNG_COMPILE_ALLOCATORS
 #endif
@@ -266,6 +267,30 @@ const char* lodepng_error_text(unsigned code);
 #endif /*LODEPNG_COMPILE_ERROR_TEXT*/
 
 #ifdef LODEPNG_COMPILE_DECODER
+/*
+Scratch memory kept by its owner across decodes, so that consecutive decodes do not
+rebuild the decoder state. The inflator builds the Huffman trees of dynamic blocks in
+it instead of allocating them, and images whose inflated scanlines (plus the unconverted
+pixels when a color conversion follows) fit in LODEPNG_SCRATCH_BUFFER_SIZE bytes are
+decoded in it, leaving only the output buffer to allocate.
+A decode takes the memory for its duration, a nested decode finds the pointers cleared
+and allocates its own memory instead.
+*/
+#define LODEPNG_SCRATCH_BUFFER_SIZE 0x20000
+
+typedef struct LodePNGDecoderScratch
+{
+  void* trees; /*Huffman trees and code lengths of the inflator, 0 while in use*/
+  unsigned char* buffer; /*LODEPNG_SCRATCH_BUFFER_SIZE bytes for small images, 0 while in use*/
+} LodePNGDecoderScratch;
+
+/*
+Allocates the scratch memory and builds the fixed Huffman trees shared by all decodes.
+Returns an error if the allocation failed, the scratch may still be used in that case.
+*/
+unsigned lodepng_decoder_scratch_init(LodePNGDecoderScratch* scratch);
+void lodepng_decoder_scratch_cleanup(LodePNGDecoderScratch* scratch);
+
 /*Settings for zlib decompression*/
 typedef struct LodePNGDecompressSettings LodePNGDecompressSettings;
 struct LodePNGDecompressSettings
@@ -285,6 +310,8 @@ struct LodePNGDecompressSettings
                              const LodePNGDecompressSettings*);
 
   const void* custom_context; /*optional custom settings for custom functions*/
+
+  LodePNGDecoderScratch* scratch; /*optional scratch memory reused across decodes (default: null)*/
 };
 
 extern const LodePNGDecompressSettings lodepng_default_decompress_settings;
@@ -630,6 +657,12 @@ typedef struct LodePNGDecoderSettings
 
   unsigned color_convert; /*whether to convert the PNG to the color type you want. Default: yes*/
 
+  /*if set, every finished row of RGBA 8-bit output is passed to convert_row while it is still in cache,
+  which may rearrange its 4 byte pixels in place into another layout. Only used when converting to RGBA
+  with 8 bits per channel, which info_raw has by default. Default: 0*/
+  void (*convert_row)(unsigned char* row, unsigned w, const void* context);
+  const void* convert_row_context; /*passed to convert_row*/
+
 #ifdef LODEPNG_COMPILE_ANCILLARY_CHUNKS
   unsigned read_text_chunks; /*if false but remember_unknown_chunks is true, they're stored in the unknown chunks*/
   /*store all bytes from unknown chunks in the LodePNGInfo (off by default, useful for a png editor)*/
@@ -19,6 +19,7 @@ WITHOUT WARRANTIES OR REPRESENTATIONS OF ANY KIND, EITHER EXPRESS OR IMPLIED.
 #include <IndustryStandard/AppleHid.h>
 #include <Protocol/AppleKeyMapAggregator.h>
 #include <Protocol/AppleKeyMapDatabase.h>
+#include <Protocol/AppleKeyMapChordMatcher.h>
 #include <Library/BaseLib.h>
 #include <Library/BaseMemoryLib.h>
 #include <Library/DebugLib.h>
@@ -48,17 +49,62 @@ WITHOUT WARRANTIES OR REPRESENTATIONS OF ANY KIND, EITHER EXPRESS OR IMPLIED.
     KEY_MAP_AGGREGATOR_DATA_SIGNATURE                     \
     )
 
+// KEY_MAP_AGGREGATOR_DATA_FROM_CHORD_MATCHER_THIS
+#define KEY_MAP_AGGREGATOR_DATA_FROM_CHORD_MATCHER_THIS(This)  \
+  CR (                                                         \
+    (This),                                                    \
+    KEY_MAP_AGGREGATOR_DATA,                                   \
+    ChordMatcher,                                              \
+    KEY_MAP_AGGREGATOR_DATA_SIGNATURE                          \
+    )
+
 // KEY_MAP_AGGREGATOR_DATA
 typedef struct {
-  UINTN                             Signature;
-  UINTN                             NextKeyStrokeIndex;
-  APPLE_KEY_CODE                    *KeyCodeBuffer;
-  UINTN                             KeyCodeBufferLength;
-  LIST_ENTRY                        KeyStrokesInfoList;
-  APPLE_KEY_MAP_DATABASE_PROTOCOL   Database;
-  APPLE_KEY_MAP_AGGREGATOR_PROTOCOL Aggregator;
+  UINTN                                Signature;
+  UINTN                                NextKeyStrokeIndex;
+  APPLE_KEY_CODE                       *KeyCodeBuffer;
+  UINTN                                KeyCodeBufferLength;
+  LIST_ENTRY                           KeyStrokesInfoList;
+  UINTN                                KeyStateGeneration;
+  APPLE_KEY_MAP_DATABASE_PROTOCOL      Database;
+  APPLE_KEY_MAP_AGGREGATOR_PROTOCOL    Aggregator;
+  APPLE_KEY_MAP_CHORD_MATCHER_PROTOCOL ChordMatcher;
 } KEY_MAP_AGGREGATOR_DATA;
 
+// KEY_MAP_CHORD_SET_SIGNATURE
+#define KEY_MAP_CHORD_SET_SIGNATURE  SIGNATURE_32 ('K', 'e', 'y', 'C')
+
+// Key codes are mapped into the bitmask by their usage id within one page
+#define KEY_MAP_KEY_PAGE(KeyCode)  ((UINT16)((KeyCode) & 0xFF00U))
+#define KEY_MAP_KEY_ID(KeyCode)    ((UINTN)((KeyCode) & 0x00FFU))
+
+#define KEY_MAP_KEY_MASK_WORDS  (256 / 64)
+
+// KEY_MAP_COMPILED_CHORD
+typedef struct {
+  UINTN              ChordId;
+  APPLE_MODIFIER_MAP Modifiers;
+  BOOLEAN            ExactMatch;
+  UINT64             KeyMask[KEY_MAP_KEY_MASK_WORDS];
+} KEY_MAP_COMPILED_CHORD;
+
+#define SIZE_OF_KEY_MAP_CHORD_SET  \
+  OFFSET_OF (KEY_MAP_CHORD_SET, Chords)
+
+// KEY_MAP_CHORD_SET
+typedef struct {
+  UINTN                  Signature;
+  UINT16                 KeyPage;
+  //
+  // Key state generation the matches were last evaluated for
+  //
+  UINTN                  Generation;
+  UINTN                  NumberOfMatches;
+  UINTN                  *Matches;
+  UINTN                  NumberOfChords;
+  KEY_MAP_COMPILED_CHORD Chords[1];
+} KEY_MAP_CHORD_SET;
+
 // APPLE_KEY_STROKES_INFO_SIGNATURE
 #define APPLE_KEY_STROKES_INFO_SIGNATURE  SIGNATURE_32 ('K', 'e', 'y', 'S')
 
@@ -435,6 +481,14 @@ InternalRemoveKeyStrokesBuffer (
   if (KeyStrokesInfo != NULL) {
     KeyMapAggregatorData->KeyCodeBufferLength -= KeyStrokesInfo->KeyCodeBufferLength;
 
+    //
+    // Only a buffer holding keys contributes to the aggregated key state.
+    //
+    if ((KeyStrokesInfo->NumberOfKeyCodes != 0)
+     || (KeyStrokesInfo->Modifiers != 0)) {
+      ++KeyMapAggregatorData->KeyStateGeneration;
+    }
+
     RemoveEntryList (&KeyStrokesInfo->Link);
     gBS->FreePool ((VOID *)KeyStrokesInfo);
 
@@ -492,14 +546,28 @@ InternalSetKeyStrokeBufferKeys (
     Status = EFI_OUT_OF_RESOURCES;
 
     if (KeyStrokesInfo->KeyCodeBufferLength >= NumberOfKeyCodes) {
-      KeyStrokesInfo->NumberOfKeyCodes = NumberOfKeyCodes;
-      KeyStrokesInfo->Modifiers        = Modifiers;
-
-      CopyMem (
-        (VOID *)&KeyStrokesInfo->KeyCodes[0],
-        (VOID *)KeyCodes,
-        (NumberOfKeyCodes * sizeof (*KeyCodes))
-        );
+      //
+      // Keyboard drivers report their state on every poll, only a change
+      // invalidates the chord matches evaluated for the current state.
+      //
+      if ((KeyStrokesInfo->NumberOfKeyCodes != NumberOfKeyCodes)
+       || (KeyStrokesInfo->Modifiers != Modifiers)
+       || (CompareMem (
+             (VOID *)&KeyStrokesInfo->KeyCodes[0],
+             (VOID *)KeyCodes,
+             (NumberOfKeyCodes * sizeof (*KeyCodes))
+             ) != 0)) {
+        KeyStrokesInfo->NumberOfKeyCodes = NumberOfKeyCodes;
+        KeyStrokesInfo->Modifiers        = Modifiers;
+
+        CopyMem (
+          (VOID *)&KeyStrokesInfo->KeyCodes[0],
+          (VOID *)KeyCodes,
+          (NumberOfKeyCodes * sizeof (*KeyCodes))
+          );
+
+        ++KeyMapAggregatorData->KeyStateGeneration;
+      }
 
       Status = EFI_SUCCESS;
     }
@@ -508,6 +576,258 @@ InternalSetKeyStrokeBufferKeys (
   return Status;
 }
 
+// InternalCompileChords
+/** Compiles a set of chords into bitmask predicates.
+
+  @param[in]  This            A pointer to the protocol instance.
+  @param[in]  NumberOfChords  The number of chords in Chords.
+  @param[in]  Chords          The chords to compile.
+  @param[out] ChordSet        The compiled chord set.
+
+  @retval EFI_SUCCESS            The chord set has been compiled.
+  @retval EFI_INVALID_PARAMETER  A chord has too many keys.
+  @retval EFI_UNSUPPORTED        Chord keys belong to different HID usage pages.
+  @retval EFI_OUT_OF_RESOURCES   The memory necessary could not be allocated.
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+InternalCompileChords (
+  IN  APPLE_KEY_MAP_CHORD_MATCHER_PROTOCOL  *This,
+  IN  UINTN                                 NumberOfChords,
+  IN  CONST APPLE_KEY_MAP_CHORD             *Chords,
+  OUT APPLE_KEY_MAP_CHORD_SET               *ChordSet
+  )
+{
+  KEY_MAP_CHORD_SET      *CompiledSet;
+  KEY_MAP_COMPILED_CHORD *Compiled;
+  BOOLEAN                HasKeyPage;
+  UINT16                 KeyPage;
+  UINTN                  Index;
+  UINTN                  KeyIndex;
+  UINTN                  KeyId;
+
+  if (Chords == NULL || ChordSet == NULL || NumberOfChords == 0) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  HasKeyPage = FALSE;
+  KeyPage    = 0;
+
+  for (Index = 0; Index < NumberOfChords; ++Index) {
+    if (Chords[Index].NumberOfKeyCodes > APPLE_KEY_MAP_CHORD_MAX_KEYS) {
+      return EFI_INVALID_PARAMETER;
+    }
+
+    for (KeyIndex = 0; KeyIndex < Chords[Index].NumberOfKeyCodes; ++KeyIndex) {
+      if (!HasKeyPage) {
+        KeyPage    = KEY_MAP_KEY_PAGE (Chords[Index].KeyCodes[KeyIndex]);
+        HasKeyPage = TRUE;
+      } else if (KeyPage != KEY_MAP_KEY_PAGE (Chords[Index].KeyCodes[KeyIndex])) {
+        return EFI_UNSUPPORTED;
+      }
+    }
+  }
+
+  CompiledSet = AllocateZeroPool (
+                  SIZE_OF_KEY_MAP_CHORD_SET
+                    + (NumberOfChords * sizeof (*Compiled))
+                  );
+
+  if (CompiledSet == NULL) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  CompiledSet->Matches = AllocatePool (NumberOfChords * sizeof (*CompiledSet->Matches));
+
+  if (CompiledSet->Matches == NULL) {
+    gBS->FreePool ((VOID *)CompiledSet);
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  CompiledSet->Signature      = KEY_MAP_CHORD_SET_SIGNATURE;
+  CompiledSet->KeyPage        = KeyPage;
+  CompiledSet->NumberOfChords = NumberOfChords;
+
+  //
+  // Force evaluation on the first match request.
+  //
+  CompiledSet->Generation = KEY_MAP_AGGREGATOR_DATA_FROM_CHORD_MATCHER_THIS (This)->KeyStateGeneration - 1;
+
+  for (Index = 0; Index < NumberOfChords; ++Index) {
+    Compiled             = &CompiledSet->Chords[Index];
+    Compiled->ChordId    = Chords[Index].ChordId;
+    Compiled->Modifiers  = Chords[Index].Modifiers;
+    Compiled->ExactMatch = Chords[Index].ExactMatch;
+
+    for (KeyIndex = 0; KeyIndex < Chords[Index].NumberOfKeyCodes; ++KeyIndex) {
+      KeyId = KEY_MAP_KEY_ID (Chords[Index].KeyCodes[KeyIndex]);
+      Compiled->KeyMask[KeyId / 64] |= LShiftU64 (1, KeyId % 64);
+    }
+  }
+
+  *ChordSet = (APPLE_KEY_MAP_CHORD_SET)CompiledSet;
+
+  return EFI_SUCCESS;
+}
+
+// InternalMatchChords
+/** Returns ids of all chords of ChordSet matching currently pressed keys.
+    Chords are only evaluated again when the aggregated key state changed.
+
+  @param[in]      This              A pointer to the protocol instance.
+  @param[in]      ChordSet          The compiled chord set.
+  @param[in, out] NumberOfChordIds  On input the number of ids ChordIds holds.
+                                    On output the number of matched chords.
+  @param[out]     ChordIds          The matched chord ids in chord set order.
+
+  @retval EFI_SUCCESS           At least one chord matched.
+  @retval EFI_NOT_FOUND         No chord matched.
+  @retval EFI_BUFFER_TOO_SMALL  ChordIds is too small, the required number of
+                                ids has been returned in NumberOfChordIds.
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+InternalMatchChords (
+  IN     APPLE_KEY_MAP_CHORD_MATCHER_PROTOCOL  *This,
+  IN     APPLE_KEY_MAP_CHORD_SET               ChordSet,
+  IN OUT UINTN                                 *NumberOfChordIds,
+  OUT    UINTN                                 *ChordIds OPTIONAL
+  )
+{
+  KEY_MAP_AGGREGATOR_DATA *KeyMapAggregatorData;
+  KEY_MAP_CHORD_SET       *CompiledSet;
+  KEY_MAP_COMPILED_CHORD  *Compiled;
+  LIST_ENTRY              *Entry;
+  APPLE_KEY_STROKES_INFO  *KeyStrokesInfo;
+  APPLE_MODIFIER_MAP      DbModifiers;
+  UINT64                  DbKeyMask[KEY_MAP_KEY_MASK_WORDS];
+  BOOLEAN                 DbOtherKeys;
+  UINTN                   Index;
+  UINTN                   Word;
+  UINTN                   KeyId;
+  BOOLEAN                 Matched;
+
+  KeyMapAggregatorData = KEY_MAP_AGGREGATOR_DATA_FROM_CHORD_MATCHER_THIS (This);
+  CompiledSet          = (KEY_MAP_CHORD_SET *)ChordSet;
+
+  if (CompiledSet == NULL
+   || CompiledSet->Signature != KEY_MAP_CHORD_SET_SIGNATURE
+   || NumberOfChordIds == NULL) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  if (CompiledSet->Generation != KeyMapAggregatorData->KeyStateGeneration) {
+    //
+    // Collect aggregated key state once for all chords.
+    //
+    DbModifiers = 0;
+    DbOtherKeys = FALSE;
+    ZeroMem (DbKeyMask, sizeof (DbKeyMask));
+
+    for (
+      Entry = GetFirstNode (&KeyMapAggregatorData->KeyStrokesInfoList);
+      !IsNull (&KeyMapAggregatorData->KeyStrokesInfoList, Entry);
+      Entry = GetNextNode (&KeyMapAggregatorData->KeyStrokesInfoList, Entry)
+      ) {
+      KeyStrokesInfo = APPLE_KEY_STROKES_INFO_FROM_LIST_ENTRY (Entry);
+
+      DbModifiers |= KeyStrokesInfo->Modifiers;
+
+      for (Index = 0; Index < KeyStrokesInfo->NumberOfKeyCodes; ++Index) {
+        if (KEY_MAP_KEY_PAGE (KeyStrokesInfo->KeyCodes[Index]) != CompiledSet->KeyPage) {
+          DbOtherKeys = TRUE;
+          continue;
+        }
+
+        KeyId = KEY_MAP_KEY_ID (KeyStrokesInfo->KeyCodes[Index]);
+        DbKeyMask[KeyId / 64] |= LShiftU64 (1, KeyId % 64);
+      }
+    }
+
+    CompiledSet->NumberOfMatches = 0;
+
+    for (Index = 0; Index < CompiledSet->NumberOfChords; ++Index) {
+      Compiled = &CompiledSet->Chords[Index];
+
+      if (Compiled->ExactMatch) {
+        Matched = (BOOLEAN)(!DbOtherKeys && DbModifiers == Compiled->Modifiers);
+
+        for (Word = 0; Matched && Word < KEY_MAP_KEY_MASK_WORDS; ++Word) {
+          Matched = (BOOLEAN)(DbKeyMask[Word] == Compiled->KeyMask[Word]);
+        }
+      } else {
+        Matched = (BOOLEAN)((DbModifiers & Compiled->Modifiers) == Compiled->Modifiers);
+
+        for (Word = 0; Matched && Word < KEY_MAP_KEY_MASK_WORDS; ++Word) {
+          Matched = (BOOLEAN)((DbKeyMask[Word] & Compiled->KeyMask[Word]) == Compiled->KeyMask[Word]);
+        }
+      }
+
+      if (Matched) {
+        CompiledSet->Matches[CompiledSet->NumberOfMatches] = Compiled->ChordId;
+        ++CompiledSet->NumberOfMatches;
+      }
+    }
+
+    CompiledSet->Generation = KeyMapAggregatorData->KeyStateGeneration;
+  }
+
+  if (CompiledSet->NumberOfMatches > *NumberOfChordIds) {
+    *NumberOfChordIds = CompiledSet->NumberOfMatches;
+    return EFI_BUFFER_TOO_SMALL;
+  }
+
+  *NumberOfChordIds = CompiledSet->NumberOfMatches;
+
+  if (CompiledSet->NumberOfMatches == 0) {
+    return EFI_NOT_FOUND;
+  }
+
+  if (ChordIds != NULL) {
+    CopyMem (
+      (VOID *)ChordIds,
+      (VOID *)CompiledSet->Matches,
+      (CompiledSet->NumberOfMatches * sizeof (*ChordIds))
+      );
+  }
+
+  return EFI_SUCCESS;
+}
+
+// InternalFreeChords
+/** Frees a compiled chord set.
+
+  @param[in] This      A pointer to the protocol instance.
+  @param[in] ChordSet  The compiled chord set.
+
+  @retval EFI_SUCCESS  The chord set has been freed.
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+InternalFreeChords (
+  IN APPLE_KEY_MAP_CHORD_MATCHER_PROTOCOL  *This,
+  IN APPLE_KEY_MAP_CHORD_SET               ChordSet
+  )
+{
+  KEY_MAP_CHORD_SET *CompiledSet;
+
+  CompiledSet = (KEY_MAP_CHORD_SET *)ChordSet;
+
+  if (CompiledSet == NULL
+   || CompiledSet->Signature != KEY_MAP_CHORD_SET_SIGNATURE) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  CompiledSet->Signature = 0;
+  gBS->FreePool ((VOID *)CompiledSet->Matches);
+  gBS->FreePool ((VOID *)CompiledSet);
+
+  return EFI_SUCCESS;
+}
+
 
 /**
   InitializeAppleKeyMapAggregator
@@ -564,6 +884,11 @@ InitializeAppleKeyMapAggregator (
     KeyMapAggregatorData->Aggregator.GetKeyStrokes      = InternalGetKeyStrokes;
     KeyMapAggregatorData->Aggregator.ContainsKeyStrokes = InternalContainsKeyStrokes;
 
+    KeyMapAggregatorData->ChordMatcher.Revision      = APPLE_KEY_MAP_CHORD_MATCHER_PROTOCOL_REVISION;
+    KeyMapAggregatorData->ChordMatcher.CompileChords = InternalCompileChords;
+    KeyMapAggregatorData->ChordMatcher.MatchChords   = InternalMatchChords;
+    KeyMapAggregatorData->ChordMatcher.FreeChords    = InternalFreeChords;
+
     InitializeListHead (&KeyMapAggregatorData->KeyStrokesInfoList);
 
     Status = gBS->InstallMultipleProtocolInterfaces (
@@ -572,6 +897,8 @@ InitializeAppleKeyMapAggregator (
       (VOID *)&KeyMapAggregatorData->Database,
       &gAppleKeyMapAggregatorProtocolGuid,
       (VOID *)&KeyMapAggregatorData->Aggregator,
+      &gAppleKeyMapChordMatcherProtocolGuid,
+      (VOID *)&KeyMapAggregatorData->ChordMatcher,
       NULL
       );
 
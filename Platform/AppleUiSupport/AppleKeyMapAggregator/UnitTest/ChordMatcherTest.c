@@ -0,0 +1,360 @@
+/** @file
+
+AppleKeyMapAggregator chord matcher host test.
+Compares MatchChords against a plain evaluation of every chord over a
+sequence of key state changes and checks CompileChords argument checks.
+
+Copyright (c) 2018, savvas
+
+All rights reserved.
+
+This program and the accompanying materials
+are licensed and made available under the terms and conditions of the BSD License
+which accompanies this distribution.  The full text of the license may be found at
+http://opensource.org/licenses/bsd-license.php
+
+THE PROGRAM IS DISTRIBUTED UNDER THE BSD LICENSE ON AN "AS IS" BASIS,
+WITHOUT WARRANTIES OR REPRESENTATIONS OF ANY KIND, EITHER EXPRESS OR IMPLIED.
+
+**/
+
+#include <AppleMacEfi.h>
+#include <Protocol/AppleKeyMapAggregator.h>
+#include <Protocol/AppleKeyMapDatabase.h>
+#include <Protocol/AppleKeyMapChordMatcher.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/UefiBootServicesTableLib.h>
+#include <AppleUiSupport.h>
+#include "HostLib.h"
+
+//
+// Keyboard usage page keys and modifiers used by the chords
+//
+#define TEST_KEY(Usage)       ((APPLE_KEY_CODE) (0x7000U | (Usage)))
+#define TEST_KEY_C            TEST_KEY (0x06U)
+#define TEST_KEY_P            TEST_KEY (0x13U)
+#define TEST_KEY_R            TEST_KEY (0x15U)
+#define TEST_KEY_V            TEST_KEY (0x19U)
+#define TEST_KEY_VOLUME_UP    ((APPLE_KEY_CODE) 0xC0E9U)
+
+#define TEST_MODIFIER_SHIFT   ((APPLE_MODIFIER_MAP) BIT1)
+#define TEST_MODIFIER_OPTION  ((APPLE_MODIFIER_MAP) BIT2)
+#define TEST_MODIFIER_COMMAND ((APPLE_MODIFIER_MAP) BIT3)
+
+#define TEST_NUMBER_OF_BUFFERS  2
+#define TEST_BUFFER_LENGTH      4
+#define TEST_NUMBER_OF_STEPS    2000
+
+STATIC CONST APPLE_KEY_CODE mTestKeys[] = {
+  TEST_KEY_C, TEST_KEY_P, TEST_KEY_R, TEST_KEY_V, TEST_KEY_VOLUME_UP
+};
+
+STATIC CONST APPLE_MODIFIER_MAP mTestModifiers[] = {
+  TEST_MODIFIER_SHIFT, TEST_MODIFIER_OPTION, TEST_MODIFIER_COMMAND
+};
+
+STATIC CONST APPLE_KEY_MAP_CHORD mTestChords[] = {
+  { 1, TEST_MODIFIER_COMMAND,                        1, { TEST_KEY_R },             FALSE },
+  { 2, TEST_MODIFIER_COMMAND | TEST_MODIFIER_OPTION, 2, { TEST_KEY_P, TEST_KEY_R }, FALSE },
+  { 3, 0,                                            1, { TEST_KEY_C },             TRUE  },
+  { 4, TEST_MODIFIER_OPTION,                         0, { 0 },                      FALSE },
+  { 5, TEST_MODIFIER_SHIFT,                          0, { 0 },                      TRUE  },
+  { 6, 0,                                            2, { TEST_KEY_V, TEST_KEY_V }, FALSE }
+};
+
+//
+// Key state of each key strokes buffer as the test set it
+//
+typedef struct {
+  UINTN               Index;
+  BOOLEAN             Present;
+  APPLE_MODIFIER_MAP  Modifiers;
+  UINTN               NumberOfKeyCodes;
+  APPLE_KEY_CODE      KeyCodes[TEST_BUFFER_LENGTH];
+} TEST_BUFFER;
+
+STATIC APPLE_KEY_MAP_DATABASE_PROTOCOL       *mDatabase;
+STATIC APPLE_KEY_MAP_CHORD_MATCHER_PROTOCOL  *mChordMatcher;
+STATIC TEST_BUFFER                           mBuffers[TEST_NUMBER_OF_BUFFERS];
+STATIC UINT32                                mSeed = 1;
+
+STATIC
+UINT32
+TestRandom (
+  VOID
+  )
+{
+  mSeed = mSeed * 1103515245U + 12345U;
+  return mSeed >> 16U;
+}
+
+STATIC
+BOOLEAN
+TestKeyPressed (
+  IN APPLE_KEY_CODE  KeyCode
+  )
+{
+  UINTN  Buffer;
+  UINTN  Index;
+
+  for (Buffer = 0; Buffer < TEST_NUMBER_OF_BUFFERS; ++Buffer) {
+    if (!mBuffers[Buffer].Present) {
+      continue;
+    }
+
+    for (Index = 0; Index < mBuffers[Buffer].NumberOfKeyCodes; ++Index) {
+      if (mBuffers[Buffer].KeyCodes[Index] == KeyCode) {
+        return TRUE;
+      }
+    }
+  }
+
+  return FALSE;
+}
+
+STATIC
+BOOLEAN
+TestChordKey (
+  IN CONST APPLE_KEY_MAP_CHORD  *Chord,
+  IN APPLE_KEY_CODE             KeyCode
+  )
+{
+  UINTN  Index;
+
+  for (Index = 0; Index < Chord->NumberOfKeyCodes; ++Index) {
+    if (Chord->KeyCodes[Index] == KeyCode) {
+      return TRUE;
+    }
+  }
+
+  return FALSE;
+}
+
+//
+// Evaluates a chord against the key state kept by the test
+//
+STATIC
+BOOLEAN
+TestChordMatches (
+  IN CONST APPLE_KEY_MAP_CHORD  *Chord
+  )
+{
+  APPLE_MODIFIER_MAP  Modifiers;
+  UINTN               Buffer;
+  UINTN               Index;
+
+  Modifiers = 0;
+  for (Buffer = 0; Buffer < TEST_NUMBER_OF_BUFFERS; ++Buffer) {
+    if (mBuffers[Buffer].Present) {
+      Modifiers |= mBuffers[Buffer].Modifiers;
+    }
+  }
+
+  for (Index = 0; Index < Chord->NumberOfKeyCodes; ++Index) {
+    if (!TestKeyPressed (Chord->KeyCodes[Index])) {
+      return FALSE;
+    }
+  }
+
+  if (!Chord->ExactMatch) {
+    return (Modifiers & Chord->Modifiers) == Chord->Modifiers;
+  }
+
+  if (Modifiers != Chord->Modifiers) {
+    return FALSE;
+  }
+
+  for (Index = 0; Index < ARRAY_SIZE (mTestKeys); ++Index) {
+    if (TestKeyPressed (mTestKeys[Index]) && !TestChordKey (Chord, mTestKeys[Index])) {
+      return FALSE;
+    }
+  }
+
+  return TRUE;
+}
+
+STATIC
+BOOLEAN
+TestCheckMatches (
+  IN APPLE_KEY_MAP_CHORD_SET  ChordSet,
+  IN UINTN                    Step
+  )
+{
+  EFI_STATUS  Status;
+  UINTN       Expected[ARRAY_SIZE (mTestChords)];
+  UINTN       NumberOfExpected;
+  UINTN       ChordIds[ARRAY_SIZE (mTestChords)];
+  UINTN       NumberOfChordIds;
+  UINTN       Index;
+
+  NumberOfExpected = 0;
+  for (Index = 0; Index < ARRAY_SIZE (mTestChords); ++Index) {
+    if (TestChordMatches (&mTestChords[Index])) {
+      Expected[NumberOfExpected] = mTestChords[Index].ChordId;
+      ++NumberOfExpected;
+    }
+  }
+
+  NumberOfChordIds = ARRAY_SIZE (ChordIds);
+  Status = mChordMatcher->MatchChords (mChordMatcher, ChordSet, &NumberOfChordIds, ChordIds);
+  if (Status != (NumberOfExpected > 0 ? EFI_SUCCESS : EFI_NOT_FOUND)
+   || NumberOfChordIds != NumberOfExpected
+   || CompareMem (ChordIds, Expected, NumberOfExpected * sizeof (*Expected)) != 0) {
+    HostPrint (
+      "Step %llu: %llu chords matched, %llu expected\n",
+      (unsigned long long) Step,
+      (unsigned long long) NumberOfChordIds,
+      (unsigned long long) NumberOfExpected
+      );
+    return FALSE;
+  }
+
+  //
+  // A too small buffer reports the number of matches without evaluating again
+  //
+  if (NumberOfExpected > 0) {
+    NumberOfChordIds = NumberOfExpected - 1;
+    Status = mChordMatcher->MatchChords (mChordMatcher, ChordSet, &NumberOfChordIds, ChordIds);
+    if (Status != EFI_BUFFER_TOO_SMALL || NumberOfChordIds != NumberOfExpected) {
+      HostPrint ("Step %llu: buffer too small not reported\n", (unsigned long long) Step);
+      return FALSE;
+    }
+  }
+
+  return TRUE;
+}
+
+//
+// Changes one buffer: new keys, the same keys again, or removal and recreation
+//
+STATIC
+BOOLEAN
+TestChangeKeyState (
+  VOID
+  )
+{
+  EFI_STATUS   Status;
+  TEST_BUFFER  *Buffer;
+  UINTN        Action;
+  UINTN        Index;
+
+  Buffer = &mBuffers[TestRandom () % TEST_NUMBER_OF_BUFFERS];
+  Action = TestRandom () % 8;
+
+  if (!Buffer->Present) {
+    Status = mDatabase->CreateKeyStrokesBuffer (mDatabase, TEST_BUFFER_LENGTH, &Buffer->Index);
+    Buffer->Present          = !EFI_ERROR (Status);
+    Buffer->Modifiers        = 0;
+    Buffer->NumberOfKeyCodes = 0;
+    return Buffer->Present;
+  }
+
+  if (Action == 0) {
+    Status = mDatabase->RemoveKeyStrokesBuffer (mDatabase, Buffer->Index);
+    Buffer->Present = FALSE;
+    return !EFI_ERROR (Status);
+  }
+
+  if (Action > 2) {
+    Buffer->Modifiers = 0;
+    for (Index = 0; Index < ARRAY_SIZE (mTestModifiers); ++Index) {
+      if (TestRandom () % 3 == 0) {
+        Buffer->Modifiers |= mTestModifiers[Index];
+      }
+    }
+
+    Buffer->NumberOfKeyCodes = TestRandom () % (TEST_BUFFER_LENGTH + 1);
+    for (Index = 0; Index < Buffer->NumberOfKeyCodes; ++Index) {
+      Buffer->KeyCodes[Index] = mTestKeys[TestRandom () % ARRAY_SIZE (mTestKeys)];
+    }
+  }
+
+  Status = mDatabase->SetKeyStrokeBufferKeys (
+    mDatabase,
+    Buffer->Index,
+    Buffer->Modifiers,
+    Buffer->NumberOfKeyCodes,
+    Buffer->KeyCodes
+    );
+
+  return !EFI_ERROR (Status);
+}
+
+STATIC
+BOOLEAN
+TestCompileErrors (
+  VOID
+  )
+{
+  EFI_STATUS               Status;
+  APPLE_KEY_MAP_CHORD      Chord;
+  APPLE_KEY_MAP_CHORD_SET  ChordSet;
+
+  ZeroMem (&Chord, sizeof (Chord));
+  Chord.NumberOfKeyCodes = APPLE_KEY_MAP_CHORD_MAX_KEYS + 1;
+  Status = mChordMatcher->CompileChords (mChordMatcher, 1, &Chord, &ChordSet);
+  if (Status != EFI_INVALID_PARAMETER) {
+    HostPrint ("Chord with too many keys compiled - %llx\n", (unsigned long long) Status);
+    return FALSE;
+  }
+
+  Chord.NumberOfKeyCodes = 2;
+  Chord.KeyCodes[0]      = TEST_KEY_R;
+  Chord.KeyCodes[1]      = TEST_KEY_VOLUME_UP;
+  Status = mChordMatcher->CompileChords (mChordMatcher, 1, &Chord, &ChordSet);
+  if (Status != EFI_UNSUPPORTED) {
+    HostPrint ("Chord with keys of two usage pages compiled - %llx\n", (unsigned long long) Status);
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+int
+main (
+  int   argc,
+  char  *argv[]
+  )
+{
+  EFI_STATUS               Status;
+  APPLE_KEY_MAP_CHORD_SET  ChordSet;
+  UINTN                    Step;
+
+  InitializeAppleKeyMapAggregator (gImageHandle, gST);
+
+  if (EFI_ERROR (gBS->LocateProtocol (&gAppleKeyMapDatabaseProtocolGuid, NULL, (VOID **) &mDatabase))
+   || EFI_ERROR (gBS->LocateProtocol (&gAppleKeyMapChordMatcherProtocolGuid, NULL, (VOID **) &mChordMatcher))) {
+    HostPrint ("AppleKeyMapAggregator failed to install\n");
+    return 1;
+  }
+
+  if (!TestCompileErrors ()) {
+    return 1;
+  }
+
+  Status = mChordMatcher->CompileChords (mChordMatcher, ARRAY_SIZE (mTestChords), mTestChords, &ChordSet);
+  if (EFI_ERROR (Status)) {
+    HostPrint ("CompileChords failure - %llx\n", (unsigned long long) Status);
+    return 1;
+  }
+
+  if (!TestCheckMatches (ChordSet, 0)) {
+    return 1;
+  }
+
+  for (Step = 1; Step <= TEST_NUMBER_OF_STEPS; ++Step) {
+    if (!TestChangeKeyState ()) {
+      HostPrint ("Step %llu: key state change failure\n", (unsigned long long) Step);
+      return 1;
+    }
+
+    if (!TestCheckMatches (ChordSet, Step)) {
+      return 1;
+    }
+  }
+
+  mChordMatcher->FreeChords (mChordMatcher, ChordSet);
+
+  HostPrint ("ChordMatcherTest: %u steps passed\n", TEST_NUMBER_OF_STEPS);
+  return 0;
+}
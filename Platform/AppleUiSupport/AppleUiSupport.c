@@ -32,6 +32,8 @@ AppleUiSupportEntrypoint (
 )
 {
   EFI_STATUS            Status;
+  EFI_STATUS            TraceStatus;
+  UINT32                Installed;
 
   DEBUG ((
     DEBUG_VERBOSE, 
@@ -39,8 +41,12 @@ AppleUiSupportEntrypoint (
     APPLE_SUPPORT_VERSION
     ));
 
+  Installed = 0;
+
   Status = InitializeAppleImageCodec (ImageHandle, SystemTable);
-  if (EFI_ERROR(Status)) {
+  if (Status == EFI_SUCCESS) {
+    Installed |= UI_TRACE_IMAGE_CODEC;
+  } else {
     DEBUG ((DEBUG_VERBOSE, "AppleUiSupport: AppleImageCodec install failure, Status = %r\n", Status));
   }
 
@@ -50,17 +56,23 @@ AppleUiSupportEntrypoint (
   }
 
   Status = InitializeUnicodeCollationEng (ImageHandle, SystemTable);
-  if (EFI_ERROR (Status)) {
+  if (Status == EFI_SUCCESS) {
+    Installed |= UI_TRACE_COLLATION;
+  } else {
     DEBUG ((DEBUG_VERBOSE, "AppleUiSupport: UnicodeCollation install failure - %r\n", Status));
   }
 
   Status = InitializeHashServices (ImageHandle, SystemTable);
-  if (EFI_ERROR (Status)) {
+  if (Status == EFI_SUCCESS) {
+    Installed |= UI_TRACE_HASH;
+  } else {
     DEBUG ((DEBUG_VERBOSE, "AppleUiSupport: HashServices install failure - %r\n", Status));
   }
 
   Status = InitializeAppleKeyMapAggregator (ImageHandle, SystemTable);
-  if (EFI_ERROR (Status)) {
+  if (Status == EFI_SUCCESS) {
+    Installed |= UI_TRACE_KEY_MAP;
+  } else {
     DEBUG ((DEBUG_VERBOSE, "AppleUiSupport: AppleKeyMapAggregator install failure - %r\n", Status));
   }
 
@@ -70,9 +82,19 @@ AppleUiSupportEntrypoint (
   }
 
   Status = InitializeFirmwareVolumeInject (ImageHandle, SystemTable);
-  if (EFI_ERROR (Status)) {
+  if (Status == EFI_SUCCESS) {
+    Installed |= UI_TRACE_FV;
+  } else {
     DEBUG ((DEBUG_VERBOSE, "AppleUiSupport: AppleFirmwareVolume install failure - %r\n", Status));
   }
 
+  //
+  // Recording wraps the protocols installed above and must not fail the driver
+  //
+  TraceStatus = InitializeUiTrace (ImageHandle, SystemTable, Installed);
+  if (EFI_ERROR (TraceStatus)) {
+    DEBUG ((DEBUG_VERBOSE, "AppleUiSupport: UiTrace start failure - %r\n", TraceStatus));
+  }
+
   return Status;
 }
\ No newline at end of file
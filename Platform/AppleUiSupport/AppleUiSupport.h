@@ -70,4 +70,44 @@ InitializeAppleKeyMapAggregator (
   IN EFI_SYSTEM_TABLE  *SystemTable
   );
 
+//
+// Protocols installed by this driver, only these are recorded
+//
+#define UI_TRACE_IMAGE_CODEC  BIT0
+#define UI_TRACE_KEY_MAP      BIT1
+#define UI_TRACE_HASH         BIT2
+#define UI_TRACE_COLLATION    BIT3
+#define UI_TRACE_FV           BIT4
+
+EFI_STATUS
+EFIAPI
+InitializeUiTrace (
+  IN EFI_HANDLE        ImageHandle,
+  IN EFI_SYSTEM_TABLE  *SystemTable,
+  IN UINT32            Installed
+  );
+
+//
+// Collation and Firmware Volume calls are recorded from inside
+// the implementations and wrappers of this driver
+//
+VOID
+EFIAPI
+UiTraceCollation (
+  IN UINT16      Function,
+  IN CONST VOID  *Argument1,
+  IN CONST VOID  *Argument2  OPTIONAL,
+  IN UINTN       FatSize
+  );
+
+VOID
+EFIAPI
+UiTraceReadSection (
+  IN CONST EFI_GUID  *NameGuid,
+  IN UINT8           SectionType,
+  IN UINTN           SectionInstance,
+  IN CONST VOID      *Buffer  OPTIONAL,
+  IN UINTN           BufferSize
+  );
+
 #endif //APPLE_UI_SUPPORT_H
@@ -29,6 +29,7 @@ WITHOUT WARRANTIES OR REPRESENTATIONS OF ANY KIND, EITHER EXPRESS OR IMPLIED.
 #include <Protocol/FirmwareVolume.h>
 #include <Protocol/FirmwareVolume2.h>
 #include "FirmwareVolumeInject.h"
+#include "../AppleUiSupport.h"
 
 //
 // Original functions from FirmwareVolume protocol
@@ -138,6 +139,8 @@ ReadSectionEx (
     return EFI_INVALID_PARAMETER;
   }
 
+  UiTraceReadSection (NameGuid, SectionType, SectionInstance, *Buffer, *BufferSize);
+
   if (CompareGuid (NameGuid, &gAppleArrowCursorImageGuid)) {
     *BufferSize = sizeof (mAppleArrowCursorImage);
     Status = gBS->AllocatePool (EfiBootServicesData, *BufferSize, (VOID **)Buffer);
@@ -28,6 +28,7 @@ Module Name:
 #include <Library/UefiDriverEntryPoint.h>
 #include <Library/UefiLib.h>
 #include <Library/MemoryAllocationLib.h>
+#include "../AppleUiSupport.h"
 
 #define FIRMWARE_VOLUME_PRIVATE_DATA_SIGNATURE  SIGNATURE_32 ('f', 'v', 't', 'h')
 
@@ -243,6 +244,10 @@ FvReadSection (
   FIRMWARE_VOLUME_PRIVATE_DATA   *Private;
   EFI_FIRMWARE_VOLUME2_PROTOCOL  *FirmwareVolume2;
 
+  if (Buffer != NULL && BufferSize != NULL) {
+    UiTraceReadSection (NameGuid, SectionType, SectionInstance, *Buffer, *BufferSize);
+  }
+
   Private = FIRMWARE_VOLUME_PRIVATE_DATA_FROM_THIS (This);
   FirmwareVolume2 = Private->FirmwareVolume2;
 
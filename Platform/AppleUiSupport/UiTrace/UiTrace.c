@@ -0,0 +1,1089 @@
+/** @file
+
+AppleUiSupport protocol call recorder
+
+Copyright (c) 2018, savvas
+
+All rights reserved.
+
+This program and the accompanying materials
+are licensed and made available under the terms and conditions of the BSD License
+which accompanies this distribution.  The full text of the license may be found at
+http://opensource.org/licenses/bsd-license.php
+
+THE PROGRAM IS DISTRIBUTED UNDER THE BSD LICENSE ON AN "AS IS" BASIS,
+WITHOUT WARRANTIES OR REPRESENTATIONS OF ANY KIND, EITHER EXPRESS OR IMPLIED.
+
+**/
+
+#include <AppleMacEfi.h>
+#include <Guid/AppleUiSupportTrace.h>
+#include <Protocol/AppleKeyMapAggregator.h>
+#include <Protocol/AppleKeyMapDatabase.h>
+#include <Protocol/AppleKeyMapChordMatcher.h>
+#include <Protocol/GraphicsOutput.h>
+#include <Protocol/Hash.h>
+#include <Protocol/LoadedImage.h>
+#include <Protocol/ServiceBinding.h>
+#include <Protocol/SimpleFileSystem.h>
+#include <Protocol/UgaDraw.h>
+#include <Protocol/AppleImageCodecProtocol.h>
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/DebugLib.h>
+#include <Library/MemoryAllocationLib.h>
+#include <Library/UefiBootServicesTableLib.h>
+#include <Library/UefiLib.h>
+#include <Library/UefiRuntimeServicesTableLib.h>
+#include "../HashServices/sha256.h"
+#include "../AppleUiSupport.h"
+
+//
+// Pending records are written out once they reach this size
+// or by the periodic flush timer, whichever comes first
+//
+#define UI_TRACE_FLUSH_THRESHOLD  SIZE_64KB
+#define UI_TRACE_FLUSH_PERIOD     EFI_TIMER_PERIOD_SECONDS (1)
+
+//
+// Calls are dropped and counted once this much is pending
+//
+#define UI_TRACE_MAX_PENDING      SIZE_16MB
+
+//
+// Digests of blobs already written, later blobs are written on every use
+//
+#define UI_TRACE_MAX_BLOBS        256
+
+STATIC EFI_FILE_PROTOCOL  *mTraceFile          = NULL;
+STATIC UINT8              *mTraceBuffer        = NULL;
+STATIC UINTN              mTraceBufferSize     = 0;
+STATIC UINTN              mTraceBufferUsed     = 0;
+STATIC UINT32             mTraceDropped        = 0;
+STATIC BOOLEAN            mTraceFlushing       = FALSE;
+STATIC UINTN              mTraceNumberOfBlobs  = 0;
+STATIC UINT8              mTraceBlobs[UI_TRACE_MAX_BLOBS][APPLE_UI_SUPPORT_TRACE_DIGEST_SIZE];
+
+//
+// Original functions of the recorded protocols
+//
+STATIC APPLE_IMAGE_CODEC_PROTOCOL            mOriginalImageCodec;
+STATIC APPLE_KEY_MAP_DATABASE_PROTOCOL       mOriginalKeyMapDatabase;
+STATIC APPLE_KEY_MAP_AGGREGATOR_PROTOCOL     mOriginalKeyMapAggregator;
+STATIC APPLE_KEY_MAP_CHORD_MATCHER_PROTOCOL  mOriginalChordMatcher;
+STATIC EFI_SERVICE_BINDING_PROTOCOL          mOriginalHashServiceBinding;
+STATIC EFI_HASH_PROTOCOL                     mOriginalHash;
+STATIC BOOLEAN                               mOriginalHashValid = FALSE;
+
+//
+// Writes pending records to the trace file.
+// Must be called at TPL_CALLBACK or below.
+//
+STATIC
+VOID
+UiTraceFlush (
+  VOID
+  )
+{
+  EFI_STATUS  Status;
+  EFI_TPL     OldTpl;
+  UINTN       Size;
+
+  OldTpl = gBS->RaiseTPL (TPL_NOTIFY);
+  if (mTraceFlushing || mTraceFile == NULL || mTraceBufferUsed == 0) {
+    gBS->RestoreTPL (OldTpl);
+    return;
+  }
+  //
+  // Calls made while the file is written are not recorded, most of them
+  // come from the file system driver itself
+  //
+  mTraceFlushing = TRUE;
+  gBS->RestoreTPL (OldTpl);
+
+  Size   = mTraceBufferUsed;
+  Status = mTraceFile->Write (mTraceFile, &Size, mTraceBuffer);
+  if (!EFI_ERROR (Status)) {
+    Status = mTraceFile->Flush (mTraceFile);
+  }
+
+  if (EFI_ERROR (Status)) {
+    DEBUG ((DEBUG_VERBOSE, "AppleUiSupport: Trace write failure, recording stopped - %r\n", Status));
+    mTraceFile->Close (mTraceFile);
+    mTraceFile = NULL;
+  }
+
+  mTraceBufferUsed = 0;
+  mTraceFlushing   = FALSE;
+}
+
+STATIC
+VOID
+EFIAPI
+UiTraceFlushNotify (
+  IN EFI_EVENT  Event,
+  IN VOID       *Context
+  )
+{
+  UiTraceFlush ();
+}
+
+//
+// No file I/O, event or memory services may be used at ExitBootServices,
+// so recording just stops and records pending since the last periodic
+// flush are dropped. The file stays as the flush timer last wrote it.
+//
+STATIC
+VOID
+EFIAPI
+UiTraceExitBootServicesNotify (
+  IN EFI_EVENT  Event,
+  IN VOID       *Context
+  )
+{
+  mTraceFile       = NULL;
+  mTraceBufferUsed = 0;
+}
+
+//
+// Appends a record to the pending buffer, the caller raised TPL
+//
+STATIC
+BOOLEAN
+UiTraceAppend (
+  IN UINT16      Type,
+  IN UINT16      Function,
+  IN CONST VOID  *Payload,
+  IN UINTN       PayloadSize,
+  IN CONST VOID  *Data  OPTIONAL,
+  IN UINTN       DataSize
+  )
+{
+  APPLE_UI_SUPPORT_TRACE_RECORD  Record;
+  UINTN                          Size;
+  UINTN                          NewSize;
+  UINT8                          *NewBuffer;
+
+  Size = sizeof (Record) + PayloadSize + DataSize;
+  if (Size > UI_TRACE_MAX_PENDING - mTraceBufferUsed) {
+    return FALSE;
+  }
+
+  if (mTraceBufferUsed + Size > mTraceBufferSize) {
+    NewSize = MAX (mTraceBufferSize * 2, UI_TRACE_FLUSH_THRESHOLD);
+    NewSize = MAX (NewSize, mTraceBufferUsed + Size);
+    NewSize = MIN (NewSize, UI_TRACE_MAX_PENDING);
+
+    NewBuffer = ReallocatePool (mTraceBufferUsed, NewSize, mTraceBuffer);
+    if (NewBuffer == NULL) {
+      return FALSE;
+    }
+
+    mTraceBuffer     = NewBuffer;
+    mTraceBufferSize = NewSize;
+  }
+
+  Record.Type     = Type;
+  Record.Function = Function;
+  Record.Size     = (UINT32) (PayloadSize + DataSize);
+
+  CopyMem (mTraceBuffer + mTraceBufferUsed, &Record, sizeof (Record));
+  mTraceBufferUsed += sizeof (Record);
+  CopyMem (mTraceBuffer + mTraceBufferUsed, Payload, PayloadSize);
+  mTraceBufferUsed += PayloadSize;
+  if (DataSize > 0) {
+    CopyMem (mTraceBuffer + mTraceBufferUsed, Data, DataSize);
+    mTraceBufferUsed += DataSize;
+  }
+
+  return TRUE;
+}
+
+//
+// Records a call, returns FALSE when it had to be dropped
+//
+STATIC
+BOOLEAN
+UiTraceWrite (
+  IN UINT16      Type,
+  IN UINT16      Function,
+  IN CONST VOID  *Payload,
+  IN UINTN       PayloadSize,
+  IN CONST VOID  *Data  OPTIONAL,
+  IN UINTN       DataSize
+  )
+{
+  APPLE_UI_SUPPORT_TRACE_DROPPED_DATA  Dropped;
+  EFI_TPL                              OldTpl;
+  BOOLEAN                              Recorded;
+
+  //
+  // Not recording, or recording stopped at ExitBootServices
+  //
+  if (mTraceFile == NULL) {
+    return FALSE;
+  }
+
+  OldTpl = gBS->RaiseTPL (TPL_HIGH_LEVEL);
+  gBS->RestoreTPL (OldTpl);
+
+  if (OldTpl > TPL_NOTIFY) {
+    ++mTraceDropped;
+    return FALSE;
+  }
+
+  OldTpl = gBS->RaiseTPL (TPL_NOTIFY);
+  if (mTraceFlushing || mTraceFile == NULL) {
+    gBS->RestoreTPL (OldTpl);
+    return FALSE;
+  }
+
+  if (mTraceDropped > 0) {
+    Dropped.NumberOfCalls = mTraceDropped;
+    if (UiTraceAppend (APPLE_UI_SUPPORT_TRACE_DROPPED, 0, &Dropped, sizeof (Dropped), NULL, 0)) {
+      mTraceDropped = 0;
+    }
+  }
+
+  Recorded = UiTraceAppend (Type, Function, Payload, PayloadSize, Data, DataSize);
+  if (!Recorded) {
+    ++mTraceDropped;
+  }
+  gBS->RestoreTPL (OldTpl);
+
+  if (OldTpl <= TPL_CALLBACK && mTraceBufferUsed >= UI_TRACE_FLUSH_THRESHOLD) {
+    UiTraceFlush ();
+  }
+
+  return Recorded;
+}
+
+//
+// Computes the digest of a buffer and records the buffer
+// unless the same contents were recorded before
+//
+STATIC
+VOID
+UiTraceBlob (
+  IN  CONST VOID  *Data,
+  IN  UINTN       DataSize,
+  OUT UINT8       *Digest
+  )
+{
+  SHA256_CTX  Context;
+  UINTN       Index;
+
+  sha256_init (&Context);
+  sha256_update (&Context, Data, DataSize);
+  sha256_final (&Context, Digest);
+
+  for (Index = 0; Index < mTraceNumberOfBlobs; ++Index) {
+    if (CompareMem (mTraceBlobs[Index], Digest, APPLE_UI_SUPPORT_TRACE_DIGEST_SIZE) == 0) {
+      return;
+    }
+  }
+
+  if (UiTraceWrite (APPLE_UI_SUPPORT_TRACE_BLOB, 0, Digest, APPLE_UI_SUPPORT_TRACE_DIGEST_SIZE, Data, DataSize)
+    && mTraceNumberOfBlobs < UI_TRACE_MAX_BLOBS) {
+    CopyMem (mTraceBlobs[mTraceNumberOfBlobs], Digest, APPLE_UI_SUPPORT_TRACE_DIGEST_SIZE);
+    ++mTraceNumberOfBlobs;
+  }
+}
+
+STATIC
+VOID
+UiTraceImageCodec (
+  IN UINT16                                Function,
+  IN CONST VOID                            *ImageBuffer,
+  IN UINTN                                 ImageSize,
+  IN UINTN                                 Version,
+  IN EFI_GRAPHICS_OUTPUT_MODE_INFORMATION  *ModeInfo  OPTIONAL
+  )
+{
+  APPLE_UI_SUPPORT_TRACE_IMAGE_CODEC_DATA  Data;
+
+  ZeroMem (&Data, sizeof (Data));
+
+  if (ImageBuffer != NULL && ImageSize > 0) {
+    UiTraceBlob (ImageBuffer, ImageSize, Data.Digest);
+  }
+
+  Data.ImageSize = ImageSize;
+  Data.Version   = Version;
+
+  if (ModeInfo != NULL) {
+    Data.PixelFormat  = (UINT32) ModeInfo->PixelFormat;
+    Data.RedMask      = ModeInfo->PixelInformation.RedMask;
+    Data.GreenMask    = ModeInfo->PixelInformation.GreenMask;
+    Data.BlueMask     = ModeInfo->PixelInformation.BlueMask;
+    Data.ReservedMask = ModeInfo->PixelInformation.ReservedMask;
+  }
+
+  UiTraceWrite (APPLE_UI_SUPPORT_TRACE_IMAGE_CODEC, Function, &Data, sizeof (Data), NULL, 0);
+}
+
+STATIC
+EFI_STATUS
+EFIAPI
+UiTraceRecognizeImageData (
+  VOID   *ImageBuffer,
+  UINTN  ImageSize
+  )
+{
+  UiTraceImageCodec (APPLE_UI_SUPPORT_TRACE_RECOGNIZE_IMAGE_DATA, ImageBuffer, ImageSize, 0, NULL);
+  return mOriginalImageCodec.RecognizeImageData (ImageBuffer, ImageSize);
+}
+
+STATIC
+EFI_STATUS
+EFIAPI
+UiTraceGetImageDims (
+  VOID    *ImageBuffer,
+  UINTN   ImageSize,
+  UINT32  *ImageWidth,
+  UINT32  *ImageHeight
+  )
+{
+  UiTraceImageCodec (APPLE_UI_SUPPORT_TRACE_GET_IMAGE_DIMS, ImageBuffer, ImageSize, 0, NULL);
+  return mOriginalImageCodec.GetImageDims (ImageBuffer, ImageSize, ImageWidth, ImageHeight);
+}
+
+STATIC
+EFI_STATUS
+EFIAPI
+UiTraceDecodeImageData (
+  VOID           *ImageBuffer,
+  UINTN          ImageSize,
+  EFI_UGA_PIXEL  **RawImageData,
+  UINTN          *RawImageDataSize
+  )
+{
+  UiTraceImageCodec (APPLE_UI_SUPPORT_TRACE_DECODE_IMAGE_DATA, ImageBuffer, ImageSize, 0, NULL);
+  return mOriginalImageCodec.DecodeImageData (ImageBuffer, ImageSize, RawImageData, RawImageDataSize);
+}
+
+STATIC
+EFI_STATUS
+EFIAPI
+UiTraceGetImageDimsVer (
+  VOID    *ImageBuffer,
+  UINTN   ImageSize,
+  UINTN   Version,
+  UINT32  *ImageWidth,
+  UINT32  *ImageHeight
+  )
+{
+  UiTraceImageCodec (APPLE_UI_SUPPORT_TRACE_GET_IMAGE_DIMS_VER, ImageBuffer, ImageSize, Version, NULL);
+  return mOriginalImageCodec.GetImageDimsVer (ImageBuffer, ImageSize, Version, ImageWidth, ImageHeight);
+}
+
+STATIC
+EFI_STATUS
+EFIAPI
+UiTraceDecodeImageDataVer (
+  VOID           *ImageBuffer,
+  UINTN          ImageSize,
+  UINTN          Version,
+  EFI_UGA_PIXEL  **RawImageData,
+  UINTN          *RawImageDataSize
+  )
+{
+  EFI_GRAPHICS_OUTPUT_MODE_INFORMATION  *ModeInfo;
+
+  ModeInfo = NULL;
+  if (Version == APPLE_IMAGE_CODEC_DECODE_GOP_VERSION
+    && RawImageData != NULL && *RawImageData != NULL) {
+    ModeInfo = ((APPLE_IMAGE_CODEC_GOP_DECODE_INFO *) *RawImageData)->ModeInfo;
+  }
+
+  UiTraceImageCodec (APPLE_UI_SUPPORT_TRACE_DECODE_IMAGE_DATA_VER, ImageBuffer, ImageSize, Version, ModeInfo);
+  return mOriginalImageCodec.DecodeImageDataVer (ImageBuffer, ImageSize, Version, RawImageData, RawImageDataSize);
+}
+
+STATIC
+VOID
+UiTraceKeyMap (
+  IN UINT16      Function,
+  IN UINT64      Id,
+  IN UINT64      Count,
+  IN UINT16      Modifiers,
+  IN BOOLEAN     ExactMatch,
+  IN CONST VOID  *Data  OPTIONAL,
+  IN UINTN       DataSize
+  )
+{
+  APPLE_UI_SUPPORT_TRACE_KEY_MAP_DATA  KeyMapData;
+
+  ZeroMem (&KeyMapData, sizeof (KeyMapData));
+  KeyMapData.Id         = Id;
+  KeyMapData.Count      = Count;
+  KeyMapData.Modifiers  = Modifiers;
+  KeyMapData.ExactMatch = ExactMatch;
+
+  UiTraceWrite (APPLE_UI_SUPPORT_TRACE_KEY_MAP, Function, &KeyMapData, sizeof (KeyMapData), Data, DataSize);
+}
+
+STATIC
+EFI_STATUS
+EFIAPI
+UiTraceCreateKeyStrokesBuffer (
+  IN  APPLE_KEY_MAP_DATABASE_PROTOCOL  *This,
+  IN  UINTN                            BufferLength,
+  OUT UINTN                            *Index
+  )
+{
+  EFI_STATUS  Status;
+
+  Status = mOriginalKeyMapDatabase.CreateKeyStrokesBuffer (This, BufferLength, Index);
+  if (!EFI_ERROR (Status)) {
+    UiTraceKeyMap (APPLE_UI_SUPPORT_TRACE_CREATE_KEY_STROKES_BUFFER, *Index, BufferLength, 0, FALSE, NULL, 0);
+  }
+
+  return Status;
+}
+
+STATIC
+EFI_STATUS
+EFIAPI
+UiTraceRemoveKeyStrokesBuffer (
+  IN APPLE_KEY_MAP_DATABASE_PROTOCOL  *This,
+  IN UINTN                            Index
+  )
+{
+  UiTraceKeyMap (APPLE_UI_SUPPORT_TRACE_REMOVE_KEY_STROKES_BUFFER, Index, 0, 0, FALSE, NULL, 0);
+  return mOriginalKeyMapDatabase.RemoveKeyStrokesBuffer (This, Index);
+}
+
+STATIC
+EFI_STATUS
+EFIAPI
+UiTraceSetKeyStrokeBufferKeys (
+  IN APPLE_KEY_MAP_DATABASE_PROTOCOL  *This,
+  IN UINTN                            Index,
+  IN APPLE_MODIFIER_MAP               Modifiers,
+  IN UINTN                            NumberOfKeyCodes,
+  IN APPLE_KEY_CODE                   *KeyCodes
+  )
+{
+  //
+  // Pressed keys may be a password, only their number is recorded
+  //
+  UiTraceKeyMap (APPLE_UI_SUPPORT_TRACE_SET_KEY_STROKE_BUFFER_KEYS, Index, NumberOfKeyCodes, Modifiers, FALSE, NULL, 0);
+  return mOriginalKeyMapDatabase.SetKeyStrokeBufferKeys (This, Index, Modifiers, NumberOfKeyCodes, KeyCodes);
+}
+
+STATIC
+EFI_STATUS
+EFIAPI
+UiTraceGetKeyStrokes (
+  IN     APPLE_KEY_MAP_AGGREGATOR_PROTOCOL  *This,
+  OUT    APPLE_MODIFIER_MAP                 *Modifiers,
+  OUT    UINTN                              *NumberOfKeyCodes,
+  IN OUT APPLE_KEY_CODE                     *KeyCodes OPTIONAL
+  )
+{
+  UiTraceKeyMap (
+    APPLE_UI_SUPPORT_TRACE_GET_KEY_STROKES,
+    KeyCodes != NULL,
+    NumberOfKeyCodes != NULL ? *NumberOfKeyCodes : 0,
+    0,
+    FALSE,
+    NULL,
+    0
+    );
+  return mOriginalKeyMapAggregator.GetKeyStrokes (This, Modifiers, NumberOfKeyCodes, KeyCodes);
+}
+
+STATIC
+EFI_STATUS
+EFIAPI
+UiTraceContainsKeyStrokes (
+  IN     APPLE_KEY_MAP_AGGREGATOR_PROTOCOL  *This,
+  IN     APPLE_MODIFIER_MAP                 Modifiers,
+  IN     UINTN                              NumberOfKeyCodes,
+  IN OUT APPLE_KEY_CODE                     *KeyCodes,
+  IN     BOOLEAN                            ExactMatch
+  )
+{
+  //
+  // Key codes are recorded before they get sorted by the call
+  //
+  UiTraceKeyMap (
+    APPLE_UI_SUPPORT_TRACE_CONTAINS_KEY_STROKES,
+    0,
+    NumberOfKeyCodes,
+    Modifiers,
+    ExactMatch,
+    KeyCodes,
+    KeyCodes != NULL ? NumberOfKeyCodes * sizeof (*KeyCodes) : 0
+    );
+  return mOriginalKeyMapAggregator.ContainsKeyStrokes (This, Modifiers, NumberOfKeyCodes, KeyCodes, ExactMatch);
+}
+
+STATIC
+EFI_STATUS
+EFIAPI
+UiTraceCompileChords (
+  IN  APPLE_KEY_MAP_CHORD_MATCHER_PROTOCOL  *This,
+  IN  UINTN                                 NumberOfChords,
+  IN  CONST APPLE_KEY_MAP_CHORD             *Chords,
+  OUT APPLE_KEY_MAP_CHORD_SET               *ChordSet
+  )
+{
+  EFI_STATUS                    Status;
+  APPLE_UI_SUPPORT_TRACE_CHORD  *TraceChords;
+  UINTN                         Index;
+  UINTN                         Index2;
+
+  Status = mOriginalChordMatcher.CompileChords (This, NumberOfChords, Chords, ChordSet);
+  if (EFI_ERROR (Status) || mTraceFile == NULL) {
+    return Status;
+  }
+
+  TraceChords = AllocateZeroPool (NumberOfChords * sizeof (*TraceChords));
+  if (TraceChords != NULL) {
+    //
+    // Compilation succeeded, so every chord fits APPLE_KEY_MAP_CHORD_MAX_KEYS
+    //
+    for (Index = 0; Index < NumberOfChords; ++Index) {
+      TraceChords[Index].ChordId          = Chords[Index].ChordId;
+      TraceChords[Index].Modifiers        = Chords[Index].Modifiers;
+      TraceChords[Index].ExactMatch       = Chords[Index].ExactMatch;
+      TraceChords[Index].NumberOfKeyCodes = (UINT8) Chords[Index].NumberOfKeyCodes;
+      for (Index2 = 0; Index2 < Chords[Index].NumberOfKeyCodes; ++Index2) {
+        TraceChords[Index].KeyCodes[Index2] = Chords[Index].KeyCodes[Index2];
+      }
+    }
+
+    UiTraceKeyMap (
+      APPLE_UI_SUPPORT_TRACE_COMPILE_CHORDS,
+      (UINTN) *ChordSet,
+      NumberOfChords,
+      0,
+      FALSE,
+      TraceChords,
+      NumberOfChords * sizeof (*TraceChords)
+      );
+
+    FreePool (TraceChords);
+  }
+
+  return Status;
+}
+
+STATIC
+EFI_STATUS
+EFIAPI
+UiTraceMatchChords (
+  IN     APPLE_KEY_MAP_CHORD_MATCHER_PROTOCOL  *This,
+  IN     APPLE_KEY_MAP_CHORD_SET               ChordSet,
+  IN OUT UINTN                                 *NumberOfChordIds,
+  OUT    UINTN                                 *ChordIds OPTIONAL
+  )
+{
+  UiTraceKeyMap (
+    APPLE_UI_SUPPORT_TRACE_MATCH_CHORDS,
+    (UINTN) ChordSet,
+    NumberOfChordIds != NULL ? *NumberOfChordIds : 0,
+    0,
+    FALSE,
+    NULL,
+    0
+    );
+  return mOriginalChordMatcher.MatchChords (This, ChordSet, NumberOfChordIds, ChordIds);
+}
+
+STATIC
+EFI_STATUS
+EFIAPI
+UiTraceFreeChords (
+  IN APPLE_KEY_MAP_CHORD_MATCHER_PROTOCOL  *This,
+  IN APPLE_KEY_MAP_CHORD_SET               ChordSet
+  )
+{
+  UiTraceKeyMap (APPLE_UI_SUPPORT_TRACE_FREE_CHORDS, (UINTN) ChordSet, 0, 0, FALSE, NULL, 0);
+  return mOriginalChordMatcher.FreeChords (This, ChordSet);
+}
+
+STATIC
+VOID
+UiTraceHash (
+  IN UINT16                   Function,
+  IN CONST EFI_HASH_PROTOCOL  *Hash,
+  IN CONST EFI_GUID           *HashAlgorithm  OPTIONAL,
+  IN BOOLEAN                  Extend,
+  IN UINT64                   MessageSize
+  )
+{
+  APPLE_UI_SUPPORT_TRACE_HASH_DATA  HashData;
+
+  ZeroMem (&HashData, sizeof (HashData));
+  HashData.Id          = (UINTN) Hash;
+  HashData.MessageSize = MessageSize;
+  HashData.Extend      = Extend;
+  if (HashAlgorithm != NULL) {
+    CopyMem (&HashData.HashAlgorithm, HashAlgorithm, sizeof (HashData.HashAlgorithm));
+  }
+
+  UiTraceWrite (APPLE_UI_SUPPORT_TRACE_HASH, Function, &HashData, sizeof (HashData), NULL, 0);
+}
+
+STATIC
+EFI_STATUS
+EFIAPI
+UiTraceGetHashSize (
+  IN  CONST EFI_HASH_PROTOCOL *This,
+  IN  CONST EFI_GUID          *HashAlgorithm,
+  OUT UINTN                   *HashSize
+  )
+{
+  UiTraceHash (APPLE_UI_SUPPORT_TRACE_GET_HASH_SIZE, This, HashAlgorithm, FALSE, 0);
+  return mOriginalHash.GetHashSize (This, HashAlgorithm, HashSize);
+}
+
+STATIC
+EFI_STATUS
+EFIAPI
+UiTraceHashData (
+  IN CONST EFI_HASH_PROTOCOL  *This,
+  IN CONST EFI_GUID           *HashAlgorithm,
+  IN BOOLEAN                  Extend,
+  IN CONST UINT8              *Message,
+  IN UINT64                   MessageSize,
+  IN OUT EFI_HASH_OUTPUT      *Hash
+  )
+{
+  //
+  // Messages may carry secrets, only their size is recorded
+  //
+  UiTraceHash (APPLE_UI_SUPPORT_TRACE_HASH_MESSAGE, This, HashAlgorithm, Extend, MessageSize);
+  return mOriginalHash.Hash (This, HashAlgorithm, Extend, Message, MessageSize, Hash);
+}
+
+STATIC
+EFI_STATUS
+EFIAPI
+UiTraceCreateChild (
+  IN     EFI_SERVICE_BINDING_PROTOCOL  *This,
+  IN OUT EFI_HANDLE                    *ChildHandle
+  )
+{
+  EFI_STATUS         Status;
+  EFI_HASH_PROTOCOL  *Hash;
+
+  Status = mOriginalHashServiceBinding.CreateChild (This, ChildHandle);
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  if (EFI_ERROR (gBS->HandleProtocol (*ChildHandle, &gEfiHashProtocolGuid, (VOID **) &Hash))) {
+    return Status;
+  }
+
+  //
+  // Every child of the binding shares the same functions
+  //
+  if (!mOriginalHashValid) {
+    mOriginalHash.GetHashSize = Hash->GetHashSize;
+    mOriginalHash.Hash        = Hash->Hash;
+    mOriginalHashValid        = TRUE;
+  }
+
+  if (Hash->GetHashSize == mOriginalHash.GetHashSize && Hash->Hash == mOriginalHash.Hash) {
+    Hash->GetHashSize = UiTraceGetHashSize;
+    Hash->Hash        = UiTraceHashData;
+    UiTraceHash (APPLE_UI_SUPPORT_TRACE_CREATE_CHILD, Hash, NULL, FALSE, 0);
+  }
+
+  return Status;
+}
+
+STATIC
+EFI_STATUS
+EFIAPI
+UiTraceDestroyChild (
+  IN EFI_SERVICE_BINDING_PROTOCOL  *This,
+  IN EFI_HANDLE                    ChildHandle
+  )
+{
+  EFI_HASH_PROTOCOL  *Hash;
+
+  if (!EFI_ERROR (gBS->HandleProtocol (ChildHandle, &gEfiHashProtocolGuid, (VOID **) &Hash))
+    && Hash->Hash == UiTraceHashData) {
+    UiTraceHash (APPLE_UI_SUPPORT_TRACE_DESTROY_CHILD, Hash, NULL, FALSE, 0);
+  }
+
+  return mOriginalHashServiceBinding.DestroyChild (This, ChildHandle);
+}
+
+/**
+  UiTraceCollation
+
+  Records a call to the Unicode Collation protocol installed by this driver.
+  The strings are file names, only their lengths are recorded.
+
+  @param[in] Function   APPLE_UI_SUPPORT_TRACE_COLLATION function.
+  @param[in] Argument1  The string, or the FAT name for FatToStr.
+  @param[in] Argument2  The second string of StriColl and MetaiMatch.
+  @param[in] FatSize    The FAT name size of FatToStr and StrToFat.
+**/
+VOID
+EFIAPI
+UiTraceCollation (
+  IN UINT16      Function,
+  IN CONST VOID  *Argument1,
+  IN CONST VOID  *Argument2  OPTIONAL,
+  IN UINTN       FatSize
+  )
+{
+  APPLE_UI_SUPPORT_TRACE_COLLATION_DATA  Data;
+  CONST CHAR8                            *Fat;
+  UINTN                                  Length;
+
+  if (mTraceFile == NULL) {
+    return;
+  }
+
+  ZeroMem (&Data, sizeof (Data));
+
+  if (Function == APPLE_UI_SUPPORT_TRACE_FAT_TO_STR) {
+    //
+    // FAT names stop at the first null character or after FatSize bytes
+    //
+    Fat = Argument1;
+    for (Length = 0; Length < FatSize && Fat[Length] != '\0'; ++Length) {
+    }
+    Data.Length1 = (UINT32) Length;
+  } else {
+    Data.Length1 = (UINT32) StrLen (Argument1);
+    if (Function == APPLE_UI_SUPPORT_TRACE_STR_TO_FAT) {
+      Data.Length2 = (UINT32) FatSize;
+    } else if (Argument2 != NULL) {
+      Data.Length2 = (UINT32) StrLen (Argument2);
+    }
+  }
+
+  UiTraceWrite (APPLE_UI_SUPPORT_TRACE_COLLATION, Function, &Data, sizeof (Data), NULL, 0);
+}
+
+/**
+  UiTraceReadSection
+
+  Records a ReadSection call to a Firmware Volume protocol implemented
+  or wrapped by this driver.
+
+  @param[in] NameGuid         The file GUID.
+  @param[in] SectionType      The section type.
+  @param[in] SectionInstance  The section instance.
+  @param[in] Buffer           The caller buffer, NULL to allocate the section.
+  @param[in] BufferSize       The caller buffer size.
+**/
+VOID
+EFIAPI
+UiTraceReadSection (
+  IN CONST EFI_GUID  *NameGuid,
+  IN UINT8           SectionType,
+  IN UINTN           SectionInstance,
+  IN CONST VOID      *Buffer  OPTIONAL,
+  IN UINTN           BufferSize
+  )
+{
+  APPLE_UI_SUPPORT_TRACE_FIRMWARE_VOLUME_DATA  Data;
+
+  if (mTraceFile == NULL) {
+    return;
+  }
+
+  ZeroMem (&Data, sizeof (Data));
+  CopyMem (&Data.NameGuid, NameGuid, sizeof (Data.NameGuid));
+  Data.SectionType     = SectionType;
+  Data.SectionInstance = SectionInstance;
+  if (Buffer != NULL) {
+    Data.BufferSize = BufferSize;
+  }
+
+  UiTraceWrite (
+    APPLE_UI_SUPPORT_TRACE_FIRMWARE_VOLUME,
+    APPLE_UI_SUPPORT_TRACE_READ_SECTION,
+    &Data,
+    sizeof (Data),
+    NULL,
+    0
+    );
+}
+
+//
+// Returns the only installed instance of a protocol, several instances
+// mean the one installed by this driver cannot be told apart
+//
+STATIC
+EFI_STATUS
+UiTraceLocateOwnProtocol (
+  IN  EFI_GUID  *Protocol,
+  OUT VOID      **Interface
+  )
+{
+  EFI_STATUS  Status;
+  EFI_HANDLE  *Handles;
+  UINTN       NumberOfHandles;
+
+  Status = gBS->LocateHandleBuffer (ByProtocol, Protocol, NULL, &NumberOfHandles, &Handles);
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  if (NumberOfHandles == 1) {
+    Status = gBS->HandleProtocol (Handles[0], Protocol, Interface);
+  } else {
+    Status = EFI_NOT_FOUND;
+  }
+
+  FreePool (Handles);
+  return Status;
+}
+
+//
+// Remembers the original functions of the recorded protocols installed
+// by this driver and overrides them with the recording wrappers
+//
+STATIC
+VOID
+UiTraceWrapProtocols (
+  IN UINT32  Installed
+  )
+{
+  EFI_STATUS                            Status;
+  APPLE_IMAGE_CODEC_PROTOCOL            *ImageCodec;
+  APPLE_KEY_MAP_DATABASE_PROTOCOL       *KeyMapDatabase;
+  APPLE_KEY_MAP_AGGREGATOR_PROTOCOL     *KeyMapAggregator;
+  APPLE_KEY_MAP_CHORD_MATCHER_PROTOCOL  *ChordMatcher;
+  EFI_SERVICE_BINDING_PROTOCOL          *HashServiceBinding;
+
+  if ((Installed & UI_TRACE_IMAGE_CODEC) != 0) {
+    Status = UiTraceLocateOwnProtocol (&gAppleImageCodecProtocolGuid, (VOID **) &ImageCodec);
+  } else {
+    Status = EFI_NOT_STARTED;
+  }
+
+  if (!EFI_ERROR (Status)) {
+    mOriginalImageCodec.RecognizeImageData = ImageCodec->RecognizeImageData;
+    mOriginalImageCodec.GetImageDims       = ImageCodec->GetImageDims;
+    mOriginalImageCodec.DecodeImageData    = ImageCodec->DecodeImageData;
+    mOriginalImageCodec.GetImageDimsVer    = ImageCodec->GetImageDimsVer;
+    mOriginalImageCodec.DecodeImageDataVer = ImageCodec->DecodeImageDataVer;
+
+    ImageCodec->RecognizeImageData = UiTraceRecognizeImageData;
+    ImageCodec->GetImageDims       = UiTraceGetImageDims;
+    ImageCodec->DecodeImageData    = UiTraceDecodeImageData;
+    ImageCodec->GetImageDimsVer    = UiTraceGetImageDimsVer;
+    ImageCodec->DecodeImageDataVer = UiTraceDecodeImageDataVer;
+  }
+
+  //
+  // Database, aggregator and chord matcher are installed together
+  //
+  if ((Installed & UI_TRACE_KEY_MAP) != 0) {
+    Status = UiTraceLocateOwnProtocol (&gAppleKeyMapDatabaseProtocolGuid, (VOID **) &KeyMapDatabase);
+    if (!EFI_ERROR (Status)) {
+      Status = UiTraceLocateOwnProtocol (&gAppleKeyMapAggregatorProtocolGuid, (VOID **) &KeyMapAggregator);
+    }
+    if (!EFI_ERROR (Status)) {
+      Status = UiTraceLocateOwnProtocol (&gAppleKeyMapChordMatcherProtocolGuid, (VOID **) &ChordMatcher);
+    }
+  } else {
+    Status = EFI_NOT_STARTED;
+  }
+
+  if (!EFI_ERROR (Status)) {
+    mOriginalKeyMapDatabase.CreateKeyStrokesBuffer = KeyMapDatabase->CreateKeyStrokesBuffer;
+    mOriginalKeyMapDatabase.RemoveKeyStrokesBuffer = KeyMapDatabase->RemoveKeyStrokesBuffer;
+    mOriginalKeyMapDatabase.SetKeyStrokeBufferKeys = KeyMapDatabase->SetKeyStrokeBufferKeys;
+
+    KeyMapDatabase->CreateKeyStrokesBuffer = UiTraceCreateKeyStrokesBuffer;
+    KeyMapDatabase->RemoveKeyStrokesBuffer = UiTraceRemoveKeyStrokesBuffer;
+    KeyMapDatabase->SetKeyStrokeBufferKeys = UiTraceSetKeyStrokeBufferKeys;
+
+    mOriginalKeyMapAggregator.GetKeyStrokes      = KeyMapAggregator->GetKeyStrokes;
+    mOriginalKeyMapAggregator.ContainsKeyStrokes = KeyMapAggregator->ContainsKeyStrokes;
+
+    KeyMapAggregator->GetKeyStrokes      = UiTraceGetKeyStrokes;
+    KeyMapAggregator->ContainsKeyStrokes = UiTraceContainsKeyStrokes;
+
+    mOriginalChordMatcher.CompileChords = ChordMatcher->CompileChords;
+    mOriginalChordMatcher.MatchChords   = ChordMatcher->MatchChords;
+    mOriginalChordMatcher.FreeChords    = ChordMatcher->FreeChords;
+
+    ChordMatcher->CompileChords = UiTraceCompileChords;
+    ChordMatcher->MatchChords   = UiTraceMatchChords;
+    ChordMatcher->FreeChords    = UiTraceFreeChords;
+  }
+
+  //
+  // Hash protocol instances are created per child, they get wrapped on creation
+  //
+  if ((Installed & UI_TRACE_HASH) != 0) {
+    Status = UiTraceLocateOwnProtocol (&gEfiHashServiceBindingProtocolGuid, (VOID **) &HashServiceBinding);
+  } else {
+    Status = EFI_NOT_STARTED;
+  }
+
+  if (!EFI_ERROR (Status)) {
+    mOriginalHashServiceBinding.CreateChild  = HashServiceBinding->CreateChild;
+    mOriginalHashServiceBinding.DestroyChild = HashServiceBinding->DestroyChild;
+
+    HashServiceBinding->CreateChild  = UiTraceCreateChild;
+    HashServiceBinding->DestroyChild = UiTraceDestroyChild;
+  }
+}
+
+//
+// Creates the trace file on the volume the driver was loaded from
+//
+STATIC
+EFI_STATUS
+UiTraceCreateFile (
+  IN  EFI_HANDLE         ImageHandle,
+  OUT EFI_FILE_PROTOCOL  **File
+  )
+{
+  EFI_STATUS                       Status;
+  EFI_LOADED_IMAGE_PROTOCOL        *LoadedImage;
+  EFI_SIMPLE_FILE_SYSTEM_PROTOCOL  *FileSystem;
+  EFI_FILE_PROTOCOL                *Root;
+  EFI_FILE_PROTOCOL                *OldFile;
+
+  Status = gBS->HandleProtocol (ImageHandle, &gEfiLoadedImageProtocolGuid, (VOID **) &LoadedImage);
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  Status = gBS->HandleProtocol (LoadedImage->DeviceHandle, &gEfiSimpleFileSystemProtocolGuid, (VOID **) &FileSystem);
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  Status = FileSystem->OpenVolume (FileSystem, &Root);
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  //
+  // Previous trace is replaced, there is no way to truncate an open file
+  //
+  Status = Root->Open (Root, &OldFile, APPLE_UI_SUPPORT_TRACE_FILE_NAME, EFI_FILE_MODE_READ | EFI_FILE_MODE_WRITE, 0);
+  if (!EFI_ERROR (Status)) {
+    OldFile->Delete (OldFile);
+  }
+
+  Status = Root->Open (
+    Root,
+    File,
+    APPLE_UI_SUPPORT_TRACE_FILE_NAME,
+    EFI_FILE_MODE_READ | EFI_FILE_MODE_WRITE | EFI_FILE_MODE_CREATE,
+    0
+    );
+
+  Root->Close (Root);
+  return Status;
+}
+
+/**
+  InitializeUiTrace
+
+  Starts recording calls to the protocols installed by AppleUiSupport
+  when APPLE_UI_SUPPORT_TRACE_VARIABLE_NAME is set to a non-zero byte.
+  Must be called after all the protocols are installed.
+  Recording stops at ExitBootServices.
+
+  @param[in] ImageHandle  The firmware allocated handle for the EFI image.
+  @param[in] SystemTable  A pointer to the EFI System Table.
+  @param[in] Installed    UI_TRACE_* bits of the protocols this driver installed.
+
+  @retval EFI_SUCCESS  Recording has started or is not requested.
+  @retval other        The trace file could not be created.
+**/
+EFI_STATUS
+EFIAPI
+InitializeUiTrace (
+  IN EFI_HANDLE        ImageHandle,
+  IN EFI_SYSTEM_TABLE  *SystemTable,
+  IN UINT32            Installed
+  )
+{
+  EFI_STATUS                     Status;
+  UINT8                          Enabled;
+  UINTN                          Size;
+  EFI_FILE_PROTOCOL              *File;
+  EFI_EVENT                      Event;
+  EFI_EVENT                      ExitBootServicesEvent;
+  APPLE_UI_SUPPORT_TRACE_HEADER  Header;
+
+  Enabled = 0;
+  Size    = sizeof (Enabled);
+  Status  = gRT->GetVariable (
+    APPLE_UI_SUPPORT_TRACE_VARIABLE_NAME,
+    &gAppleUiSupportTraceVariableGuid,
+    NULL,
+    &Size,
+    &Enabled
+    );
+
+  if (EFI_ERROR (Status) || Enabled == 0 || Installed == 0) {
+    return EFI_SUCCESS;
+  }
+
+  Status = UiTraceCreateFile (ImageHandle, &File);
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  Header.Signature = APPLE_UI_SUPPORT_TRACE_SIGNATURE;
+  Header.Revision  = APPLE_UI_SUPPORT_TRACE_REVISION;
+
+  Size   = sizeof (Header);
+  Status = File->Write (File, &Size, &Header);
+  if (EFI_ERROR (Status)) {
+    File->Close (File);
+    return Status;
+  }
+
+  Status = gBS->CreateEvent (
+    EVT_TIMER | EVT_NOTIFY_SIGNAL,
+    TPL_CALLBACK,
+    UiTraceFlushNotify,
+    NULL,
+    &Event
+    );
+
+  if (EFI_ERROR (Status)) {
+    File->Close (File);
+    return Status;
+  }
+
+  Status = gBS->CreateEvent (
+    EVT_SIGNAL_EXIT_BOOT_SERVICES,
+    TPL_CALLBACK,
+    UiTraceExitBootServicesNotify,
+    NULL,
+    &ExitBootServicesEvent
+    );
+
+  if (!EFI_ERROR (Status)) {
+    Status = gBS->SetTimer (Event, TimerPeriodic, UI_TRACE_FLUSH_PERIOD);
+    if (EFI_ERROR (Status)) {
+      gBS->CloseEvent (ExitBootServicesEvent);
+    }
+  }
+
+  if (EFI_ERROR (Status)) {
+    gBS->CloseEvent (Event);
+    File->Close (File);
+    return Status;
+  }
+
+  mTraceFile       = File;
+  UiTraceWrapProtocols (Installed);
+
+  DEBUG ((DEBUG_VERBOSE, "AppleUiSupport: Recording protocol calls to %s\n", APPLE_UI_SUPPORT_TRACE_FILE_NAME));
+  return EFI_SUCCESS;
+}
@@ -15,9 +15,12 @@ WITHOUT WARRANTIES OR REPRESENTATIONS OF ANY KIND, EITHER EXPRESS OR IMPLIED.
 
 #include "UnicodeCollationEng.h"
 
+#include <Guid/AppleUiSupportTrace.h>
 #include <Library/BaseLib.h>
 #include <Library/UefiLib.h>
 
+#include "../AppleUiSupport.h"
+
 CHAR8 mEngUpperMap[MAP_TABLE_SIZE];
 CHAR8 mEngLowerMap[MAP_TABLE_SIZE];
 CHAR8 mEngInfoMap[MAP_TABLE_SIZE];
@@ -213,6 +216,8 @@ EngStriColl (
   IN CHAR16                           *Str2
   )
 {
+  UiTraceCollation (APPLE_UI_SUPPORT_TRACE_STRI_COLL, Str1, Str2, 0);
+
   while (*Str1 != 0) {
     if (TO_UPPER (*Str1) != TO_UPPER (*Str2)) {
       break;
@@ -241,6 +246,8 @@ EngStrLwr (
   IN OUT CHAR16                       *Str
   )
 {
+  UiTraceCollation (APPLE_UI_SUPPORT_TRACE_STR_LWR, Str, NULL, 0);
+
   while (*Str != 0) {
     *Str = TO_LOWER (*Str);
     Str += 1;
@@ -263,6 +270,8 @@ EngStrUpr (
   IN OUT CHAR16                       *Str
   )
 {
+  UiTraceCollation (APPLE_UI_SUPPORT_TRACE_STR_UPR, Str, NULL, 0);
+
   while (*Str != 0) {
     *Str = TO_UPPER (*Str);
     Str += 1;
@@ -271,9 +280,9 @@ EngStrUpr (
 
 /**
   Performs a case-insensitive comparison of a Null-terminated
-  pattern string and a Null-terminated string.
+  pattern string and a Null-terminated string, calls itself
+  for every '*' in the pattern.
 
-  @param  This    Protocol instance pointer.
   @param  String  A pointer to a Null-terminated string.
   @param  Pattern A pointer to a Null-terminated pattern string.
 
@@ -281,10 +290,9 @@ EngStrUpr (
   @retval FALSE   Pattern was not found in String.
 
 **/
+STATIC
 BOOLEAN
-EFIAPI
-EngMetaiMatch (
-  IN EFI_UNICODE_COLLATION_PROTOCOL   *This,
+EngMetaiMatchString (
   IN CHAR16                           *String,
   IN CHAR16                           *Pattern
   )
@@ -313,14 +321,14 @@ EngMetaiMatch (
       // Match zero or more chars
       //
       while (*String != 0) {
-        if (EngMetaiMatch (This, String, Pattern)) {
+        if (EngMetaiMatchString (String, Pattern)) {
           return TRUE;
         }
 
         String += 1;
       }
 
-      return EngMetaiMatch (This, String, Pattern);
+      return EngMetaiMatchString (String, Pattern);
 
     case '?':
       //
@@ -406,6 +414,32 @@ EngMetaiMatch (
 }
 
 
+/**
+  Performs a case-insensitive comparison of a Null-terminated
+  pattern string and a Null-terminated string.
+
+  @param  This    Protocol instance pointer.
+  @param  String  A pointer to a Null-terminated string.
+  @param  Pattern A pointer to a Null-terminated pattern string.
+
+  @retval TRUE    Pattern was found in String.
+  @retval FALSE   Pattern was not found in String.
+
+**/
+BOOLEAN
+EFIAPI
+EngMetaiMatch (
+  IN EFI_UNICODE_COLLATION_PROTOCOL   *This,
+  IN CHAR16                           *String,
+  IN CHAR16                           *Pattern
+  )
+{
+  UiTraceCollation (APPLE_UI_SUPPORT_TRACE_METAI_MATCH, String, Pattern, 0);
+
+  return EngMetaiMatchString (String, Pattern);
+}
+
+
 /**
   Converts an 8.3 FAT file name in an OEM character set to a Null-terminated string.
 
@@ -426,6 +460,8 @@ EngFatToStr (
   OUT CHAR16                          *String
   )
 {
+  UiTraceCollation (APPLE_UI_SUPPORT_TRACE_FAT_TO_STR, Fat, NULL, FatSize);
+
   //
   // No DBCS issues, just expand and add null terminate to end of string
   //
@@ -466,6 +502,8 @@ EngStrToFat (
 {
   BOOLEAN SpecialCharExist;
 
+  UiTraceCollation (APPLE_UI_SUPPORT_TRACE_STR_TO_FAT, String, NULL, FatSize);
+
   SpecialCharExist = FALSE;
   while ((*String != 0) && (FatSize != 0)) {
     //
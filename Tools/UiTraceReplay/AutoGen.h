@@ -0,0 +1,4 @@
+//
+// UEFI sources are built with this header force included, as with the UDK build
+//
+#include <Uefi.h>
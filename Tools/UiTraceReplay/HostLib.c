@@ -0,0 +1,136 @@
+/** @file
+
+UiTraceReplay host services
+
+Copyright (c) 2018, savvas
+
+All rights reserved.
+
+This program and the accompanying materials
+are licensed and made available under the terms and conditions of the BSD License
+which accompanies this distribution.  The full text of the license may be found at
+http://opensource.org/licenses/bsd-license.php
+
+THE PROGRAM IS DISTRIBUTED UNDER THE BSD LICENSE ON AN "AS IS" BASIS,
+WITHOUT WARRANTIES OR REPRESENTATIONS OF ANY KIND, EITHER EXPRESS OR IMPLIED.
+
+**/
+
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "HostLib.h"
+
+void *
+HostAllocate (
+  unsigned long long  Size
+  )
+{
+  //
+  // Zero sized pools are valid in UEFI
+  //
+  return malloc (Size > 0 ? Size : 1);
+}
+
+void
+HostFree (
+  void  *Buffer
+  )
+{
+  free (Buffer);
+}
+
+void *
+HostCopyMem (
+  void                *Destination,
+  const void          *Source,
+  unsigned long long  Length
+  )
+{
+  return memmove (Destination, Source, Length);
+}
+
+void *
+HostSetMem (
+  void                *Buffer,
+  unsigned long long  Length,
+  unsigned char       Value
+  )
+{
+  return memset (Buffer, Value, Length);
+}
+
+int
+HostCompareMem (
+  const void          *Buffer1,
+  const void          *Buffer2,
+  unsigned long long  Length
+  )
+{
+  return memcmp (Buffer1, Buffer2, Length);
+}
+
+unsigned long long
+HostTimeNs (
+  void
+  )
+{
+  struct timespec  Time;
+
+  clock_gettime (CLOCK_MONOTONIC, &Time);
+  return (unsigned long long) Time.tv_sec * 1000000000ULL + (unsigned long long) Time.tv_nsec;
+}
+
+int
+HostReadFile (
+  const char          *FileName,
+  void                **Data,
+  unsigned long long  *Size
+  )
+{
+  FILE  *File;
+  long  FileSize;
+
+  File = fopen (FileName, "rb");
+  if (File == NULL) {
+    return -1;
+  }
+
+  if (fseek (File, 0, SEEK_END) != 0 || (FileSize = ftell (File)) < 0 || fseek (File, 0, SEEK_SET) != 0) {
+    fclose (File);
+    return -1;
+  }
+
+  *Data = HostAllocate ((unsigned long long) FileSize);
+  if (*Data == NULL) {
+    fclose (File);
+    return -1;
+  }
+
+  if (fread (*Data, 1, (size_t) FileSize, File) != (size_t) FileSize) {
+    free (*Data);
+    fclose (File);
+    return -1;
+  }
+
+  *Size = (unsigned long long) FileSize;
+  fclose (File);
+  return 0;
+}
+
+void
+HostPrint (
+  const char  *Format,
+  ...
+  )
+{
+  va_list  Marker;
+
+  va_start (Marker, Format);
+  vprintf (Format, Marker);
+  va_end (Marker);
+}
@@ -0,0 +1,78 @@
+/** @file
+
+UiTraceReplay host services.
+Kept free of UEFI headers, which clash with the C library ones.
+
+Copyright (c) 2018, savvas
+
+All rights reserved.
+
+This program and the accompanying materials
+are licensed and made available under the terms and conditions of the BSD License
+which accompanies this distribution.  The full text of the license may be found at
+http://opensource.org/licenses/bsd-license.php
+
+THE PROGRAM IS DISTRIBUTED UNDER THE BSD LICENSE ON AN "AS IS" BASIS,
+WITHOUT WARRANTIES OR REPRESENTATIONS OF ANY KIND, EITHER EXPRESS OR IMPLIED.
+
+**/
+
+#ifndef HOST_LIB_H_
+#define HOST_LIB_H_
+
+void *
+HostAllocate (
+  unsigned long long  Size
+  );
+
+void
+HostFree (
+  void  *Buffer
+  );
+
+void *
+HostCopyMem (
+  void                *Destination,
+  const void          *Source,
+  unsigned long long  Length
+  );
+
+void *
+HostSetMem (
+  void                *Buffer,
+  unsigned long long  Length,
+  unsigned char       Value
+  );
+
+int
+HostCompareMem (
+  const void          *Buffer1,
+  const void          *Buffer2,
+  unsigned long long  Length
+  );
+
+//
+// Monotonic time in nanoseconds
+//
+unsigned long long
+HostTimeNs (
+  void
+  );
+
+//
+// Reads a whole file into a buffer freed with HostFree
+//
+int
+HostReadFile (
+  const char          *FileName,
+  void                **Data,
+  unsigned long long  *Size
+  );
+
+void
+HostPrint (
+  const char  *Format,
+  ...
+  );
+
+#endif // HOST_LIB_H_
@@ -0,0 +1,785 @@
+/** @file
+
+UiTraceReplay UEFI environment.
+Provides the boot services, runtime services and library functions the
+AppleUiSupport modules use, backed by the host C library.
+
+Copyright (c) 2018, savvas
+
+All rights reserved.
+
+This program and the accompanying materials
+are licensed and made available under the terms and conditions of the BSD License
+which accompanies this distribution.  The full text of the license may be found at
+http://opensource.org/licenses/bsd-license.php
+
+THE PROGRAM IS DISTRIBUTED UNDER THE BSD LICENSE ON AN "AS IS" BASIS,
+WITHOUT WARRANTIES OR REPRESENTATIONS OF ANY KIND, EITHER EXPRESS OR IMPLIED.
+
+**/
+
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/MemoryAllocationLib.h>
+#include <Library/UefiBootServicesTableLib.h>
+#include <Library/UefiLib.h>
+#include <Library/UefiRuntimeServicesTableLib.h>
+#include "HostLib.h"
+#include "AppleUiSupport.h"
+
+//
+// More than enough for the protocols and hash children of one session
+//
+#define SHIM_MAX_INTERFACES  1024
+
+typedef struct {
+  EFI_HANDLE  Handle;
+  EFI_GUID    Protocol;
+  VOID        *Interface;
+} SHIM_INTERFACE;
+
+STATIC SHIM_INTERFACE  mInterfaces[SHIM_MAX_INTERFACES];
+STATIC UINTN           mNumberOfInterfaces = 0;
+STATIC UINTN           mLastHandle         = 0;
+STATIC EFI_TPL         mCurrentTpl         = TPL_APPLICATION;
+
+STATIC
+EFI_TPL
+EFIAPI
+ShimRaiseTpl (
+  IN EFI_TPL  NewTpl
+  )
+{
+  EFI_TPL  OldTpl;
+
+  OldTpl      = mCurrentTpl;
+  mCurrentTpl = NewTpl;
+  return OldTpl;
+}
+
+STATIC
+VOID
+EFIAPI
+ShimRestoreTpl (
+  IN EFI_TPL  OldTpl
+  )
+{
+  mCurrentTpl = OldTpl;
+}
+
+STATIC
+EFI_STATUS
+EFIAPI
+ShimAllocatePool (
+  IN  EFI_MEMORY_TYPE  PoolType,
+  IN  UINTN            Size,
+  OUT VOID             **Buffer
+  )
+{
+  if (Buffer == NULL) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  *Buffer = HostAllocate (Size);
+  return *Buffer != NULL ? EFI_SUCCESS : EFI_OUT_OF_RESOURCES;
+}
+
+STATIC
+EFI_STATUS
+EFIAPI
+ShimFreePool (
+  IN VOID  *Buffer
+  )
+{
+  HostFree (Buffer);
+  return EFI_SUCCESS;
+}
+
+//
+// Recording is not replayed, so there are no timers to run
+//
+STATIC
+EFI_STATUS
+EFIAPI
+ShimCreateEvent (
+  IN  UINT32            Type,
+  IN  EFI_TPL           NotifyTpl,
+  IN  EFI_EVENT_NOTIFY  NotifyFunction,
+  IN  VOID              *NotifyContext,
+  OUT EFI_EVENT         *Event
+  )
+{
+  return EFI_UNSUPPORTED;
+}
+
+STATIC
+EFI_STATUS
+EFIAPI
+ShimSetTimer (
+  IN EFI_EVENT        Event,
+  IN EFI_TIMER_DELAY  Type,
+  IN UINT64           TriggerTime
+  )
+{
+  return EFI_UNSUPPORTED;
+}
+
+STATIC
+EFI_STATUS
+EFIAPI
+ShimCloseEvent (
+  IN EFI_EVENT  Event
+  )
+{
+  return EFI_SUCCESS;
+}
+
+STATIC
+EFI_STATUS
+EFIAPI
+ShimInstallProtocolInterface (
+  IN OUT EFI_HANDLE          *Handle,
+  IN     EFI_GUID            *Protocol,
+  IN     EFI_INTERFACE_TYPE  InterfaceType,
+  IN     VOID                *Interface
+  )
+{
+  UINTN  Index;
+
+  if (Handle == NULL || Protocol == NULL) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  if (*Handle != NULL) {
+    for (Index = 0; Index < mNumberOfInterfaces; ++Index) {
+      if (mInterfaces[Index].Handle == *Handle && CompareGuid (&mInterfaces[Index].Protocol, Protocol)) {
+        return EFI_INVALID_PARAMETER;
+      }
+    }
+  }
+
+  if (mNumberOfInterfaces == SHIM_MAX_INTERFACES) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  if (*Handle == NULL) {
+    *Handle = (EFI_HANDLE) ++mLastHandle;
+  }
+
+  mInterfaces[mNumberOfInterfaces].Handle    = *Handle;
+  mInterfaces[mNumberOfInterfaces].Interface = Interface;
+  CopyGuid (&mInterfaces[mNumberOfInterfaces].Protocol, Protocol);
+  ++mNumberOfInterfaces;
+
+  return EFI_SUCCESS;
+}
+
+STATIC
+EFI_STATUS
+EFIAPI
+ShimUninstallProtocolInterface (
+  IN EFI_HANDLE  Handle,
+  IN EFI_GUID    *Protocol,
+  IN VOID        *Interface
+  )
+{
+  UINTN  Index;
+
+  for (Index = 0; Index < mNumberOfInterfaces; ++Index) {
+    if (mInterfaces[Index].Handle == Handle
+      && mInterfaces[Index].Interface == Interface
+      && CompareGuid (&mInterfaces[Index].Protocol, Protocol)) {
+      --mNumberOfInterfaces;
+      CopyMem (&mInterfaces[Index], &mInterfaces[mNumberOfInterfaces], sizeof (mInterfaces[Index]));
+      return EFI_SUCCESS;
+    }
+  }
+
+  return EFI_NOT_FOUND;
+}
+
+STATIC
+EFI_STATUS
+EFIAPI
+ShimHandleProtocol (
+  IN  EFI_HANDLE  Handle,
+  IN  EFI_GUID    *Protocol,
+  OUT VOID        **Interface
+  )
+{
+  UINTN  Index;
+
+  for (Index = 0; Index < mNumberOfInterfaces; ++Index) {
+    if (mInterfaces[Index].Handle == Handle && CompareGuid (&mInterfaces[Index].Protocol, Protocol)) {
+      *Interface = mInterfaces[Index].Interface;
+      return EFI_SUCCESS;
+    }
+  }
+
+  return EFI_UNSUPPORTED;
+}
+
+STATIC
+EFI_STATUS
+EFIAPI
+ShimLocateProtocol (
+  IN  EFI_GUID  *Protocol,
+  IN  VOID      *Registration  OPTIONAL,
+  OUT VOID      **Interface
+  )
+{
+  UINTN  Index;
+
+  for (Index = 0; Index < mNumberOfInterfaces; ++Index) {
+    if (CompareGuid (&mInterfaces[Index].Protocol, Protocol)) {
+      *Interface = mInterfaces[Index].Interface;
+      return EFI_SUCCESS;
+    }
+  }
+
+  *Interface = NULL;
+  return EFI_NOT_FOUND;
+}
+
+STATIC
+EFI_STATUS
+EFIAPI
+ShimLocateHandle (
+  IN     EFI_LOCATE_SEARCH_TYPE  SearchType,
+  IN     EFI_GUID                *Protocol    OPTIONAL,
+  IN     VOID                    *SearchKey   OPTIONAL,
+  IN OUT UINTN                   *BufferSize,
+  OUT    EFI_HANDLE              *Buffer
+  )
+{
+  UINTN  Index;
+  UINTN  Count;
+
+  if (SearchType != ByProtocol || Protocol == NULL || BufferSize == NULL) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  Count = 0;
+  for (Index = 0; Index < mNumberOfInterfaces; ++Index) {
+    if (CompareGuid (&mInterfaces[Index].Protocol, Protocol)) {
+      if ((Count + 1) * sizeof (EFI_HANDLE) <= *BufferSize) {
+        Buffer[Count] = mInterfaces[Index].Handle;
+      }
+      ++Count;
+    }
+  }
+
+  if (Count == 0) {
+    return EFI_NOT_FOUND;
+  }
+
+  if (Count * sizeof (EFI_HANDLE) > *BufferSize) {
+    *BufferSize = Count * sizeof (EFI_HANDLE);
+    return EFI_BUFFER_TOO_SMALL;
+  }
+
+  *BufferSize = Count * sizeof (EFI_HANDLE);
+  return EFI_SUCCESS;
+}
+
+STATIC
+EFI_STATUS
+EFIAPI
+ShimLocateHandleBuffer (
+  IN     EFI_LOCATE_SEARCH_TYPE  SearchType,
+  IN     EFI_GUID                *Protocol    OPTIONAL,
+  IN     VOID                    *SearchKey   OPTIONAL,
+  IN OUT UINTN                   *NoHandles,
+  OUT    EFI_HANDLE              **Buffer
+  )
+{
+  EFI_STATUS  Status;
+  UINTN       BufferSize;
+
+  BufferSize = 0;
+  Status     = ShimLocateHandle (SearchType, Protocol, SearchKey, &BufferSize, NULL);
+  if (Status != EFI_BUFFER_TOO_SMALL) {
+    return Status;
+  }
+
+  *Buffer = HostAllocate (BufferSize);
+  if (*Buffer == NULL) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  Status = ShimLocateHandle (SearchType, Protocol, SearchKey, &BufferSize, *Buffer);
+  if (EFI_ERROR (Status)) {
+    HostFree (*Buffer);
+    *Buffer = NULL;
+    return Status;
+  }
+
+  *NoHandles = BufferSize / sizeof (EFI_HANDLE);
+  return EFI_SUCCESS;
+}
+
+STATIC
+EFI_STATUS
+EFIAPI
+ShimInstallMultipleProtocolInterfaces (
+  IN OUT EFI_HANDLE  *Handle,
+  ...
+  )
+{
+  EFI_STATUS  Status;
+  VA_LIST     Args;
+  EFI_GUID    *Protocol;
+  VOID        *Interface;
+
+  Status = EFI_SUCCESS;
+
+  VA_START (Args, Handle);
+  while (!EFI_ERROR (Status)) {
+    Protocol = VA_ARG (Args, EFI_GUID *);
+    if (Protocol == NULL) {
+      break;
+    }
+
+    Interface = VA_ARG (Args, VOID *);
+    Status    = ShimInstallProtocolInterface (Handle, Protocol, EFI_NATIVE_INTERFACE, Interface);
+  }
+  VA_END (Args);
+
+  return Status;
+}
+
+STATIC
+VOID
+EFIAPI
+ShimCopyMem (
+  IN VOID   *Destination,
+  IN VOID   *Source,
+  IN UINTN  Length
+  )
+{
+  HostCopyMem (Destination, Source, Length);
+}
+
+STATIC
+VOID
+EFIAPI
+ShimSetMem (
+  IN VOID   *Buffer,
+  IN UINTN  Size,
+  IN UINT8  Value
+  )
+{
+  HostSetMem (Buffer, Size, Value);
+}
+
+//
+// Variables are not persisted, recording is never enabled on the host
+//
+STATIC
+EFI_STATUS
+EFIAPI
+ShimGetVariable (
+  IN     CHAR16    *VariableName,
+  IN     EFI_GUID  *VendorGuid,
+  OUT    UINT32    *Attributes  OPTIONAL,
+  IN OUT UINTN     *DataSize,
+  OUT    VOID      *Data        OPTIONAL
+  )
+{
+  return EFI_NOT_FOUND;
+}
+
+STATIC
+EFI_STATUS
+EFIAPI
+ShimSetVariable (
+  IN CHAR16    *VariableName,
+  IN EFI_GUID  *VendorGuid,
+  IN UINT32    Attributes,
+  IN UINTN     DataSize,
+  IN VOID      *Data
+  )
+{
+  return EFI_SUCCESS;
+}
+
+//
+// Services the AppleUiSupport modules do not use are left NULL
+//
+STATIC EFI_BOOT_SERVICES mBootServices = {
+  .RaiseTPL                          = ShimRaiseTpl,
+  .RestoreTPL                        = ShimRestoreTpl,
+  .AllocatePool                      = ShimAllocatePool,
+  .FreePool                          = ShimFreePool,
+  .CreateEvent                       = ShimCreateEvent,
+  .SetTimer                          = ShimSetTimer,
+  .CloseEvent                        = ShimCloseEvent,
+  .InstallProtocolInterface          = ShimInstallProtocolInterface,
+  .UninstallProtocolInterface        = ShimUninstallProtocolInterface,
+  .HandleProtocol                    = ShimHandleProtocol,
+  .LocateHandle                      = ShimLocateHandle,
+  .LocateHandleBuffer                = ShimLocateHandleBuffer,
+  .LocateProtocol                    = ShimLocateProtocol,
+  .InstallMultipleProtocolInterfaces = ShimInstallMultipleProtocolInterfaces,
+  .CopyMem                           = ShimCopyMem,
+  .SetMem                            = ShimSetMem
+};
+
+STATIC EFI_RUNTIME_SERVICES mRuntimeServices = {
+  .GetVariable = ShimGetVariable,
+  .SetVariable = ShimSetVariable
+};
+
+STATIC EFI_SYSTEM_TABLE mSystemTable = {
+  .BootServices    = &mBootServices,
+  .RuntimeServices = &mRuntimeServices
+};
+
+EFI_HANDLE            gImageHandle = (EFI_HANDLE) (UINTN) 0x1000;
+EFI_SYSTEM_TABLE      *gST         = &mSystemTable;
+EFI_BOOT_SERVICES     *gBS         = &mBootServices;
+EFI_RUNTIME_SERVICES  *gRT         = &mRuntimeServices;
+
+//
+// BaseMemoryLib
+//
+VOID *
+EFIAPI
+CopyMem (
+  OUT VOID       *DestinationBuffer,
+  IN  CONST VOID *SourceBuffer,
+  IN  UINTN      Length
+  )
+{
+  return HostCopyMem (DestinationBuffer, SourceBuffer, Length);
+}
+
+VOID *
+EFIAPI
+SetMem (
+  OUT VOID  *Buffer,
+  IN  UINTN Length,
+  IN  UINT8 Value
+  )
+{
+  return HostSetMem (Buffer, Length, Value);
+}
+
+VOID *
+EFIAPI
+ZeroMem (
+  OUT VOID  *Buffer,
+  IN  UINTN Length
+  )
+{
+  return HostSetMem (Buffer, Length, 0);
+}
+
+INTN
+EFIAPI
+CompareMem (
+  IN CONST VOID  *DestinationBuffer,
+  IN CONST VOID  *SourceBuffer,
+  IN UINTN       Length
+  )
+{
+  return HostCompareMem (DestinationBuffer, SourceBuffer, Length);
+}
+
+BOOLEAN
+EFIAPI
+CompareGuid (
+  IN CONST GUID  *Guid1,
+  IN CONST GUID  *Guid2
+  )
+{
+  return HostCompareMem (Guid1, Guid2, sizeof (GUID)) == 0;
+}
+
+GUID *
+EFIAPI
+CopyGuid (
+  OUT GUID       *DestinationGuid,
+  IN  CONST GUID *SourceGuid
+  )
+{
+  return HostCopyMem (DestinationGuid, SourceGuid, sizeof (GUID));
+}
+
+//
+// MemoryAllocationLib
+//
+VOID *
+EFIAPI
+AllocatePool (
+  IN UINTN  AllocationSize
+  )
+{
+  return HostAllocate (AllocationSize);
+}
+
+VOID *
+EFIAPI
+AllocateZeroPool (
+  IN UINTN  AllocationSize
+  )
+{
+  VOID  *Buffer;
+
+  Buffer = HostAllocate (AllocationSize);
+  if (Buffer != NULL) {
+    HostSetMem (Buffer, AllocationSize, 0);
+  }
+
+  return Buffer;
+}
+
+VOID *
+EFIAPI
+AllocateCopyPool (
+  IN UINTN       AllocationSize,
+  IN CONST VOID  *Buffer
+  )
+{
+  VOID  *Memory;
+
+  Memory = HostAllocate (AllocationSize);
+  if (Memory != NULL) {
+    HostCopyMem (Memory, Buffer, AllocationSize);
+  }
+
+  return Memory;
+}
+
+VOID *
+EFIAPI
+ReallocatePool (
+  IN UINTN  OldSize,
+  IN UINTN  NewSize,
+  IN VOID   *OldBuffer  OPTIONAL
+  )
+{
+  VOID  *NewBuffer;
+
+  NewBuffer = HostAllocate (NewSize);
+  if (NewBuffer != NULL && OldBuffer != NULL) {
+    HostCopyMem (NewBuffer, OldBuffer, MIN (OldSize, NewSize));
+    HostFree (OldBuffer);
+  }
+
+  return NewBuffer;
+}
+
+VOID
+EFIAPI
+FreePool (
+  IN VOID  *Buffer
+  )
+{
+  HostFree (Buffer);
+}
+
+//
+// BaseLib
+//
+UINTN
+EFIAPI
+StrLen (
+  IN CONST CHAR16  *String
+  )
+{
+  UINTN  Length;
+
+  for (Length = 0; String[Length] != L'\0'; ++Length) {
+  }
+
+  return Length;
+}
+
+UINTN
+EFIAPI
+StrSize (
+  IN CONST CHAR16  *String
+  )
+{
+  return (StrLen (String) + 1) * sizeof (*String);
+}
+
+UINTN
+EFIAPI
+AsciiStrLen (
+  IN CONST CHAR8  *String
+  )
+{
+  UINTN  Length;
+
+  for (Length = 0; String[Length] != '\0'; ++Length) {
+  }
+
+  return Length;
+}
+
+INTN
+EFIAPI
+AsciiStrnCmp (
+  IN CONST CHAR8  *FirstString,
+  IN CONST CHAR8  *SecondString,
+  IN UINTN        Length
+  )
+{
+  if (Length == 0) {
+    return 0;
+  }
+
+  while (*FirstString != '\0' && *FirstString == *SecondString && Length > 1) {
+    ++FirstString;
+    ++SecondString;
+    --Length;
+  }
+
+  return *FirstString - *SecondString;
+}
+
+UINT64
+EFIAPI
+LShiftU64 (
+  IN UINT64  Operand,
+  IN UINTN   Count
+  )
+{
+  return Operand << Count;
+}
+
+LIST_ENTRY *
+EFIAPI
+InitializeListHead (
+  IN OUT LIST_ENTRY  *ListHead
+  )
+{
+  ListHead->ForwardLink = ListHead;
+  ListHead->BackLink    = ListHead;
+  return ListHead;
+}
+
+LIST_ENTRY *
+EFIAPI
+InsertTailList (
+  IN OUT LIST_ENTRY  *ListHead,
+  IN OUT LIST_ENTRY  *Entry
+  )
+{
+  Entry->ForwardLink              = ListHead;
+  Entry->BackLink                 = ListHead->BackLink;
+  Entry->BackLink->ForwardLink    = Entry;
+  ListHead->BackLink              = Entry;
+  return ListHead;
+}
+
+LIST_ENTRY *
+EFIAPI
+RemoveEntryList (
+  IN CONST LIST_ENTRY  *Entry
+  )
+{
+  Entry->ForwardLink->BackLink = Entry->BackLink;
+  Entry->BackLink->ForwardLink = Entry->ForwardLink;
+  return Entry->ForwardLink;
+}
+
+LIST_ENTRY *
+EFIAPI
+GetFirstNode (
+  IN CONST LIST_ENTRY  *List
+  )
+{
+  return List->ForwardLink;
+}
+
+LIST_ENTRY *
+EFIAPI
+GetNextNode (
+  IN CONST LIST_ENTRY  *List,
+  IN CONST LIST_ENTRY  *Node
+  )
+{
+  return Node->ForwardLink;
+}
+
+BOOLEAN
+EFIAPI
+IsNull (
+  IN CONST LIST_ENTRY  *List,
+  IN CONST LIST_ENTRY  *Node
+  )
+{
+  return (BOOLEAN) (Node == List);
+}
+
+BOOLEAN
+EFIAPI
+IsListEmpty (
+  IN CONST LIST_ENTRY  *ListHead
+  )
+{
+  return (BOOLEAN) (ListHead->ForwardLink == ListHead);
+}
+
+//
+// UefiLib
+//
+EFI_STATUS
+EFIAPI
+GetVariable2 (
+  IN  CONST CHAR16    *Name,
+  IN  CONST EFI_GUID  *Guid,
+  OUT VOID            **Value,
+  OUT UINTN           *Size  OPTIONAL
+  )
+{
+  *Value = NULL;
+  if (Size != NULL) {
+    *Size = 0;
+  }
+
+  return EFI_NOT_FOUND;
+}
+
+//
+// FirmwareVolumeInject only calls this when Firmware Volume 2 is present,
+// which is never the case here
+//
+EFI_STATUS
+EFIAPI
+InitializeFirmwareVolume2 (
+  IN EFI_HANDLE        ImageHandle,
+  IN EFI_SYSTEM_TABLE  *SystemTable
+  )
+{
+  return EFI_UNSUPPORTED;
+}
+
+//
+// UiTrace, the replayed calls are not recorded again
+//
+VOID
+EFIAPI
+UiTraceCollation (
+  IN UINT16      Function,
+  IN CONST VOID  *Argument1,
+  IN CONST VOID  *Argument2  OPTIONAL,
+  IN UINTN       FatSize
+  )
+{
+}
+
+VOID
+EFIAPI
+UiTraceReadSection (
+  IN CONST EFI_GUID  *NameGuid,
+  IN UINT8           SectionType,
+  IN UINTN           SectionInstance,
+  IN CONST VOID      *Buffer  OPTIONAL,
+  IN UINTN           BufferSize
+  )
+{
+}
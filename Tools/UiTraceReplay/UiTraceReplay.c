@@ -0,0 +1,1054 @@
+/** @file
+
+UiTraceReplay -- runs an AppleUiSupport protocol call trace against a host
+build of the same modules and reports the time spent per call type.
+
+Copyright (c) 2018, savvas
+
+All rights reserved.
+
+This program and the accompanying materials
+are licensed and made available under the terms and conditions of the BSD License
+which accompanies this distribution.  The full text of the license may be found at
+http://opensource.org/licenses/bsd-license.php
+
+THE PROGRAM IS DISTRIBUTED UNDER THE BSD LICENSE ON AN "AS IS" BASIS,
+WITHOUT WARRANTIES OR REPRESENTATIONS OF ANY KIND, EITHER EXPRESS OR IMPLIED.
+
+**/
+
+#include <AppleMacEfi.h>
+#include <Guid/AppleUiSupportTrace.h>
+#include <Framework/FirmwareVolumeImageFormat.h>
+#include <Pi/PiFirmwareFile.h>
+#include <Pi/PiFirmwareVolume.h>
+#include <Protocol/AppleKeyMapAggregator.h>
+#include <Protocol/AppleKeyMapDatabase.h>
+#include <Protocol/AppleKeyMapChordMatcher.h>
+#include <Protocol/FirmwareVolume.h>
+#include <Protocol/GraphicsOutput.h>
+#include <Protocol/Hash.h>
+#include <Protocol/ServiceBinding.h>
+#include <Protocol/UgaDraw.h>
+#include <Protocol/UnicodeCollation.h>
+#include <Protocol/AppleImageCodecProtocol.h>
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/MemoryAllocationLib.h>
+#include <Library/UefiBootServicesTableLib.h>
+#include <AppleUiSupport.h>
+#include "HostLib.h"
+
+//
+// Key strokes buffers, chord sets and hash children alive at the same time
+//
+#define REPLAY_MAX_OBJECTS       1024
+
+//
+// Pressed keys are not recorded, SetKeyStrokeBufferKeys gets letters
+// of the keyboard usage page starting from A instead
+//
+#define REPLAY_KEY_CODE(Index)   ((APPLE_KEY_CODE) (0x7004U + ((Index) % 26U)))
+
+#define REPLAY_MAX_FUNCTIONS     8
+
+//
+// Kinds of objects created by replayed calls
+//
+#define REPLAY_KEY_STROKES_BUFFER  0
+#define REPLAY_CHORD_SET           1
+#define REPLAY_HASH_CHILD          2
+
+typedef struct {
+  CONST UINT8  *Digest;
+  CONST UINT8  *Data;
+  UINTN        Size;
+} REPLAY_BLOB;
+
+typedef struct {
+  UINT16                         Type;
+  UINT16                         Function;
+  UINT32                         Size;
+  CONST UINT8                    *Payload;
+} REPLAY_RECORD;
+
+typedef struct {
+  UINTN              Kind;
+  UINT64             Id;
+  UINTN              Index;
+  VOID               *Object;
+  EFI_HANDLE         Handle;
+} REPLAY_OBJECT;
+
+typedef struct {
+  UINT64  Calls;
+  UINT64  Time;
+} REPLAY_COUNTER;
+
+STATIC CONST CHAR8 *mTypeNames[APPLE_UI_SUPPORT_TRACE_MAX_TYPE] = {
+  NULL,
+  NULL,
+  "AppleImageCodec",
+  "AppleKeyMap",
+  "Hash",
+  "UnicodeCollation",
+  "FirmwareVolume"
+};
+
+STATIC CONST CHAR8 *mFunctionNames[APPLE_UI_SUPPORT_TRACE_MAX_TYPE][REPLAY_MAX_FUNCTIONS] = {
+  { NULL },
+  { NULL },
+  {
+    "RecognizeImageData",
+    "GetImageDims",
+    "DecodeImageData",
+    "GetImageDimsVer",
+    "DecodeImageDataVer"
+  },
+  {
+    "CreateKeyStrokesBuffer",
+    "RemoveKeyStrokesBuffer",
+    "SetKeyStrokeBufferKeys",
+    "GetKeyStrokes",
+    "ContainsKeyStrokes",
+    "CompileChords",
+    "MatchChords",
+    "FreeChords"
+  },
+  {
+    "CreateChild",
+    "DestroyChild",
+    "GetHashSize",
+    "Hash"
+  },
+  {
+    "StriColl",
+    "MetaiMatch",
+    "StrLwr",
+    "StrUpr",
+    "FatToStr",
+    "StrToFat"
+  },
+  {
+    "ReadSection"
+  }
+};
+
+//
+// Minimum payload size of every record type
+//
+STATIC CONST UINT32 mPayloadSizes[APPLE_UI_SUPPORT_TRACE_MAX_TYPE] = {
+  sizeof (APPLE_UI_SUPPORT_TRACE_BLOB_DATA),
+  sizeof (APPLE_UI_SUPPORT_TRACE_DROPPED_DATA),
+  sizeof (APPLE_UI_SUPPORT_TRACE_IMAGE_CODEC_DATA),
+  sizeof (APPLE_UI_SUPPORT_TRACE_KEY_MAP_DATA),
+  sizeof (APPLE_UI_SUPPORT_TRACE_HASH_DATA),
+  sizeof (APPLE_UI_SUPPORT_TRACE_COLLATION_DATA),
+  sizeof (APPLE_UI_SUPPORT_TRACE_FIRMWARE_VOLUME_DATA)
+};
+
+//
+// Protocols under test
+//
+STATIC APPLE_IMAGE_CODEC_PROTOCOL            *mImageCodec;
+STATIC APPLE_KEY_MAP_DATABASE_PROTOCOL       *mKeyMapDatabase;
+STATIC APPLE_KEY_MAP_AGGREGATOR_PROTOCOL     *mKeyMapAggregator;
+STATIC APPLE_KEY_MAP_CHORD_MATCHER_PROTOCOL  *mChordMatcher;
+STATIC EFI_SERVICE_BINDING_PROTOCOL          *mHashServiceBinding;
+STATIC EFI_UNICODE_COLLATION_PROTOCOL        *mUnicodeCollation;
+STATIC EFI_FIRMWARE_VOLUME_PROTOCOL          *mFirmwareVolume;
+
+STATIC REPLAY_BLOB     *mBlobs             = NULL;
+STATIC UINTN           mNumberOfBlobs      = 0;
+STATIC REPLAY_RECORD   *mRecords           = NULL;
+STATIC UINTN           mNumberOfRecords    = 0;
+STATIC REPLAY_OBJECT   mObjects[REPLAY_MAX_OBJECTS];
+STATIC UINTN           mNumberOfObjects    = 0;
+STATIC REPLAY_COUNTER  mCounters[APPLE_UI_SUPPORT_TRACE_MAX_TYPE][REPLAY_MAX_FUNCTIONS];
+STATIC UINT64          mDroppedCalls       = 0;
+STATIC UINT64          mSkippedCalls       = 0;
+
+//
+// Argument buffers, prepared outside of the timed calls
+//
+STATIC UINT8           *mScratch           = NULL;
+STATIC UINTN           mScratchSize        = 0;
+
+STATIC
+VOID *
+ReplayScratch (
+  IN UINTN  Size
+  )
+{
+  if (Size > mScratchSize) {
+    if (mScratch != NULL) {
+      FreePool (mScratch);
+    }
+    mScratchSize = MAX (Size, mScratchSize * 2);
+    mScratch     = AllocateZeroPool (mScratchSize);
+    if (mScratch == NULL) {
+      mScratchSize = 0;
+    }
+  }
+
+  return mScratch;
+}
+
+STATIC
+CONST REPLAY_BLOB *
+ReplayFindBlob (
+  IN CONST UINT8  *Digest
+  )
+{
+  UINTN  Index;
+
+  for (Index = 0; Index < mNumberOfBlobs; ++Index) {
+    if (CompareMem (mBlobs[Index].Digest, Digest, APPLE_UI_SUPPORT_TRACE_DIGEST_SIZE) == 0) {
+      return &mBlobs[Index];
+    }
+  }
+
+  return NULL;
+}
+
+STATIC
+REPLAY_OBJECT *
+ReplayFindObject (
+  IN UINTN   Kind,
+  IN UINT64  Id
+  )
+{
+  UINTN  Index;
+
+  for (Index = 0; Index < mNumberOfObjects; ++Index) {
+    if (mObjects[Index].Kind == Kind && mObjects[Index].Id == Id) {
+      return &mObjects[Index];
+    }
+  }
+
+  return NULL;
+}
+
+STATIC
+REPLAY_OBJECT *
+ReplayAddObject (
+  IN UINTN   Kind,
+  IN UINT64  Id
+  )
+{
+  REPLAY_OBJECT  *Object;
+
+  //
+  // Recorded ids may be reused once their object is released
+  //
+  Object = ReplayFindObject (Kind, Id);
+  if (Object == NULL) {
+    if (mNumberOfObjects == REPLAY_MAX_OBJECTS) {
+      return NULL;
+    }
+
+    Object = &mObjects[mNumberOfObjects++];
+  }
+
+  ZeroMem (Object, sizeof (*Object));
+  Object->Kind = Kind;
+  Object->Id   = Id;
+  return Object;
+}
+
+STATIC
+VOID
+ReplayRemoveObject (
+  IN REPLAY_OBJECT  *Object
+  )
+{
+  --mNumberOfObjects;
+  CopyMem (Object, &mObjects[mNumberOfObjects], sizeof (*Object));
+}
+
+STATIC
+VOID
+ReplayCount (
+  IN CONST REPLAY_RECORD  *Record,
+  IN UINT64               Start
+  )
+{
+  UINT64  End;
+
+  End = HostTimeNs ();
+  ++mCounters[Record->Type][Record->Function].Calls;
+  mCounters[Record->Type][Record->Function].Time += End - Start;
+}
+
+STATIC
+VOID
+ReplayImageCodec (
+  IN CONST REPLAY_RECORD  *Record
+  )
+{
+  CONST APPLE_UI_SUPPORT_TRACE_IMAGE_CODEC_DATA  *Data;
+  CONST REPLAY_BLOB                              *Blob;
+  EFI_GRAPHICS_OUTPUT_MODE_INFORMATION           ModeInfo;
+  APPLE_IMAGE_CODEC_GOP_DECODE_INFO              DecodeInfo;
+  VOID                                           *ImageBuffer;
+  UINTN                                          ImageSize;
+  EFI_UGA_PIXEL                                  *RawImageData;
+  UINTN                                          RawImageDataSize;
+  UINT32                                         Width;
+  UINT32                                         Height;
+  EFI_STATUS                                     Status;
+  UINT64                                         Start;
+
+  Data         = (CONST APPLE_UI_SUPPORT_TRACE_IMAGE_CODEC_DATA *) Record->Payload;
+  ImageBuffer  = NULL;
+  ImageSize    = (UINTN) Data->ImageSize;
+  RawImageData = NULL;
+
+  if (ImageSize > 0) {
+    Blob = ReplayFindBlob (Data->Digest);
+    if (Blob == NULL || Blob->Size != ImageSize) {
+      ++mSkippedCalls;
+      return;
+    }
+
+    ImageBuffer = (VOID *) Blob->Data;
+  }
+
+  Start = HostTimeNs ();
+
+  switch (Record->Function) {
+    case APPLE_UI_SUPPORT_TRACE_RECOGNIZE_IMAGE_DATA:
+      Status = mImageCodec->RecognizeImageData (ImageBuffer, ImageSize);
+      break;
+
+    case APPLE_UI_SUPPORT_TRACE_GET_IMAGE_DIMS:
+      Status = mImageCodec->GetImageDims (ImageBuffer, ImageSize, &Width, &Height);
+      break;
+
+    case APPLE_UI_SUPPORT_TRACE_DECODE_IMAGE_DATA:
+      Status = mImageCodec->DecodeImageData (ImageBuffer, ImageSize, &RawImageData, &RawImageDataSize);
+      break;
+
+    case APPLE_UI_SUPPORT_TRACE_GET_IMAGE_DIMS_VER:
+      Status = mImageCodec->GetImageDimsVer (ImageBuffer, ImageSize, (UINTN) Data->Version, &Width, &Height);
+      break;
+
+    case APPLE_UI_SUPPORT_TRACE_DECODE_IMAGE_DATA_VER:
+      if (Data->Version == APPLE_IMAGE_CODEC_DECODE_GOP_VERSION) {
+        //
+        // Mode setup is cheap enough to stay inside the timed region
+        //
+        ZeroMem (&ModeInfo, sizeof (ModeInfo));
+        ModeInfo.PixelFormat                   = (EFI_GRAPHICS_PIXEL_FORMAT) Data->PixelFormat;
+        ModeInfo.PixelInformation.RedMask      = Data->RedMask;
+        ModeInfo.PixelInformation.GreenMask    = Data->GreenMask;
+        ModeInfo.PixelInformation.BlueMask     = Data->BlueMask;
+        ModeInfo.PixelInformation.ReservedMask = Data->ReservedMask;
+
+        DecodeInfo.ModeInfo = &ModeInfo;
+        RawImageData        = (EFI_UGA_PIXEL *) &DecodeInfo;
+      }
+
+      Status = mImageCodec->DecodeImageDataVer (
+        ImageBuffer,
+        ImageSize,
+        (UINTN) Data->Version,
+        &RawImageData,
+        &RawImageDataSize
+        );
+      break;
+
+    default:
+      ++mSkippedCalls;
+      return;
+  }
+
+  ReplayCount (Record, Start);
+
+  if (!EFI_ERROR (Status)) {
+    if (RawImageData != NULL) {
+      FreePool (RawImageData);
+    }
+  }
+}
+
+STATIC
+VOID
+ReplayKeyMap (
+  IN CONST REPLAY_RECORD  *Record
+  )
+{
+  CONST APPLE_UI_SUPPORT_TRACE_KEY_MAP_DATA  *Data;
+  CONST APPLE_UI_SUPPORT_TRACE_CHORD         *TraceChords;
+  APPLE_KEY_MAP_CHORD                        *Chords;
+  APPLE_KEY_MAP_CHORD_SET                    ChordSet;
+  APPLE_KEY_CODE                             *KeyCodes;
+  UINTN                                      *ChordIds;
+  APPLE_MODIFIER_MAP                         Modifiers;
+  REPLAY_OBJECT                              *Object;
+  UINTN                                      Count;
+  UINTN                                      Index;
+  UINTN                                      Index2;
+  UINTN                                      BufferIndex;
+  EFI_STATUS                                 Status;
+  UINT64                                     Start;
+
+  Data   = (CONST APPLE_UI_SUPPORT_TRACE_KEY_MAP_DATA *) Record->Payload;
+  Count  = (UINTN) Data->Count;
+  Object = NULL;
+
+  switch (Record->Function) {
+    case APPLE_UI_SUPPORT_TRACE_CREATE_KEY_STROKES_BUFFER:
+      Start  = HostTimeNs ();
+      Status = mKeyMapDatabase->CreateKeyStrokesBuffer (mKeyMapDatabase, Count, &BufferIndex);
+      ReplayCount (Record, Start);
+
+      if (!EFI_ERROR (Status)) {
+        Object = ReplayAddObject (REPLAY_KEY_STROKES_BUFFER, Data->Id);
+        if (Object != NULL) {
+          Object->Index = BufferIndex;
+        } else {
+          mKeyMapDatabase->RemoveKeyStrokesBuffer (mKeyMapDatabase, BufferIndex);
+        }
+      }
+      break;
+
+    case APPLE_UI_SUPPORT_TRACE_REMOVE_KEY_STROKES_BUFFER:
+    case APPLE_UI_SUPPORT_TRACE_SET_KEY_STROKE_BUFFER_KEYS:
+      Object = ReplayFindObject (REPLAY_KEY_STROKES_BUFFER, Data->Id);
+      if (Object == NULL) {
+        ++mSkippedCalls;
+        break;
+      }
+
+      if (Record->Function == APPLE_UI_SUPPORT_TRACE_REMOVE_KEY_STROKES_BUFFER) {
+        Start = HostTimeNs ();
+        mKeyMapDatabase->RemoveKeyStrokesBuffer (mKeyMapDatabase, Object->Index);
+        ReplayCount (Record, Start);
+        ReplayRemoveObject (Object);
+        break;
+      }
+
+      KeyCodes = ReplayScratch (MAX (Count, 1) * sizeof (*KeyCodes));
+      if (KeyCodes == NULL) {
+        ++mSkippedCalls;
+        break;
+      }
+
+      for (Index = 0; Index < Count; ++Index) {
+        KeyCodes[Index] = REPLAY_KEY_CODE (Index);
+      }
+
+      Start = HostTimeNs ();
+      mKeyMapDatabase->SetKeyStrokeBufferKeys (
+        mKeyMapDatabase,
+        Object->Index,
+        Data->Modifiers,
+        Count,
+        KeyCodes
+        );
+      ReplayCount (Record, Start);
+      break;
+
+    case APPLE_UI_SUPPORT_TRACE_GET_KEY_STROKES:
+      KeyCodes = ReplayScratch (MAX (Count, 1) * sizeof (*KeyCodes));
+      if (KeyCodes == NULL) {
+        ++mSkippedCalls;
+        break;
+      }
+
+      Start = HostTimeNs ();
+      mKeyMapAggregator->GetKeyStrokes (mKeyMapAggregator, &Modifiers, &Count, Data->Id != 0 ? KeyCodes : NULL);
+      ReplayCount (Record, Start);
+      break;
+
+    case APPLE_UI_SUPPORT_TRACE_CONTAINS_KEY_STROKES:
+      //
+      // The call sorts the keys, so they are copied again every time
+      //
+      KeyCodes = ReplayScratch (MAX (Count, 1) * sizeof (*KeyCodes));
+      if (KeyCodes == NULL || Record->Size != sizeof (*Data) + Count * sizeof (*KeyCodes)) {
+        ++mSkippedCalls;
+        break;
+      }
+
+      CopyMem (KeyCodes, Data + 1, Count * sizeof (*KeyCodes));
+
+      Start = HostTimeNs ();
+      mKeyMapAggregator->ContainsKeyStrokes (
+        mKeyMapAggregator,
+        Data->Modifiers,
+        Count,
+        KeyCodes,
+        Data->ExactMatch
+        );
+      ReplayCount (Record, Start);
+      break;
+
+    case APPLE_UI_SUPPORT_TRACE_COMPILE_CHORDS:
+      Chords = ReplayScratch (MAX (Count, 1) * sizeof (*Chords));
+      if (Chords == NULL || Record->Size != sizeof (*Data) + Count * sizeof (*TraceChords)) {
+        ++mSkippedCalls;
+        break;
+      }
+
+      TraceChords = (CONST APPLE_UI_SUPPORT_TRACE_CHORD *) (Data + 1);
+      ZeroMem (Chords, Count * sizeof (*Chords));
+      for (Index = 0; Index < Count; ++Index) {
+        Chords[Index].ChordId          = (UINTN) TraceChords[Index].ChordId;
+        Chords[Index].Modifiers        = TraceChords[Index].Modifiers;
+        Chords[Index].ExactMatch       = TraceChords[Index].ExactMatch;
+        Chords[Index].NumberOfKeyCodes = MIN (TraceChords[Index].NumberOfKeyCodes, APPLE_KEY_MAP_CHORD_MAX_KEYS);
+        for (Index2 = 0; Index2 < Chords[Index].NumberOfKeyCodes; ++Index2) {
+          Chords[Index].KeyCodes[Index2] = TraceChords[Index].KeyCodes[Index2];
+        }
+      }
+
+      Start  = HostTimeNs ();
+      Status = mChordMatcher->CompileChords (mChordMatcher, Count, Chords, &ChordSet);
+      ReplayCount (Record, Start);
+
+      if (!EFI_ERROR (Status)) {
+        Object = ReplayAddObject (REPLAY_CHORD_SET, Data->Id);
+        if (Object != NULL) {
+          Object->Object = ChordSet;
+        } else {
+          mChordMatcher->FreeChords (mChordMatcher, ChordSet);
+        }
+      }
+      break;
+
+    case APPLE_UI_SUPPORT_TRACE_MATCH_CHORDS:
+    case APPLE_UI_SUPPORT_TRACE_FREE_CHORDS:
+      Object = ReplayFindObject (REPLAY_CHORD_SET, Data->Id);
+      if (Object == NULL) {
+        ++mSkippedCalls;
+        break;
+      }
+
+      if (Record->Function == APPLE_UI_SUPPORT_TRACE_FREE_CHORDS) {
+        Start = HostTimeNs ();
+        mChordMatcher->FreeChords (mChordMatcher, Object->Object);
+        ReplayCount (Record, Start);
+        ReplayRemoveObject (Object);
+        break;
+      }
+
+      ChordIds = ReplayScratch (MAX (Count, 1) * sizeof (*ChordIds));
+      if (ChordIds == NULL) {
+        ++mSkippedCalls;
+        break;
+      }
+
+      Start = HostTimeNs ();
+      mChordMatcher->MatchChords (mChordMatcher, Object->Object, &Count, Count > 0 ? ChordIds : NULL);
+      ReplayCount (Record, Start);
+      break;
+
+    default:
+      ++mSkippedCalls;
+      break;
+  }
+}
+
+STATIC
+VOID
+ReplayHash (
+  IN CONST REPLAY_RECORD  *Record
+  )
+{
+  CONST APPLE_UI_SUPPORT_TRACE_HASH_DATA  *Data;
+  EFI_HASH_PROTOCOL                       *Hash;
+  EFI_GUID                                HashAlgorithm;
+  EFI_HANDLE                              ChildHandle;
+  REPLAY_OBJECT                           *Object;
+  EFI_HASH_OUTPUT                         Output;
+  UINT8                                   Digest[64];
+  UINT8                                   *Message;
+  UINTN                                   HashSize;
+  EFI_STATUS                              Status;
+  UINT64                                  Start;
+
+  Data = (CONST APPLE_UI_SUPPORT_TRACE_HASH_DATA *) Record->Payload;
+
+  if (Record->Function == APPLE_UI_SUPPORT_TRACE_CREATE_CHILD) {
+    ChildHandle = NULL;
+
+    Start  = HostTimeNs ();
+    Status = mHashServiceBinding->CreateChild (mHashServiceBinding, &ChildHandle);
+    ReplayCount (Record, Start);
+
+    if (EFI_ERROR (Status)) {
+      return;
+    }
+
+    Status = gBS->HandleProtocol (ChildHandle, &gEfiHashProtocolGuid, (VOID **) &Hash);
+    Object = ReplayAddObject (REPLAY_HASH_CHILD, Data->Id);
+    if (EFI_ERROR (Status) || Object == NULL) {
+      mHashServiceBinding->DestroyChild (mHashServiceBinding, ChildHandle);
+      if (Object != NULL) {
+        ReplayRemoveObject (Object);
+      }
+      return;
+    }
+
+    Object->Handle = ChildHandle;
+    Object->Object = Hash;
+    return;
+  }
+
+  Object = ReplayFindObject (REPLAY_HASH_CHILD, Data->Id);
+  if (Object == NULL) {
+    ++mSkippedCalls;
+    return;
+  }
+
+  Hash = Object->Object;
+  CopyMem (&HashAlgorithm, &Data->HashAlgorithm, sizeof (HashAlgorithm));
+
+  switch (Record->Function) {
+    case APPLE_UI_SUPPORT_TRACE_DESTROY_CHILD:
+      Start = HostTimeNs ();
+      mHashServiceBinding->DestroyChild (mHashServiceBinding, Object->Handle);
+      ReplayCount (Record, Start);
+      ReplayRemoveObject (Object);
+      break;
+
+    case APPLE_UI_SUPPORT_TRACE_GET_HASH_SIZE:
+      Start = HostTimeNs ();
+      Hash->GetHashSize (Hash, &HashAlgorithm, &HashSize);
+      ReplayCount (Record, Start);
+      break;
+
+    case APPLE_UI_SUPPORT_TRACE_HASH_MESSAGE:
+      //
+      // Messages are not recorded, a zeroed one of the same size is hashed
+      //
+      Message = ReplayScratch (MAX ((UINTN) Data->MessageSize, 1));
+      if (Message == NULL) {
+        ++mSkippedCalls;
+        break;
+      }
+
+      ZeroMem (Message, (UINTN) Data->MessageSize);
+      Output.Sha256Hash = (EFI_SHA256_HASH *) Digest;
+
+      Start = HostTimeNs ();
+      Hash->Hash (Hash, &HashAlgorithm, Data->Extend, Message, Data->MessageSize, &Output);
+      ReplayCount (Record, Start);
+      break;
+
+    default:
+      ++mSkippedCalls;
+      break;
+  }
+}
+
+STATIC
+VOID
+ReplayCollation (
+  IN CONST REPLAY_RECORD  *Record
+  )
+{
+  CONST APPLE_UI_SUPPORT_TRACE_COLLATION_DATA  *Data;
+  UINT8                                        *Buffer;
+  CHAR16                                       *String1;
+  CHAR16                                       *String2;
+  CHAR8                                        *Fat;
+  UINTN                                        Length1;
+  UINTN                                        Length2;
+  UINTN                                        Offset2;
+  UINTN                                        BufferSize;
+  UINTN                                        Index;
+  UINT64                                       Start;
+
+  Data    = (CONST APPLE_UI_SUPPORT_TRACE_COLLATION_DATA *) Record->Payload;
+  Length1 = Data->Length1;
+  Length2 = Data->Length2;
+
+  if (Record->Size != sizeof (*Data)) {
+    ++mSkippedCalls;
+    return;
+  }
+
+  //
+  // File names are not recorded, the strings are replayed as runs of the same
+  // letter of the recorded lengths. FatToStr writes a character per FAT byte.
+  //
+  if (Record->Function == APPLE_UI_SUPPORT_TRACE_FAT_TO_STR) {
+    Length2 = Length1;
+  }
+
+  Offset2    = ALIGN_VALUE ((Length1 + 1) * sizeof (CHAR16), sizeof (UINT64));
+  BufferSize = Offset2 + (Length2 + 1) * sizeof (CHAR16);
+  Buffer     = ReplayScratch (BufferSize);
+  if (Buffer == NULL) {
+    ++mSkippedCalls;
+    return;
+  }
+
+  String1 = (CHAR16 *) Buffer;
+  String2 = (CHAR16 *) (Buffer + Offset2);
+  Fat     = (CHAR8 *) Buffer;
+
+  if (Record->Function == APPLE_UI_SUPPORT_TRACE_FAT_TO_STR) {
+    SetMem (Fat, Length1, 'A');
+    Fat[Length1] = '\0';
+  } else {
+    for (Index = 0; Index < Length1; ++Index) {
+      String1[Index] = L'a';
+    }
+    String1[Length1] = L'\0';
+  }
+
+  for (Index = 0; Index < Length2; ++Index) {
+    String2[Index] = L'a';
+  }
+  String2[Length2] = L'\0';
+
+  Start = HostTimeNs ();
+
+  switch (Record->Function) {
+    case APPLE_UI_SUPPORT_TRACE_STRI_COLL:
+      mUnicodeCollation->StriColl (mUnicodeCollation, String1, String2);
+      break;
+
+    case APPLE_UI_SUPPORT_TRACE_METAI_MATCH:
+      mUnicodeCollation->MetaiMatch (mUnicodeCollation, String1, String2);
+      break;
+
+    case APPLE_UI_SUPPORT_TRACE_STR_LWR:
+      mUnicodeCollation->StrLwr (mUnicodeCollation, String1);
+      break;
+
+    case APPLE_UI_SUPPORT_TRACE_STR_UPR:
+      mUnicodeCollation->StrUpr (mUnicodeCollation, String1);
+      break;
+
+    case APPLE_UI_SUPPORT_TRACE_FAT_TO_STR:
+      mUnicodeCollation->FatToStr (mUnicodeCollation, Length1, Fat, String2);
+      break;
+
+    case APPLE_UI_SUPPORT_TRACE_STR_TO_FAT:
+      mUnicodeCollation->StrToFat (mUnicodeCollation, String1, Length2, (CHAR8 *) String2);
+      break;
+
+    default:
+      ++mSkippedCalls;
+      return;
+  }
+
+  ReplayCount (Record, Start);
+}
+
+STATIC
+VOID
+ReplayFirmwareVolume (
+  IN CONST REPLAY_RECORD  *Record
+  )
+{
+  CONST APPLE_UI_SUPPORT_TRACE_FIRMWARE_VOLUME_DATA  *Data;
+  EFI_GUID                                           NameGuid;
+  VOID                                               *Buffer;
+  UINTN                                              BufferSize;
+  UINT32                                             AuthenticationStatus;
+  EFI_STATUS                                         Status;
+  UINT64                                             Start;
+
+  Data = (CONST APPLE_UI_SUPPORT_TRACE_FIRMWARE_VOLUME_DATA *) Record->Payload;
+
+  if (Record->Function != APPLE_UI_SUPPORT_TRACE_READ_SECTION) {
+    ++mSkippedCalls;
+    return;
+  }
+
+  CopyMem (&NameGuid, &Data->NameGuid, sizeof (NameGuid));
+  BufferSize = (UINTN) Data->BufferSize;
+  Buffer     = NULL;
+  if (BufferSize > 0) {
+    Buffer = ReplayScratch (BufferSize);
+    if (Buffer == NULL) {
+      ++mSkippedCalls;
+      return;
+    }
+  }
+
+  Start  = HostTimeNs ();
+  Status = mFirmwareVolume->ReadSection (
+    mFirmwareVolume,
+    &NameGuid,
+    Data->SectionType,
+    (UINTN) Data->SectionInstance,
+    &Buffer,
+    &BufferSize,
+    &AuthenticationStatus
+    );
+  ReplayCount (Record, Start);
+
+  if (!EFI_ERROR (Status) && Data->BufferSize == 0) {
+    FreePool (Buffer);
+  }
+}
+
+//
+// Releases objects the session left behind, outside of the timed calls
+//
+STATIC
+VOID
+ReplayReleaseObjects (
+  VOID
+  )
+{
+  REPLAY_OBJECT  *Object;
+
+  while (mNumberOfObjects > 0) {
+    Object = &mObjects[mNumberOfObjects - 1];
+    if (Object->Kind == REPLAY_KEY_STROKES_BUFFER) {
+      mKeyMapDatabase->RemoveKeyStrokesBuffer (mKeyMapDatabase, Object->Index);
+    } else if (Object->Kind == REPLAY_CHORD_SET) {
+      mChordMatcher->FreeChords (mChordMatcher, Object->Object);
+    } else {
+      mHashServiceBinding->DestroyChild (mHashServiceBinding, Object->Handle);
+    }
+
+    --mNumberOfObjects;
+  }
+}
+
+//
+// Splits the trace into records and collects the blobs they reference
+//
+STATIC
+BOOLEAN
+ReplayParse (
+  IN CONST UINT8  *Trace,
+  IN UINTN        TraceSize
+  )
+{
+  CONST APPLE_UI_SUPPORT_TRACE_HEADER        *Header;
+  CONST APPLE_UI_SUPPORT_TRACE_RECORD        *TraceRecord;
+  CONST APPLE_UI_SUPPORT_TRACE_DROPPED_DATA  *Dropped;
+  UINTN                                      Offset;
+  UINTN                                      MaxRecords;
+
+  Header = (CONST APPLE_UI_SUPPORT_TRACE_HEADER *) Trace;
+  if (TraceSize < sizeof (*Header)
+    || Header->Signature != APPLE_UI_SUPPORT_TRACE_SIGNATURE
+    || Header->Revision != APPLE_UI_SUPPORT_TRACE_REVISION) {
+    HostPrint ("Not an AppleUiSupport trace of revision %u\n", APPLE_UI_SUPPORT_TRACE_REVISION);
+    return FALSE;
+  }
+
+  //
+  // The file may end with an incomplete record when recording was cut short
+  //
+  MaxRecords = (TraceSize - sizeof (*Header)) / sizeof (*TraceRecord);
+  mRecords   = AllocatePool (MAX (MaxRecords, 1) * sizeof (*mRecords));
+  mBlobs     = AllocatePool (MAX (MaxRecords, 1) * sizeof (*mBlobs));
+  if (mRecords == NULL || mBlobs == NULL) {
+    return FALSE;
+  }
+
+  Offset = sizeof (*Header);
+  while (TraceSize - Offset >= sizeof (*TraceRecord)) {
+    TraceRecord = (CONST APPLE_UI_SUPPORT_TRACE_RECORD *) (Trace + Offset);
+    if (TraceRecord->Size > TraceSize - Offset - sizeof (*TraceRecord)) {
+      HostPrint ("Truncated record at offset %llu ignored\n", (unsigned long long) Offset);
+      break;
+    }
+
+    if (TraceRecord->Type >= APPLE_UI_SUPPORT_TRACE_MAX_TYPE
+      || TraceRecord->Function >= REPLAY_MAX_FUNCTIONS
+      || TraceRecord->Size < mPayloadSizes[TraceRecord->Type]) {
+      HostPrint ("Malformed record at offset %llu\n", (unsigned long long) Offset);
+      return FALSE;
+    }
+
+    if (TraceRecord->Type == APPLE_UI_SUPPORT_TRACE_BLOB) {
+      mBlobs[mNumberOfBlobs].Digest = (CONST UINT8 *) (TraceRecord + 1);
+      mBlobs[mNumberOfBlobs].Data   = mBlobs[mNumberOfBlobs].Digest + APPLE_UI_SUPPORT_TRACE_DIGEST_SIZE;
+      mBlobs[mNumberOfBlobs].Size   = TraceRecord->Size - APPLE_UI_SUPPORT_TRACE_DIGEST_SIZE;
+      if (ReplayFindBlob (mBlobs[mNumberOfBlobs].Digest) == NULL) {
+        ++mNumberOfBlobs;
+      }
+    } else if (TraceRecord->Type == APPLE_UI_SUPPORT_TRACE_DROPPED) {
+      Dropped        = (CONST APPLE_UI_SUPPORT_TRACE_DROPPED_DATA *) (TraceRecord + 1);
+      mDroppedCalls += Dropped->NumberOfCalls;
+    } else {
+      mRecords[mNumberOfRecords].Type     = TraceRecord->Type;
+      mRecords[mNumberOfRecords].Function = TraceRecord->Function;
+      mRecords[mNumberOfRecords].Size     = TraceRecord->Size;
+      mRecords[mNumberOfRecords].Payload  = (CONST UINT8 *) (TraceRecord + 1);
+      ++mNumberOfRecords;
+    }
+
+    Offset += sizeof (*TraceRecord) + TraceRecord->Size;
+  }
+
+  return TRUE;
+}
+
+//
+// Installs the AppleUiSupport protocols the way its entry point does
+//
+STATIC
+BOOLEAN
+ReplayInitialize (
+  VOID
+  )
+{
+  InitializeAppleImageCodec (gImageHandle, gST);
+  InitializeUnicodeCollationEng (gImageHandle, gST);
+  InitializeHashServices (gImageHandle, gST);
+  InitializeAppleKeyMapAggregator (gImageHandle, gST);
+  InitializeFirmwareVolumeInject (gImageHandle, gST);
+
+  return !EFI_ERROR (gBS->LocateProtocol (&gAppleImageCodecProtocolGuid, NULL, (VOID **) &mImageCodec))
+    && !EFI_ERROR (gBS->LocateProtocol (&gAppleKeyMapDatabaseProtocolGuid, NULL, (VOID **) &mKeyMapDatabase))
+    && !EFI_ERROR (gBS->LocateProtocol (&gAppleKeyMapAggregatorProtocolGuid, NULL, (VOID **) &mKeyMapAggregator))
+    && !EFI_ERROR (gBS->LocateProtocol (&gAppleKeyMapChordMatcherProtocolGuid, NULL, (VOID **) &mChordMatcher))
+    && !EFI_ERROR (gBS->LocateProtocol (&gEfiHashServiceBindingProtocolGuid, NULL, (VOID **) &mHashServiceBinding))
+    && !EFI_ERROR (gBS->LocateProtocol (&gEfiUnicodeCollation2ProtocolGuid, NULL, (VOID **) &mUnicodeCollation))
+    && !EFI_ERROR (gBS->LocateProtocol (&gEfiFirmwareVolumeProtocolGuid, NULL, (VOID **) &mFirmwareVolume));
+}
+
+STATIC
+VOID
+ReplayReport (
+  IN UINTN  Iterations
+  )
+{
+  UINTN   Type;
+  UINTN   Function;
+  UINT64  Calls;
+  UINT64  Time;
+  UINT64  TotalCalls;
+  UINT64  TotalTime;
+  UINT64  Average;
+
+  TotalCalls = 0;
+  TotalTime  = 0;
+
+  HostPrint ("%-42s %10s %14s %14s\n", "Call", "Calls", "Total ms", "Average us");
+
+  for (Type = 0; Type < APPLE_UI_SUPPORT_TRACE_MAX_TYPE; ++Type) {
+    for (Function = 0; Function < REPLAY_MAX_FUNCTIONS; ++Function) {
+      Calls = mCounters[Type][Function].Calls;
+      Time  = mCounters[Type][Function].Time;
+      if (Calls == 0) {
+        continue;
+      }
+
+      TotalCalls += Calls;
+      TotalTime  += Time;
+      Average     = Time / Calls;
+
+      HostPrint (
+        "%16s.%-25s %10llu %10llu.%03llu %10llu.%03llu\n",
+        mTypeNames[Type],
+        mFunctionNames[Type][Function],
+        (unsigned long long) Calls,
+        (unsigned long long) (Time / 1000000),
+        (unsigned long long) (Time / 1000 % 1000),
+        (unsigned long long) (Average / 1000),
+        (unsigned long long) (Average % 1000)
+        );
+    }
+  }
+
+  HostPrint (
+    "%-42s %10llu %10llu.%03llu\n",
+    "Total",
+    (unsigned long long) TotalCalls,
+    (unsigned long long) (TotalTime / 1000000),
+    (unsigned long long) (TotalTime / 1000 % 1000)
+    );
+
+  HostPrint (
+    "Iterations: %llu, calls dropped while recording: %llu, skipped: %llu\n",
+    (unsigned long long) Iterations,
+    (unsigned long long) mDroppedCalls,
+    (unsigned long long) mSkippedCalls
+    );
+}
+
+int
+main (
+  int   argc,
+  char  *argv[]
+  )
+{
+  VOID                *Trace;
+  unsigned long long  TraceSize;
+  UINTN               Iterations;
+  UINTN               Iteration;
+  UINTN               Index;
+  CONST CHAR8         *Argument;
+
+  if (argc < 2 || argc > 3) {
+    HostPrint (
+      "UiTraceReplay v1.0 - Replays AppleUiSupport protocol call traces.\n"
+      "Usage: UiTraceReplay <trace> [iterations]\n"
+      "Example: ./UiTraceReplay AppleUiSupport.trace 10\n"
+      );
+    return 1;
+  }
+
+  Iterations = 1;
+  if (argc == 3) {
+    Iterations = 0;
+    for (Argument = argv[2]; *Argument >= '0' && *Argument <= '9'; ++Argument) {
+      Iterations = Iterations * 10 + (UINTN) (*Argument - '0');
+    }
+
+    if (*Argument != '\0' || Iterations == 0) {
+      HostPrint ("Invalid number of iterations %s\n", argv[2]);
+      return 1;
+    }
+  }
+
+  if (HostReadFile (argv[1], &Trace, &TraceSize) != 0) {
+    HostPrint ("Cannot read %s\n", argv[1]);
+    return 1;
+  }
+
+  if (!ReplayParse (Trace, (UINTN) TraceSize)) {
+    return 1;
+  }
+
+  if (!ReplayInitialize ()) {
+    HostPrint ("AppleUiSupport protocols failed to install\n");
+    return 1;
+  }
+
+  for (Iteration = 0; Iteration < Iterations; ++Iteration) {
+    for (Index = 0; Index < mNumberOfRecords; ++Index) {
+      switch (mRecords[Index].Type) {
+        case APPLE_UI_SUPPORT_TRACE_IMAGE_CODEC:
+          ReplayImageCodec (&mRecords[Index]);
+          break;
+
+        case APPLE_UI_SUPPORT_TRACE_KEY_MAP:
+          ReplayKeyMap (&mRecords[Index]);
+          break;
+
+        case APPLE_UI_SUPPORT_TRACE_HASH:
+          ReplayHash (&mRecords[Index]);
+          break;
+
+        case APPLE_UI_SUPPORT_TRACE_COLLATION:
+          ReplayCollation (&mRecords[Index]);
+          break;
+
+        case APPLE_UI_SUPPORT_TRACE_FIRMWARE_VOLUME:
+          ReplayFirmwareVolume (&mRecords[Index]);
+          break;
+      }
+    }
+
+    ReplayReleaseObjects ();
+  }
+
+  ReplayReport (Iterations);
+  return 0;
+}